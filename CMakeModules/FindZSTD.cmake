@@ -0,0 +1,69 @@
+###############################################################################
+# CMake module to search for the zstd library.
+#
+# Defines ZSTD_INCLUDE_DIR, ZSTD_LIBRARY and ZSTD_FOUND
+#
+# Looks in $ZSTD_BIN_PATH first (e.g. brew --prefix zstd), then in C:/zstd on Windows (see WINDOWS.md)
+#
+# Redistribution and use is allowed according to the terms of the BSD license.
+# For details see the accompanying COPYING-CMAKE-SCRIPTS file.
+#
+###############################################################################
+
+#
+### Global Configuration Section
+#
+SET(_ZSTD_REQUIRED_VARS ZSTD_INCLUDE_DIR ZSTD_LIBRARY)
+
+#
+### zstd ships a pkgconfig file
+#
+if(PKG_CONFIG_FOUND)
+  pkg_check_modules(PC_ZSTD QUIET libzstd)
+endif(PKG_CONFIG_FOUND)
+
+
+#
+### Look for the include files.
+#
+find_path(
+  ZSTD_INCLUDE_DIR
+  NAMES zstd.h
+  HINTS
+      ${PC_ZSTD_INCLUDEDIR}
+      ${PC_ZSTD_INCLUDE_DIRS}
+      $ENV{ZSTD_BIN_PATH}/include
+  PATHS
+      C:/zstd/include
+  DOC "zstd include directory"
+)
+
+#
+### Look for the libraries
+#
+find_library(
+  ZSTD_LIBRARY
+  NAMES zstd zstd_static libzstd
+  HINTS
+    ${PC_ZSTD_LIBDIR}
+    ${PC_ZSTD_LIBRARY_DIRS}
+    $ENV{ZSTD_BIN_PATH}/lib
+  PATHS
+    C:/zstd/lib
+  PATH_SUFFIXES lib${LIB_SUFFIX}
+)
+
+mark_as_advanced(ZSTD_LIBRARY)
+mark_as_advanced(ZSTD_INCLUDE_DIR)
+set(ZSTD_INCLUDE_DIRS ${ZSTD_INCLUDE_DIR})
+set(ZSTD_VERSION_STRING ${PC_ZSTD_VERSION})
+
+#
+### Check if everything was found and if the version is sufficient.
+#
+include(FindPackageHandleStandardArgs)
+find_package_handle_standard_args(
+  ZSTD
+  REQUIRED_VARS ${_ZSTD_REQUIRED_VARS}
+  VERSION_VAR ZSTD_VERSION_STRING
+)
@@ -1,17 +1,46 @@
 #include <autoupdater.h>
+#include <QDebug>
+#include <QEventLoop>
+#include <algorithm>
 #ifdef Q_OS_MACOS
 #include <sys/types.h>
 #include <sys/sysctl.h>
-#include <QDebug>
 #endif
+#ifdef Q_OS_UNIX
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <unistd.h>
+#endif
+#ifdef Q_OS_LINUX
+#include <sys/syscall.h>
+#ifndef RENAME_EXCHANGE
+#define RENAME_EXCHANGE (1 << 1)
+#endif
+#endif
+#ifdef Q_OS_WIN
+#include <windows.h>
+#endif
+
+AutoUpdater::AutoUpdater(): manager(new QNetworkAccessManager(this)), raceTimer(new QTimer(this)),
+    downloadTimer(new QTimer(this)), idleTimer(new QTimer(this)) {
+    mirrorClock.start();
+
+    raceTimer->setSingleShot(true);
+    QObject::connect(raceTimer, &QTimer::timeout, this, &AutoUpdater::startNextRacer);
 
-AutoUpdater::AutoUpdater(): manager(new QNetworkAccessManager(this)) {
-    init_public_key();
+    downloadTimer->setInterval(DOWNLOAD_TICK_MS);
+    QObject::connect(downloadTimer, &QTimer::timeout, this, &AutoUpdater::downloadTick);
+
+    idleTimer->setSingleShot(true);
+    QObject::connect(idleTimer, &QTimer::timeout, this, &AutoUpdater::applySchedule);
 }
 
 // HANDLE FATAL ERRORS
 void AutoUpdater::emitFatalError(QString msg, QVariant err = QVariant()) {
-    this->abort();
+    // We're always on our own thread here; abort right away, so other downloads in progress can't finish
+    // and emit prepared() after the error. Jobs are not ours to stop: an install may be in progress
+    this->abortPerform();
     emit error(msg, err);
 }
 
@@ -55,6 +84,12 @@ void AutoUpdater::checkForUpdates(QString endpoint, QString userAgent) {
     inProgress = true; 
     QMetaObject::invokeMethod(this, "checkForUpdatesPerform", Qt::QueuedConnection, Q_ARG(QString, endpoint), Q_ARG(QString, userAgent));
 }
+void AutoUpdater::checkForUpdatesRace(QStringList endpoints, QString userAgent) {
+    if (inProgress) return;
+    inProgress = true;
+    QMetaObject::invokeMethod(this, "checkForUpdatesRacePerform", Qt::QueuedConnection, Q_ARG(QStringList, endpoints),
+                              Q_ARG(QString, userAgent));
+}
 void AutoUpdater::updateFromVersionDesc(QUrl versionDesc, QByteArray base64Sig) {
     if (inProgress) return;
     inProgress = true;
@@ -64,52 +99,412 @@ void AutoUpdater::updateFromVersionDesc(QUrl versionDesc, QByteArray base64Sig)
 void AutoUpdater::abort() {
     QMetaObject::invokeMethod(this, "abortPerform", Qt::QueuedConnection);
 }
+void AutoUpdater::abortJobs() {
+    QMetaObject::invokeMethod(this, "cancelJobs", Qt::QueuedConnection);
+}
+int AutoUpdater::startCmd(QString cmd, QStringList args) {
+    int id = nextJobId.fetchAndAddRelaxed(1);
+    QMetaObject::invokeMethod(this, "startCmdPerform", Qt::QueuedConnection, Q_ARG(int, id), Q_ARG(QString, cmd),
+                              Q_ARG(QStringList, args));
+    return id;
+}
+int AutoUpdater::moveFileToAppDirAsync(QString from) {
+    int id = nextJobId.fetchAndAddRelaxed(1);
+    QMetaObject::invokeMethod(this, "moveFileToAppDirPerform", Qt::QueuedConnection, Q_ARG(int, id), Q_ARG(QString, from));
+    return id;
+}
+// The blocking versions wait for a job, and are cancelled by abortJobs() like any other
+int AutoUpdater::executeCmd(QString cmd, QStringList args, bool noWait = false) {
+    if (noWait) {
+        QProcess::startDetached(cmd, args);
+        return -1;
+    }
+    return waitForJob([this, cmd, args](int id) {
+        QMetaObject::invokeMethod(this, "startCmdPerform", Qt::QueuedConnection, Q_ARG(int, id), Q_ARG(QString, cmd),
+                                  Q_ARG(QStringList, args));
+    });
+}
+bool AutoUpdater::moveFileToAppDir(QString from) {
+    return waitForJob([this, from](int id) {
+        QMetaObject::invokeMethod(this, "moveFileToAppDirPerform", Qt::QueuedConnection, Q_ARG(int, id),
+                                  Q_ARG(QString, from));
+    }) == 0;
+}
+void AutoUpdater::setSchedulingPolicy(QVariantMap policy) {
+    QMetaObject::invokeMethod(this, "setSchedulingPolicyPerform", Qt::QueuedConnection, Q_ARG(QVariantMap, policy));
+}
+void AutoUpdater::setPlaybackActive(bool active) {
+    QMetaObject::invokeMethod(this, "setPlaybackActivePerform", Qt::QueuedConnection, Q_ARG(bool, active));
+}
 
-// SETTINGS
 void AutoUpdater::setForceFullUpdate(bool force) {
+    QMetaObject::invokeMethod(this, "setForceFullUpdatePerform", Qt::QueuedConnection, Q_ARG(bool, force));
+}
+void AutoUpdater::setMaxConcurrentDownloads(int max) {
+    QMetaObject::invokeMethod(this, "setMaxConcurrentDownloadsPerform", Qt::QueuedConnection, Q_ARG(int, max));
+}
+void AutoUpdater::setBandwidthLimit(qint64 bytesPerSec) {
+    QMetaObject::invokeMethod(this, "setBandwidthLimitPerform", Qt::QueuedConnection, Q_ARG(qint64, bytesPerSec));
+}
+
+// SETTINGS
+// On our thread, since the downloads read them
+void AutoUpdater::setForceFullUpdatePerform(bool force) {
     forceFullUpdate = force;
 }
+void AutoUpdater::setMaxConcurrentDownloadsPerform(int max) {
+    maxConcurrentDownloads = qMax(1, max);
+    if (!downloadQueue.isEmpty()) startNextDownload();
+}
+void AutoUpdater::setBandwidthLimitPerform(qint64 bytesPerSec) {
+    bandwidthLimit = qMax(Q_INT64_C(0), bytesPerSec);
+    applySchedule();
+}
+
+// SCHEDULING
+void AutoUpdater::setSchedulingPolicyPerform(QVariantMap policy) {
+    if (policy.contains("pauseDuringPlayback")) pauseDuringPlayback = policy.value("pauseDuringPlayback").toBool();
+    if (policy.contains("playbackBandwidthLimit"))
+        playbackBandwidthLimit = qMax(Q_INT64_C(0), policy.value("playbackBandwidthLimit").toLongLong());
+    if (policy.contains("minIdleMs")) minIdleMs = qMax(0, policy.value("minIdleMs").toInt());
+    if (policy.contains("bandwidthLimit")) bandwidthLimit = qMax(Q_INT64_C(0), policy.value("bandwidthLimit").toLongLong());
+    applySchedule();
+}
+
+void AutoUpdater::setPlaybackActivePerform(bool active) {
+    if (active == playbackActive) return;
+    playbackActive = active;
+
+    // Don't go back to full speed on every short pause
+    if (active) idleTimer->stop();
+    else if (minIdleMs > 0) idleTimer->start(minIdleMs);
+    applySchedule();
+}
+
+void AutoUpdater::applySchedule() {
+    bool busy = playbackActive || idleTimer->isActive();
+    QString state = SCHEDULE_NORMAL;
+    qint64 limit = bandwidthLimit;
+    if (busy && pauseDuringPlayback) {
+        state = SCHEDULE_PAUSED;
+    } else if (busy && playbackBandwidthLimit > 0) {
+        state = SCHEDULE_THROTTLED;
+        limit = limit > 0 ? qMin(limit, playbackBandwidthLimit) : playbackBandwidthLimit;
+    }
+
+    bool wasPaused = scheduleState == SCHEDULE_PAUSED;
+    bool changed = state != scheduleState || limit != effectiveLimit;
+    scheduleState = state;
+    effectiveLimit = limit;
+
+    if (state == SCHEDULE_PAUSED) suspendDownloads();
+
+    // Switch the downloads in progress between being paced and being drained on readyRead
+    foreach (fActiveDownload* download, activeDownloads) {
+        download->reply->setReadBufferSize(effectiveLimit > 0 ? DOWNLOAD_READ_BUFFER : 0);
+        if (effectiveLimit <= 0) readDownload(download, -1);
+    }
+    foreach (BlockMapDownload* download, blockMapDownloads.keys()) {
+        download->setReadBufferSize(effectiveLimit > 0 ? DOWNLOAD_READ_BUFFER : 0);
+        download->setPaused(state == SCHEDULE_PAUSED);
+    }
+
+    if (wasPaused && state != SCHEDULE_PAUSED && downloadsHeld) {
+        downloadsHeld = false;
+        startNextDownload();
+    }
+
+    if (changed) {
+        QVariantMap schedule;
+        schedule["state"] = scheduleState;
+        schedule["playbackActive"] = playbackActive;
+        schedule["bandwidthLimit"] = effectiveLimit;
+        schedule["resumeInMs"] = idleTimer->isActive() ? idleTimer->remainingTime() : 0;
+        emit schedulingStateChanged(schedule);
+    }
+}
+
+// Stops the downloads in progress rather than stalling them, so a long pause can't time the connections out;
+// they are put back in the queue and resume from their partial state
+void AutoUpdater::suspendDownloads() {
+    QList<fActiveDownload*> downloads = activeDownloads.values();
+    activeDownloads.clear();
+    std::sort(downloads.begin(), downloads.end(), [](fActiveDownload* a, fActiveDownload* b) {
+        return a->job.index > b->job.index;
+    });
+    foreach (fActiveDownload* download, downloads) {
+        download->reply->disconnect(this);
+        download->reply->abort();
+        download->reply->deleteLater();
+        savePartialState(download);
+        download->output.close();
+        downloadQueue.prepend(download->job);
+        delete download;
+        downloadsHeld = true;
+    }
+}
 
 // UTILS 
-bool AutoUpdater::moveFileToAppDir(QString from) {
-    QDir dir;
-    QFileInfo oldFile = QFileInfo(from);
-    QString dest = QCoreApplication::applicationDirPath() +  QDir::separator() + oldFile.fileName();
-    
-    if (! QFile::exists(from)) return false;
+// Starts a job and runs an event loop until it's finished; returns its exit code, -1 if it was cancelled
+int AutoUpdater::waitForJob(std::function<void(int)> start) {
+    int id = nextJobId.fetchAndAddRelaxed(1);
+    int result = -1;
+    QEventLoop loop;
+    // Connected before the job starts, so we can't miss it finishing
+    QObject::connect(this, &AutoUpdater::jobFinished, &loop, [&loop, &result, id](int job, bool ok, int code) {
+        Q_UNUSED(ok);
+        if (job != id) return;
+        result = code;
+        loop.quit();
+    });
+    start(id);
+    loop.exec();
+    return result;
+}
+
+bool AutoUpdater::rollbackFileInAppDir(QString fileName) {
+    QString dest = QCoreApplication::applicationDirPath() + QDir::separator() + fileName;
+    QString staged = QCoreApplication::applicationDirPath() + QDir::separator() + STAGING_DIR + QDir::separator() + fileName;
+    QString rollback = staged + ROLLBACK_SUFFIX;
 
-    if (QFile::exists(dest)) {
-        if (! QFile::remove(dest)) return false;
+    if (! QFile::exists(rollback)) return false;
+
+    // The version we're rolling back from ends up staged, and is not needed anymore
+    QFile::remove(staged);
+    if (! swapIntoPlace(rollback, dest, staged)) return false;
+    QFile::remove(staged);
+    syncPath(QCoreApplication::applicationDirPath());
+    return true;
+}
+
+// Moves staged to dest, atomically replacing it; what was at dest is moved to rollback
+bool AutoUpdater::swapIntoPlace(QString staged, QString dest, QString rollback) {
+    if (! QFile::exists(dest)) return QFile::rename(staged, dest);
+
+#ifdef Q_OS_UNIX
+    QByteArray stagedPath = QFile::encodeName(staged);
+    QByteArray destPath = QFile::encodeName(dest);
+    QByteArray rollbackPath = QFile::encodeName(rollback);
+
+#if defined(Q_OS_LINUX) && defined(SYS_renameat2)
+    // The two trade places in one step; the old file is left staged
+    if (syscall(SYS_renameat2, AT_FDCWD, stagedPath.constData(), AT_FDCWD, destPath.constData(), RENAME_EXCHANGE) == 0) {
+        if (::rename(stagedPath.constData(), rollbackPath.constData()) != 0) {
+            qWarning() << "AUTOUPDATER: unable to keep a rollback copy of" << dest;
+        }
+        return true;
     }
+    // Not supported by older kernels and some filesystems
+#endif
 
-    return dir.rename(from, dest);
+    // A hard link keeps the old file, and rename() replaces the destination atomically
+    if (::link(destPath.constData(), rollbackPath.constData()) != 0 && ! QFile::copy(dest, rollback)) {
+        qWarning() << "AUTOUPDATER: unable to keep a rollback copy of" << dest;
+    }
+    return ::rename(stagedPath.constData(), destPath.constData()) == 0;
+#elif defined(Q_OS_WIN)
+    return ReplaceFileW(
+        (LPCWSTR)QDir::toNativeSeparators(dest).utf16(),
+        (LPCWSTR)QDir::toNativeSeparators(staged).utf16(),
+        (LPCWSTR)QDir::toNativeSeparators(rollback).utf16(),
+        REPLACEFILE_IGNORE_MERGE_ERRORS, NULL, NULL
+    );
+#else
+    QFile::copy(dest, rollback);
+    if (! QFile::remove(dest)) return false;
+    return QFile::rename(staged, dest);
+#endif
 }
 
-int AutoUpdater::executeCmd(QString cmd, QStringList args, bool noWait = false) {
-    QProcess proc;
+// Makes sure a file (or a directory entry) is on disk before we rely on it
+bool AutoUpdater::syncPath(QString path) {
+#ifdef Q_OS_UNIX
+    int fd = ::open(QFile::encodeName(path).constData(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return false;
+    bool ok = ::fsync(fd) == 0;
+    ::close(fd);
+    return ok;
+#else
+    // ReplaceFileW and NTFS journaling are what we get here
+    Q_UNUSED(path);
+    return true;
+#endif
+}
 
-    proc.setProcessChannelMode(QProcess::ForwardedChannels);
-    
-    if (noWait) {
-        proc.startDetached(cmd, args);
-        return -1;
+// Pulls a freshly installed file into the page cache, so the reload that follows doesn't read it cold
+void AutoUpdater::prewarmFile(QString path) {
+#ifdef Q_OS_LINUX
+    int fd = ::open(QFile::encodeName(path).constData(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return;
+    struct stat st;
+    if (::fstat(fd, &st) == 0) {
+        posix_fadvise(fd, 0, st.st_size, POSIX_FADV_WILLNEED);
+        // Unlike the advice, this waits until the data is read
+        readahead(fd, 0, st.st_size);
     }
+    ::close(fd);
+#else
+    QFile file(path);
+    if (! file.open(QIODevice::ReadOnly)) return;
+    QByteArray buf(PREWARM_READ_CHUNK, 0);
+    while (file.read(buf.data(), buf.size()) > 0) { }
+#endif
+}
 
-    proc.start(cmd, args);
+// JOBS
+void AutoUpdater::startCmdPerform(int id, QString cmd, QStringList args) {
+    QProcess* proc = new QProcess(this);
+    proc->setProcessChannelMode(QProcess::MergedChannels);
+    jobs.insert(id, proc);
+
+    QObject::connect(proc, &QProcess::readyReadStandardOutput, this, [this, id, proc]() {
+        emit jobOutput(id, QString::fromLocal8Bit(proc->readAllStandardOutput()));
+    });
+    QObject::connect(proc, QOverload<int, QProcess::ExitStatus>::of(&QProcess::finished), this,
+                     [this, id](int code, QProcess::ExitStatus status) {
+        finishJob(id, status == QProcess::NormalExit && code == 0, status == QProcess::NormalExit ? code : -1);
+    });
+    QObject::connect(proc, &QProcess::errorOccurred, this, [this, id](QProcess::ProcessError err) {
+        if (err == QProcess::FailedToStart) finishJob(id, false, -1);
+    });
+    QTimer::singleShot(JOB_TIMEOUT_MS, proc, &QProcess::kill);
+
+    proc->start(cmd, args);
+}
 
-    // We mostly need quick commands executed, and waiting for them in that func removes a huge layer of complexity
-    if (! proc.waitForFinished(5 * 60 * 1000)) return -1;
+// The new file is staged next to the destination and swapped in atomically, so a crash at any point leaves
+// either the old or the new file installed; the old one is kept for rollbackFileInAppDir()
+void AutoUpdater::moveFileToAppDirPerform(int id, QString from) {
+    QVariantMap progress;
+    progress["file"] = from;
+    progress["stage"] = "installing";
+    emit jobProgress(id, progress);
+
+    QString stagingDir = QCoreApplication::applicationDirPath() + QDir::separator() + STAGING_DIR;
+    QString staged = stagingDir + QDir::separator() + QFileInfo(from).fileName();
+    if (! QFile::exists(from) || ! QDir().mkpath(stagingDir)) {
+        emit jobFinished(id, false, 1);
+        return;
+    }
+    QFile::remove(staged);
+
+    // Same filesystem: nothing to copy
+    if (QDir().rename(from, staged)) {
+        bool ok = installStaged(from, staged);
+        emit jobFinished(id, ok, ok ? 0 : 1);
+        return;
+    }
+
+    // tempPath is often on another filesystem; the copy is done a chunk at a time, so it can be cancelled
+    fMoveJob* move = new fMoveJob();
+    move->from = from;
+    move->in.setFileName(from);
+    move->out.setFileName(staged);
+    moveJobs.insert(id, move);
+    if (! move->in.open(QIODevice::ReadOnly) || ! move->out.open(QIODevice::WriteOnly)) {
+        finishMove(id, false);
+        return;
+    }
+    QMetaObject::invokeMethod(this, "moveFileStep", Qt::QueuedConnection, Q_ARG(int, id));
+}
+
+void AutoUpdater::moveFileStep(int id) {
+    // Not there if it's been cancelled
+    fMoveJob* move = moveJobs.value(id);
+    if (move == NULL) return;
+
+    QByteArray chunk = move->in.read(MOVE_COPY_CHUNK);
+    if (chunk.isEmpty()) {
+        finishMove(id, move->in.atEnd());
+        return;
+    }
+    if (move->out.write(chunk) != chunk.size()) {
+        finishMove(id, false);
+        return;
+    }
+
+    QVariantMap progress;
+    progress["file"] = move->from;
+    progress["stage"] = "copying";
+    progress["done"] = move->out.size();
+    progress["total"] = move->in.size();
+    emit jobProgress(id, progress);
+    QMetaObject::invokeMethod(this, "moveFileStep", Qt::QueuedConnection, Q_ARG(int, id));
+}
+
+// Installs a copied file, or cleans up after one that was cancelled or failed
+void AutoUpdater::finishMove(int id, bool copied, int failCode) {
+    fMoveJob* move = moveJobs.take(id);
+    if (move == NULL) return;
+    QString from = move->from;
+    QString staged = move->out.fileName();
+    move->in.close();
+    if (! move->out.flush()) copied = false;
+    move->out.close();
+    delete move;
+
+    if (! copied) {
+        QFile::remove(staged);
+        emit jobFinished(id, false, failCode);
+        return;
+    }
+    QFile::remove(from);
+    bool ok = installStaged(from, staged);
+    emit jobFinished(id, ok, ok ? 0 : 1);
+}
+
+bool AutoUpdater::installStaged(QString from, QString staged) {
+    QString appDir = QCoreApplication::applicationDirPath();
+    QString stagingDir = appDir + QDir::separator() + STAGING_DIR;
+    QString dest = appDir + QDir::separator() + QFileInfo(staged).fileName();
+
+    if (! syncPath(staged)) {
+        QFile::remove(staged);
+        return false;
+    }
 
-    return proc.exitCode();
+    QString rollback = staged + ROLLBACK_SUFFIX;
+    QFile::remove(rollback);
+    if (! swapIntoPlace(staged, dest, rollback)) {
+        QFile::remove(staged);
+        return false;
+    }
+    syncPath(stagingDir);
+    syncPath(appDir);
+
+    checksumCache.moved(from, dest);
+    prewarmFile(dest);
+    return true;
+}
+
+void AutoUpdater::finishJob(int id, bool ok, int code) {
+    // Not there if it's already finished, or cancelled
+    QProcess* proc = jobs.take(id);
+    if (proc == NULL) return;
+    proc->deleteLater();
+    emit jobFinished(id, ok, code);
+}
+
+void AutoUpdater::cancelJobs() {
+    foreach (int id, jobs.keys()) {
+        QProcess* proc = jobs.value(id);
+        proc->disconnect(this);
+        proc->kill();
+        finishJob(id, false, -1);
+    }
+    // The file in place is left alone; the partial copy is removed
+    foreach (int id, moveJobs.keys()) finishMove(id, false, -1);
 }
 
 // CHECK FOR UPDATES
-void AutoUpdater::checkForUpdatesPerform(QString endpoint, QString userAgent)
+QNetworkRequest AutoUpdater::checkRequest(QUrl url, QString userAgent)
 {
-    QByteArray serverHash = getFileChecksum(QCoreApplication::applicationDirPath() +  QDir::separator() + SERVER_FNAME);
-    QByteArray asarHash = getFileChecksum(QCoreApplication::applicationDirPath() +  QDir::separator() + ASAR_FNAME);
+    QList<QByteArray> sums = checksumCache.checksums(QStringList()
+        << QCoreApplication::applicationDirPath() +  QDir::separator() + SERVER_FNAME
+        << QCoreApplication::applicationDirPath() +  QDir::separator() + ASAR_FNAME);
+    QByteArray serverHash = sums[0];
+    QByteArray asarHash = sums[1];
 
-    QUrl url = QUrl(endpoint);
     QUrlQuery query = QUrlQuery(url);
 
     query.addQueryItem("serverSum", serverHash.toHex());
@@ -119,7 +514,12 @@ void AutoUpdater::checkForUpdatesPerform(QString endpoint, QString userAgent)
     url.setQuery(query);
     auto request = QNetworkRequest(QUrl(url));
     request.setRawHeader("User-Agent", userAgent.toUtf8());
-    currentCheck = manager->get(request);
+    return request;
+}
+
+void AutoUpdater::checkForUpdatesPerform(QString endpoint, QString userAgent)
+{
+    currentCheck = manager->get(checkRequest(QUrl(endpoint), userAgent));
     QObject::connect(currentCheck, &QNetworkReply::finished, this, &AutoUpdater::checkForUpdatesFinished);
 }
 
@@ -138,23 +538,13 @@ void AutoUpdater::checkForUpdatesFinished()
         QJsonParseError *error = NULL;
         QJsonDocument jsonResponse = QJsonDocument::fromJson(reply->readAll(), error);
 
-        emit checkFinished(jsonResponse.toVariant());
-
         if (jsonResponse.isObject()) {
-            QJsonObject obj = jsonResponse.object();
-            
-            if (obj.value("upToDate").toBool()) {
-                // NO NEW VERSION, DO NOTHING
-                inProgress = false;
-            } else {
-                updateFromVersionDescPerform(
-                    QUrl(obj.value("versionDesc").toString()),
-                    QByteArray::fromBase64(obj.value("signature").toString().toUtf8())
-                );
-            }
+            processCheck(jsonResponse);
         } else if (error) {
+            emit checkFinished(jsonResponse.toVariant());
             emitFatalError("JSON parse error on checkForUpdates "+error->errorString());
         } else {
+            emit checkFinished(jsonResponse.toVariant());
             emitFatalError("Unable to understand response from checkForUpdates");
         }
 
@@ -164,6 +554,102 @@ void AutoUpdater::checkForUpdatesFinished()
     }
 }
 
+void AutoUpdater::processCheck(QJsonDocument jsonResponse)
+{
+    emit checkFinished(jsonResponse.toVariant());
+
+    QJsonObject obj = jsonResponse.object();
+    if (obj.value("upToDate").toBool()) {
+        // NO NEW VERSION, DO NOTHING
+        inProgress = false;
+    } else {
+        updateFromVersionDescPerform(
+            QUrl(obj.value("versionDesc").toString()),
+            QByteArray::fromBase64(obj.value("signature").toString().toUtf8())
+        );
+    }
+}
+
+// Happy eyeballs for mirrors: a slow mirror gets company after RACE_STAGGER_MS, and a failed one is replaced
+// right away, so a dead mirror doesn't cost us a network timeout
+void AutoUpdater::checkForUpdatesRacePerform(QStringList endpoints, QString userAgent)
+{
+    QList<QUrl> urls;
+    foreach (const QString &endpoint, endpoints) urls.append(QUrl(endpoint));
+    raceQueue = mirrorStats.order(urls);
+    raceUserAgent = userAgent;
+    raceError = QString();
+    raceErrorCode = QVariant();
+
+    if (raceQueue.isEmpty()) {
+        emitFatalError("internal error - no endpoints to check for updates");
+        return;
+    }
+    startNextRacer();
+}
+
+void AutoUpdater::startNextRacer()
+{
+    if (raceQueue.isEmpty()) return;
+
+    QNetworkReply* reply = manager->get(checkRequest(raceQueue.takeFirst(), raceUserAgent));
+    reply->setProperty("startedAt", mirrorClock.elapsed());
+    QObject::connect(reply, &QNetworkReply::finished, this, &AutoUpdater::raceReplyFinished);
+    raceReplies.append(reply);
+
+    if (!raceQueue.isEmpty()) raceTimer->start(RACE_STAGGER_MS);
+}
+
+void AutoUpdater::raceReplyFinished()
+{
+    QNetworkReply* reply = qobject_cast<QNetworkReply*>(sender());
+    // Not there if the race is over
+    if (reply == NULL || !raceReplies.removeOne(reply)) return;
+    reply->deleteLater();
+
+    // The endpoint we asked, rather than where we got redirected to
+    QUrl mirror = reply->request().url();
+
+    QJsonDocument jsonResponse;
+    if (reply->error() == QNetworkReply::NoError) jsonResponse = QJsonDocument::fromJson(reply->readAll());
+    if (jsonResponse.isObject()) {
+        mirrorStats.recordSuccess(mirror, mirrorClock.elapsed() - reply->property("startedAt").toLongLong());
+        cancelRace();
+        processCheck(jsonResponse);
+        return;
+    }
+
+    mirrorStats.recordFailure(mirror);
+    if (reply->error() != QNetworkReply::NoError) {
+        raceError = "Network error on checkForUpdates "+mirror.host();
+        raceErrorCode = reply->error();
+    } else {
+        raceError = "Unable to understand response from checkForUpdates "+mirror.host();
+        raceErrorCode = QVariant();
+    }
+
+    if (!raceQueue.isEmpty()) {
+        raceTimer->stop();
+        startNextRacer();
+    } else if (raceReplies.isEmpty()) {
+        emitFatalError(raceError, raceErrorCode);
+    }
+}
+
+void AutoUpdater::cancelRace()
+{
+    raceTimer->stop();
+    raceQueue.clear();
+
+    QList<QNetworkReply*> replies = raceReplies;
+    raceReplies.clear();
+    foreach (QNetworkReply* reply, replies) {
+        reply->disconnect(this);
+        reply->abort();
+        reply->deleteLater();
+    }
+}
+
 
 // GET & VERIFY (SIGNATURE) VERSION DESC
 void AutoUpdater::updateFromVersionDescPerform(QUrl versionDesc, QByteArray base64Sig) {
@@ -186,6 +672,7 @@ void AutoUpdater::updateFromVersionDescFinished() {
         QByteArray dataReply = reply->readAll();
         QByteArray sig = reply->property("signature").toByteArray();
 
+        InitScheduler::instance()->ensure("public key");
         if (verify_sig(
             (const byte*)dataReply.data(), dataReply.size(), 
             (const byte*)sig.data(), sig.length()
@@ -237,39 +724,219 @@ void AutoUpdater::prepareUpdate(QJsonDocument versionDescDoc) {
 
         if (! (file.contains("url") && file.contains("checksum"))) continue;
 
-        enqueueDownload(
-            QUrl(file.value("url").toString()), 
-            QByteArray::fromHex(file.value("checksum").toString().toUtf8())
-        );
+        QUrl url = pickMirror(QUrl(file.value("url").toString()), file.value("mirrors").toArray());
+        QByteArray checksum = QByteArray::fromHex(file.value("checksum").toString().toUtf8());
+
+        // Files we have installed may come with patches against them, keyed by the checksum of what we have;
+        // the patch checksums are covered by the versionDesc signature
+        QString installed = QCoreApplication::applicationDirPath() +  QDir::separator() + prop;
+        QJsonObject patches = file.value("patches").toObject();
+        if (!patches.isEmpty() && QFile::exists(installed)) {
+            QJsonObject patch = patches.value(QString(getFileChecksum(installed).toHex())).toObject();
+            if (patch.contains("url") && patch.contains("checksum")) {
+                enqueuePatch(
+                    QUrl(patch.value("url").toString()),
+                    QByteArray::fromHex(patch.value("checksum").toString().toUtf8()),
+                    installed, url, checksum
+                );
+                continue;
+            }
+        }
+
+        // Full packages come with a block map, so we only fetch what changed since the version we run
+        QJsonObject blockMap = file.value("blockMap").toObject();
+        QString source = blockSourcePath(prop);
+        if (blockMap.contains("url") && blockMap.contains("checksum") && !source.isEmpty()) {
+            enqueueBlockMapDownload(
+                url, checksum,
+                QUrl(blockMap.value("url").toString()),
+                QByteArray::fromHex(blockMap.value("checksum").toString().toUtf8()),
+                source
+            );
+            continue;
+        }
+
+        // Smaller on the wire, and the same file once decompressed
+        QJsonObject zstd = file.value("zstd").toObject();
+        if (zstd.contains("url") && zstd.contains("checksum")) {
+            enqueueCompressedDownload(
+                pickMirror(QUrl(zstd.value("url").toString()), zstd.value("mirrors").toArray()),
+                QByteArray::fromHex(zstd.value("checksum").toString().toUtf8()),
+                url, checksum
+            );
+            continue;
+        }
+
+        enqueueDownload(url, checksum);
     }
 
     startNextDownload();
 }
 
 
+// Files may list mirrors of url; the checksum is what makes any of them good
+QUrl AutoUpdater::pickMirror(QUrl url, QJsonArray mirrors) {
+    if (mirrors.isEmpty()) return url;
+    QList<QUrl> urls;
+    urls.append(url);
+    foreach (const QJsonValue &mirror, mirrors) urls.append(QUrl(mirror.toString()));
+    return mirrorStats.order(urls).first();
+}
+
 // DOWNLOAD & VERIFY (CHECKSUM)
 QByteArray AutoUpdater::getFileChecksum(QString path) {
-    QCryptographicHash crypto(QCryptographicHash::Sha256);
-    QFile file(path);
-    file.open(QFile::ReadOnly);
-    while (!file.atEnd()) { crypto.addData(file.read(FILE_READ_CHUNK)); }
-    return crypto.result();
+    return checksumCache.checksum(path);
+}
+
+// The local copy of a full package that blocks can be reused from, if any
+QString AutoUpdater::blockSourcePath(QString prop) {
+#ifdef Q_OS_LINUX
+    // Set by the AppImage runtime to the image we're running from
+    QString appImage = QProcessEnvironment::systemEnvironment().value("APPIMAGE");
+    if (prop == "linux" && !appImage.isEmpty() && QFileInfo(appImage).isFile()) return appImage;
+#else
+    Q_UNUSED(prop);
+#endif
+    return QString();
 }
 
 void AutoUpdater::enqueueDownload(QUrl from, QByteArray checksum) {
-    downloadQueue.enqueue(fDownload(from, checksum));
+    fDownload next;
+    next.index = enqueuedCount++;
+    next.url = from;
+    next.checksum = checksum;
+    downloadQueue.enqueue(next);
+}
+
+void AutoUpdater::enqueuePatch(QUrl from, QByteArray checksum, QString base, QUrl targetUrl, QByteArray targetChecksum) {
+    fDownload next;
+    next.index = enqueuedCount++;
+    next.url = from;
+    next.checksum = checksum;
+    next.patchBase = base;
+    next.targetUrl = targetUrl;
+    next.targetChecksum = targetChecksum;
+    downloadQueue.enqueue(next);
+}
+
+void AutoUpdater::enqueueBlockMapDownload(QUrl from, QByteArray checksum, QUrl blockMap, QByteArray blockMapChecksum,
+                                          QString source) {
+    fDownload next;
+    next.index = enqueuedCount++;
+    next.url = from;
+    next.checksum = checksum;
+    next.blockMapUrl = blockMap;
+    next.blockMapChecksum = blockMapChecksum;
+    next.blockSource = source;
+    downloadQueue.enqueue(next);
+}
+
+void AutoUpdater::enqueueCompressedDownload(QUrl from, QByteArray checksum, QUrl targetUrl, QByteArray targetChecksum) {
+    fDownload next;
+    next.index = enqueuedCount++;
+    next.url = from;
+    next.checksum = checksum;
+    next.targetUrl = targetUrl;
+    next.targetChecksum = targetChecksum;
+    next.compressed = true;
+    downloadQueue.enqueue(next);
+}
+
+// Applies a downloaded patch to a staged copy in tempPath; the installed file is left untouched
+void AutoUpdater::finishPatch(fDownload job, QString patchPath) {
+    QString dest = QDir::tempPath() + QDir::separator() + job.targetUrl.fileName();
+    QString err;
+    QByteArray actual = applyPatch(job.patchBase, patchPath, dest, err);
+    QFile::remove(patchPath);
+
+    if (!err.isEmpty()) {
+        QFile::remove(dest);
+        fallbackToFullDownload(job, err);
+    } else if (actual != job.targetChecksum) {
+        QFile::remove(dest);
+        fallbackToFullDownload(job, "checksum mismatch after patching "+job.patchBase);
+    } else {
+        checksumCache.insert(dest, actual);
+        preparedFiles.insert(job.index, dest);
+    }
+}
+
+// Falls back to downloading the whole, uncompressed file
+void AutoUpdater::fallbackToFullDownload(fDownload job, QString reason) {
+    qWarning() << "AUTOUPDATER:" << job.url.toString() << "failed:" << reason;
+
+    fDownload full;
+    full.index = job.index;
+    full.url = job.targetUrl;
+    full.checksum = job.targetChecksum;
+    downloadQueue.prepend(full);
+}
+
+// Returns the SHA-256 of the patched file; err is set on failure
+QByteArray AutoUpdater::applyPatch(QString basePath, QString patchPath, QString dest, QString &err) {
+    QFile base(basePath);
+    QFile patch(patchPath);
+    QFile output(dest);
+    if (!base.open(QIODevice::ReadOnly) || !patch.open(QIODevice::ReadOnly) || !output.open(QIODevice::WriteOnly)) {
+        err = "unable to open files for patching";
+        return QByteArray();
+    }
+
+    // The old file is the zstd prefix, and has to stay in memory while decoding
+    QByteArray baseBuffer;
+    const char* baseData = base.size() ? (const char*)base.map(0, base.size()) : NULL;
+    if (!baseData) {
+        baseBuffer = base.readAll();
+        baseData = baseBuffer.constData();
+    }
+
+    QCryptographicHash hash(QCryptographicHash::Sha256);
+    ZstdDecoder decoder;
+    if (decoder.setPrefix(baseData, base.size())) {
+        while (!patch.atEnd()) {
+            QByteArray in = patch.read(PATCH_READ_CHUNK);
+            QByteArray out;
+            if (!decoder.feed(in.constData(), in.size(), out)) break;
+            if (output.write(out) != out.size()) {
+                err = "unable to write "+dest+": "+output.errorString();
+                break;
+            }
+            hash.addData(out);
+        }
+    }
+    if (err.isEmpty() && !decoder.error().isEmpty()) err = decoder.error();
+    if (err.isEmpty() && !decoder.finished()) err = "truncated patch";
+
+    output.close();
+    base.close();
+    return err.isEmpty() ? hash.result() : QByteArray();
+}
+
+int AutoUpdater::downloadsInProgress() {
+    return activeDownloads.size() + blockMapDownloads.size();
 }
 
 void AutoUpdater::startNextDownload() {
-    if (downloadQueue.isEmpty()) {
+    while (!downloadQueue.isEmpty() && downloadsInProgress() < maxConcurrentDownloads) {
+        // Held back until playback has been over for a while
+        if (scheduleState == SCHEDULE_PAUSED) {
+            downloadsHeld = true;
+            return;
+        }
+        // false means a fatal error was emitted and we're aborted
+        if (!startDownload(downloadQueue.dequeue())) return;
+    }
+
+    if (downloadQueue.isEmpty() && downloadsInProgress() == 0) {
+        downloadTimer->stop();
         inProgress = false;
-        emit prepared(preparedFiles, QVariant(currentVersionDesc.object()));
-        return;
+        emit prepared(preparedFiles.values(), QVariant(currentVersionDesc.object()));
     }
+}
 
-    fDownload next = downloadQueue.dequeue();
-    QUrl url = next.first;
-    QByteArray checksum = next.second;
+bool AutoUpdater::startDownload(fDownload next) {
+    QUrl url = next.url;
+    QByteArray checksum = next.checksum;
 
     // WARNING: TODO: do we want to make a separate dir inside tempPath? ; we should ensure downloadFile always overrides
     QString dest = QDir::tempPath() + QDir::separator() + url.fileName();
@@ -280,54 +947,479 @@ void AutoUpdater::startNextDownload() {
     //   this would actually prevent a case where the version descriptor is generated from empty files from breaking
     // the system - because this check would return true, and then the file wouldn't exist at all, emitting an error
     // (this shouldn't be able to happen, but still...)
-    if (checksum == getFileChecksum(dest)) {
-        preparedFiles.push_back(dest);
-        startNextDownload();
-        return;
+    if (! next.patchBase.isEmpty() || next.compressed) {
+        QString target = QDir::tempPath() + QDir::separator() + next.targetUrl.fileName();
+        if (next.targetChecksum == getFileChecksum(target)) {
+            preparedFiles.insert(next.index, target);
+            return true;
+        }
+    }
+    if (next.compressed) {
+        // Decompressed straight to where the uncompressed file would be downloaded
+        dest = QDir::tempPath() + QDir::separator() + next.targetUrl.fileName();
+    } else if (! next.patchBase.isEmpty()) {
+        // Never where it's applied to, whatever the patch is called
+        dest = QDir::tempPath() + QDir::separator() + next.targetUrl.fileName() + PATCH_SUFFIX;
+    }
+    if (! next.compressed && checksum == getFileChecksum(dest)) {
+        if (next.patchBase.isEmpty()) preparedFiles.insert(next.index, dest);
+        else finishPatch(next, dest);
+        return true;
+    }
+
+    if (! next.blockSource.isEmpty()) {
+        startBlockMapDownload(next, dest);
+        return true;
+    }
+
+    // Start the download, or resume it if we've got part of it from last time
+    fActiveDownload* download = new fActiveDownload();
+    download->job = next;
+    download->output.setFileName(dest);
+
+    if (next.compressed) {
+        download->decoder.reset(new ZstdDecoder());
+        removePartialState(dest);
+    }
+
+    QNetworkRequest request(url);
+    if (! next.compressed && resumeDownload(download)) {
+        request.setRawHeader("Range", "bytes="+QByteArray::number(download->resumedFrom)+"-");
+        // If the file changed since, the server will send all of it
+        if (!download->etag.isEmpty()) request.setRawHeader("If-Range", download->etag);
+    } else if (!download->output.open(QIODevice::WriteOnly)) {
+        QString err = download->output.errorString();
+        delete download;
+        emitFatalError("error opening file "+dest+" for download: "+err);
+        return false;
+    }
+
+    download->reply = manager->get(request);
+    download->startedAt = mirrorClock.elapsed();
+    // Unlimited downloads are drained on readyRead; limited ones are paced by downloadTick(), and the small
+    // read buffer makes the reply stop reading from the socket in the meantime
+    if (effectiveLimit > 0) download->reply->setReadBufferSize(DOWNLOAD_READ_BUFFER);
+    QObject::connect(download->reply, &QNetworkReply::readyRead, this, &AutoUpdater::downloadReadyRead);
+    QObject::connect(download->reply, &QNetworkReply::finished, this, &AutoUpdater::downloadFinished);
+    activeDownloads.insert(download->reply, download);
+
+    if (!downloadTimer->isActive()) {
+        downloadTokens = 0;
+        ticksSinceProgress = 0;
+        bytesSinceProgress = 0;
+        downloadTimer->start();
+    }
+    return true;
+}
+
+// Block map downloads make their own range requests; like the other downloads, they are paced by downloadTick()
+// when bandwidth limited
+void AutoUpdater::startBlockMapDownload(fDownload next, QString dest) {
+    // Whatever a full download left there is overwritten
+    removePartialState(dest);
+
+    BlockMapDownload* download = new BlockMapDownload(manager, this);
+    QObject::connect(download, &BlockMapDownload::finished, this, &AutoUpdater::blockMapDownloadFinished);
+    blockMapDownloads.insert(download, next);
+    if (effectiveLimit > 0) download->setReadBufferSize(DOWNLOAD_READ_BUFFER);
+    download->start(next.url, next.blockMapUrl, next.blockMapChecksum, next.blockSource, dest);
+
+    if (!downloadTimer->isActive()) {
+        downloadTokens = 0;
+        ticksSinceProgress = 0;
+        bytesSinceProgress = 0;
+        downloadTimer->start();
+    }
+}
+
+void AutoUpdater::blockMapDownloadFinished(bool ok, QString err, QByteArray actual) {
+    BlockMapDownload* download = qobject_cast<BlockMapDownload*>(sender());
+    // Not there if we've been aborted
+    if (download == NULL || !blockMapDownloads.contains(download)) return;
+    fDownload job = blockMapDownloads.take(download);
+    QString dest = download->destination();
+    download->deleteLater();
+
+    if (ok && actual == job.checksum) {
+        qDebug() << "AUTOUPDATER: assembled" << dest << "reusing" << download->reused() << "bytes, fetched"
+                 << download->fetched();
+        checksumCache.insert(dest, actual);
+        preparedFiles.insert(job.index, dest);
+    } else {
+        qWarning() << "AUTOUPDATER: block map download of" << job.url.toString() << "failed:"
+                   << (ok ? QString("checksum mismatch") : err);
+        QFile::remove(dest);
+
+        fDownload full;
+        full.index = job.index;
+        full.url = job.url;
+        full.checksum = job.checksum;
+        downloadQueue.prepend(full);
+    }
+    startNextDownload();
+}
+
+// Reads up to maxBytes (everything if negative) from the reply into the output file
+qint64 AutoUpdater::readDownload(fActiveDownload* download, qint64 maxBytes) {
+    QByteArray data = maxBytes < 0 ? download->reply->readAll() : download->reply->read(maxBytes);
+    if (data.isEmpty()) return 0;
+
+    bytesSinceProgress += data.size();
+    if (!download->responseChecked && !checkDownloadResponse(download)) download->invalid = true;
+    if (download->invalid) return data.size();
+
+    download->received += data.size();
+    download->hash.addData(data);
+
+    if (download->decoder) {
+        QByteArray out;
+        if (!download->decoder->feed(data.constData(), data.size(), out)) {
+            download->invalid = true;
+            return data.size();
+        }
+        if (download->output.write(out) != out.size()) {
+            failDownloadWrite(download);
+            return data.size();
+        }
+        download->outputHash.addData(out);
+        return data.size();
     }
 
-    // Start the download
-    output.setFileName(dest);
-    if (!output.open(QIODevice::WriteOnly)) {
-        emitFatalError("error opening file "+dest+" for download: "+output.errorString());
+    // Nothing that wasn't written makes it into the chunk hashes, so the partial state stays true to the file
+    if (download->output.write(data) != data.size()) {
+        failDownloadWrite(download);
+        return data.size();
+    }
+
+    // Keep per-chunk hashes, so that we can trust what we have on disk if we need to resume
+    const char* ptr = data.constData();
+    qint64 left = data.size();
+    while (left > 0) {
+        qint64 n = qMin(left, PARTIAL_CHUNK_SIZE - download->chunkFill);
+        download->chunkHash.addData(ptr, (int)n);
+        download->chunkFill += n;
+        ptr += n;
+        left -= n;
+        if (download->chunkFill == PARTIAL_CHUNK_SIZE) {
+            download->chunks.append(download->chunkHash.result());
+            download->chunkHash.reset();
+            download->chunkFill = 0;
+            savePartialState(download);
+        }
+    }
+
+    return data.size();
+}
+
+// Disk full or the like: nothing more is written, and downloadFinished() fails the download
+void AutoUpdater::failDownloadWrite(fActiveDownload* download) {
+    if (download->writeError.isEmpty()) download->writeError = download->output.errorString();
+    download->invalid = true;
+    // Queued, since we're called from the reply's signals
+    QMetaObject::invokeMethod(download->reply, "abort", Qt::QueuedConnection);
+}
+
+// Called when the first data arrives; returns false if we can't use the response
+bool AutoUpdater::checkDownloadResponse(fActiveDownload* download) {
+    QNetworkReply* reply = download->reply;
+    download->responseChecked = true;
+
+    int status = reply->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt();
+    QByteArray etag = reply->rawHeader("ETag");
+    if (!etag.isEmpty()) download->etag = etag;
+    qint64 length = reply->header(QNetworkRequest::ContentLengthHeader).toLongLong();
+
+    // An error page; the reply will finish with an error
+    if (status >= 400) return false;
+    mirrorStats.recordSuccess(download->job.url, mirrorClock.elapsed() - download->startedAt);
+
+    if (download->resumedFrom > 0 && status == 206) {
+        QByteArray range = reply->rawHeader("Content-Range");
+        if (!range.startsWith("bytes "+QByteArray::number(download->resumedFrom)+"-")) {
+            removePartialState(download->output.fileName());
+            return false;
+        }
+        if (length > 0) download->total = download->resumedFrom + length;
+        return true;
+    }
+
+    if (download->resumedFrom > 0) {
+        // The server ignored the range (or the file changed): start over
+        download->output.resize(0);
+        download->output.seek(0);
+        download->hash.reset();
+        download->chunkHash.reset();
+        download->chunks.clear();
+        download->chunkFill = 0;
+        download->received = 0;
+        download->resumedFrom = 0;
+    }
+    if (length > 0) download->total = length;
+    return true;
+}
+
+// Picks up a partial download from the state left by a previous attempt; the output is left open if so
+bool AutoUpdater::resumeDownload(fActiveDownload* download) {
+    QString dest = download->output.fileName();
+    QFile stateFile(dest + PARTIAL_STATE_SUFFIX);
+    if (!stateFile.open(QIODevice::ReadOnly)) return false;
+    QJsonObject state = QJsonDocument::fromJson(stateFile.readAll()).object();
+    stateFile.close();
+
+    QJsonArray chunks = state.value("chunks").toArray();
+    if (state.value("url").toString() != download->job.url.toString()
+        || QByteArray::fromHex(state.value("checksum").toString().toUtf8()) != download->job.checksum
+        || state.value("chunkSize").toInt() != PARTIAL_CHUNK_SIZE
+        || chunks.isEmpty()
+        || !download->output.open(QIODevice::ReadWrite)
+    ) {
+        removePartialState(dest);
+        return false;
+    }
+
+    // Re-hash what we have, checking it against the chunk hashes; this is the only time we read it back
+    qint64 offset = 0;
+    foreach (const QJsonValue &expected, chunks) {
+        QByteArray chunk = download->output.read(PARTIAL_CHUNK_SIZE);
+        if (chunk.size() != PARTIAL_CHUNK_SIZE
+            || QCryptographicHash::hash(chunk, QCryptographicHash::Sha256).toHex() != expected.toString().toLatin1()
+        ) break;
+        download->hash.addData(chunk);
+        download->chunks.append(QByteArray::fromHex(expected.toString().toLatin1()));
+        offset += chunk.size();
+    }
+
+    if (offset == 0) {
+        download->output.close();
+        download->hash.reset();
+        download->chunks.clear();
+        removePartialState(dest);
+        return false;
+    }
+
+    download->output.resize(offset);
+    download->output.seek(offset);
+    download->received = offset;
+    download->resumedFrom = offset;
+    download->etag = state.value("etag").toString().toLatin1();
+    return true;
+}
+
+void AutoUpdater::savePartialState(fActiveDownload* download) {
+    if (download->invalid || download->decoder || download->chunks.isEmpty()) return;
+
+    QJsonArray chunks;
+    foreach (const QByteArray &chunk, download->chunks) chunks.append(QString(chunk.toHex()));
+
+    QJsonObject state;
+    state["url"] = download->job.url.toString();
+    state["checksum"] = QString(download->job.checksum.toHex());
+    state["etag"] = QString::fromLatin1(download->etag);
+    state["chunkSize"] = PARTIAL_CHUNK_SIZE;
+    state["offset"] = (qint64)download->chunks.size() * PARTIAL_CHUNK_SIZE;
+    state["chunks"] = chunks;
+
+    if (!download->output.flush()) {
+        failDownloadWrite(download);
         return;
     }
+    QFile stateFile(download->output.fileName() + PARTIAL_STATE_SUFFIX);
+    if (stateFile.open(QIODevice::WriteOnly)) stateFile.write(QJsonDocument(state).toJson(QJsonDocument::Compact));
+}
 
-    currentDownload = manager->get(QNetworkRequest(url));
-    currentDownload->setProperty("checksum", checksum);
-    QObject::connect(currentDownload, &QNetworkReply::readyRead, this, &AutoUpdater::downloadReadyRead);
-    QObject::connect(currentDownload, &QNetworkReply::finished, this, &AutoUpdater::downloadFinished);
+void AutoUpdater::removePartialState(QString dest) {
+    QFile::remove(dest + PARTIAL_STATE_SUFFIX);
 }
 
 void AutoUpdater::downloadReadyRead()
 {
-    output.write(currentDownload->readAll());
+    fActiveDownload* download = activeDownloads.value(qobject_cast<QNetworkReply*>(sender()));
+    if (download && effectiveLimit <= 0) readDownload(download, -1);
+}
+
+void AutoUpdater::downloadTick()
+{
+    if (effectiveLimit > 0) {
+        // Refill; the bucket holds at most one second worth of tokens
+        downloadTokens = qMin(downloadTokens + effectiveLimit * DOWNLOAD_TICK_MS / 1000, effectiveLimit);
+
+        // Share the tokens fairly between the downloads that have something to read
+        QList<fActiveDownload*> pending;
+        foreach (fActiveDownload* download, activeDownloads) {
+            if (download->reply->bytesAvailable() > 0) pending.append(download);
+        }
+        QList<BlockMapDownload*> pendingBlockMaps;
+        foreach (BlockMapDownload* download, blockMapDownloads.keys()) {
+            if (download->bytesAvailable() > 0) pendingBlockMaps.append(download);
+        }
+        while (downloadTokens > 0 && !(pending.isEmpty() && pendingBlockMaps.isEmpty())) {
+            qint64 share = qMax(Q_INT64_C(1), downloadTokens / (pending.size() + pendingBlockMaps.size()));
+            foreach (fActiveDownload* download, pending) {
+                downloadTokens -= readDownload(download, qMin(share, downloadTokens));
+                if (download->reply->bytesAvailable() <= 0) pending.removeOne(download);
+                if (downloadTokens <= 0) break;
+            }
+            foreach (BlockMapDownload* download, pendingBlockMaps) {
+                if (downloadTokens <= 0) break;
+                qint64 n = download->read(qMin(share, downloadTokens));
+                downloadTokens -= n;
+                bytesSinceProgress += n;
+                // Also when it's done: that was its last range
+                if (download->bytesAvailable() <= 0) pendingBlockMaps.removeOne(download);
+            }
+        }
+    }
+
+    if (++ticksSinceProgress >= DOWNLOAD_PROGRESS_TICKS) emitDownloadProgress();
+}
+
+void AutoUpdater::emitDownloadProgress()
+{
+    QVariantList files;
+    qint64 received = 0;
+    qint64 total = 0;
+    foreach (fActiveDownload* download, activeDownloads) {
+        QVariantMap file;
+        file["file"] = download->output.fileName();
+        file["url"] = download->reply->url().toString();
+        file["received"] = download->received;
+        file["total"] = download->total;
+        files.append(file);
+        received += download->received;
+        if (download->total > 0) total += download->total;
+    }
+    foreach (BlockMapDownload* download, blockMapDownloads.keys()) {
+        QVariantMap file;
+        file["file"] = download->destination();
+        file["url"] = blockMapDownloads.value(download).url.toString();
+        file["received"] = download->reused() + download->fetched();
+        file["total"] = download->size() > 0 ? download->size() : -1;
+        file["reused"] = download->reused();
+        files.append(file);
+        received += download->reused() + download->fetched();
+        total += download->size();
+    }
+
+    QVariantMap progress;
+    progress["files"] = files;
+    progress["received"] = received;
+    progress["total"] = total;
+    progress["queued"] = downloadQueue.size();
+    progress["bytesPerSec"] = ticksSinceProgress ? bytesSinceProgress * 1000 / (ticksSinceProgress * DOWNLOAD_TICK_MS) : 0;
+    progress["bandwidthLimit"] = effectiveLimit;
+    progress["schedule"] = scheduleState;
+
+    ticksSinceProgress = 0;
+    bytesSinceProgress = 0;
+
+    emit downloadProgress(progress);
 }
 
 void AutoUpdater::downloadFinished()
 {
-    output.close();
+    QNetworkReply* reply = qobject_cast<QNetworkReply*>(sender());
+    if (reply == NULL) {
+        emitFatalError("internal error - no reply on downloadFinished");
+        return;
+    }
+    reply->deleteLater();
 
-    if (currentDownload == NULL) {
-        emitFatalError("internal error - currentDownload NULL on downloadFinished");
+    // Not there if we've been aborted
+    fActiveDownload* download = activeDownloads.take(reply);
+    if (download == NULL) return;
+
+    // A 416 has no body, so it never gets to checkDownloadResponse(); what we have doesn't fit the file
+    int status = reply->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt();
+    bool rangeRejected = status == 416 && download->resumedFrom > 0;
+
+    // There may be data left that the bandwidth limiter didn't get to yet
+    if (reply->error() == QNetworkReply::NoError) readDownload(download, -1);
+    // Keep what we've got, so the next attempt can resume
+    else if (!rangeRejected) savePartialState(download);
+    if (download->writeError.isEmpty() && !download->output.flush()) download->writeError = download->output.errorString();
+    download->output.close();
+
+    QString dest = download->output.fileName();
+    fDownload job = download->job;
+    QByteArray actual = download->hash.result();
+    bool invalid = download->invalid;
+    QString writeError = download->writeError;
+    QString decodeError;
+    if (download->decoder) {
+        decodeError = download->decoder->error();
+        if (decodeError.isEmpty() && !download->decoder->finished()) decodeError = "truncated";
+    }
+    QByteArray decompressed = download->outputHash.result();
+    delete download;
+
+    // Before the cancelled check: failDownloadWrite() is what aborted the reply
+    if (!writeError.isEmpty()) {
+        removePartialState(dest);
+        QFile::remove(dest);
+        emitFatalError("Unable to write file "+dest+": "+writeError);
         return;
     }
+    if (reply->error() == QNetworkReply::OperationCanceledError) return;
 
-    QNetworkReply* reply = currentDownload;
-    reply->deleteLater();
-    currentDownload = NULL;
+    if (rangeRejected) {
+        removePartialState(dest);
+        QFile::remove(dest);
+        qDebug() << "AUTOUPDATER: range not satisfiable, downloading all of" << dest;
+        downloadQueue.prepend(job);
+        startNextDownload();
+        return;
+    }
+    if (reply->error() != QNetworkReply::NoError) mirrorStats.recordFailure(job.url);
+
+    // A compressed file that can't be used just means we download it uncompressed
+    if (job.compressed) {
+        if (reply->error() != QNetworkReply::NoError) {
+            QFile::remove(dest);
+            fallbackToFullDownload(job, "network error "+QString::number(reply->error()));
+        } else if (invalid || job.checksum != actual) {
+            QFile::remove(dest);
+            fallbackToFullDownload(job, "unable to verify compressed checksum");
+        } else if (!decodeError.isEmpty() || job.targetChecksum != decompressed) {
+            QFile::remove(dest);
+            fallbackToFullDownload(job, "unable to decompress: "+(decodeError.isEmpty() ? QString("checksum mismatch") : decodeError));
+        } else {
+            checksumCache.insert(dest, decompressed);
+            preparedFiles.insert(job.index, dest);
+        }
+        startNextDownload();
+        return;
+    }
 
-    if (reply->error() == QNetworkReply::NoError) {
-        QString dest = output.fileName();
-        QByteArray checksum = reply->property("checksum").toByteArray();
+    // A patch that can't be used just means we download the whole file
+    if (! job.patchBase.isEmpty()) {
+        if (reply->error() != QNetworkReply::NoError) {
+            fallbackToFullDownload(job, "network error "+QString::number(reply->error()));
+        } else {
+            removePartialState(dest);
+            if (! invalid && job.checksum == actual) {
+                finishPatch(job, dest);
+            } else {
+                QFile::remove(dest);
+                fallbackToFullDownload(job, "unable to verify patch checksum");
+            }
+        }
+        startNextDownload();
+        return;
+    }
 
-        if (checksum == getFileChecksum(dest)) {
-            preparedFiles.push_back(dest);
+    if (reply->error() == QNetworkReply::NoError) {
+        removePartialState(dest);
+        if (invalid) {
+            emitFatalError("Unable to resume download of file "+dest);
+        } else if (job.checksum == actual) {
+            checksumCache.insert(dest, actual);
+            preparedFiles.insert(job.index, dest);
             startNextDownload();
         } else {
+            QFile::remove(dest);
             emitFatalError("Unable to verify checksum for file "+dest);
         }
-    } else if (reply->error() != QNetworkReply::OperationCanceledError) {
+    } else {
         emitFatalError("Network error on downloadFinished "+reply->url().toString(), reply->error());
     }
 }
@@ -340,14 +1432,30 @@ void AutoUpdater::abortPerform() {
     // .abort() will re-set currentCheck before the 'finished' handler is executed
     // This is not a problem, because all public methods call the internal ones with invokeMethod and queuedConnection
     if (currentCheck) currentCheck->abort();
-    if (currentDownload) currentDownload->abort();
+    cancelRace();
+
+    // Take them out first, so downloadFinished() ignores the replies we abort
+    QHash<QNetworkReply*, fActiveDownload*> downloads = activeDownloads;
+    activeDownloads.clear();
+    foreach (fActiveDownload* download, downloads) {
+        download->reply->abort();
+        savePartialState(download);
+        download->output.close();
+        delete download;
+    }
+    foreach (BlockMapDownload* download, blockMapDownloads.keys()) {
+        download->abort();
+        download->deleteLater();
+    }
+    blockMapDownloads.clear();
+    downloadTimer->stop();
+    downloadsHeld = false;
 
     currentVersionDesc = QJsonDocument();
 
     downloadQueue = QQueue<fDownload>();
-    preparedFiles = QVariantList();
-
-    output.close();
+    preparedFiles = QMap<int, QVariant>();
+    enqueuedCount = 0;
 
     inProgress = false;
 }
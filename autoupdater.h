@@ -10,28 +10,53 @@
 #include <QJsonObject>
 #include <QDir>
 #include <QFile>
+#include <QCryptographicHash>
 #include <QThread>
 #include <QUrl>
 #include <QUrlQuery>
 #include <QProcessEnvironment>
 #include <QQueue>
+#include <QHash>
+#include <QMap>
+#include <QTimer>
+#include <QElapsedTimer>
+#include <QScopedPointer>
+#include <QAtomicInt>
 #include <QVector>
 #include <QProcess>
 #include <QNetworkConfigurationManager>
+#include <functional>
+
+#include "blockmapdownload.h"
+#include "checksumcache.h"
+#include "mirrorstats.h"
+#include "zstddecoder.h"
+#include "initscheduler.h"
 
 // Mixing C and C++ :(
 extern "C" {
 #include <verifysig.h>
 }
 
-#define FILE_READ_CHUNK 8192
-
 // TODO Move to somewhere? Document that we can override?
 #define SERVER_FNAME "server.js"
 #define ASAR_FNAME "stremio.asar"
 
 #define PARTIAL_UPDATE_FILES { SERVER_FNAME, ASAR_FNAME }
 
+// Files are installed through a staging dir inside the app dir, where the previous version is also kept
+#define STAGING_DIR ".stremio-staging"
+#define ROLLBACK_SUFFIX ".rollback"
+#define PREWARM_READ_CHUNK (1024 * 1024)
+
+// Jobs are commands and file operations run on our thread; commands are killed after that long
+#define JOB_TIMEOUT_MS (5 * 60 * 1000)
+// Files moved across filesystems are copied in chunks of that much, so the move can be cancelled
+#define MOVE_COPY_CHUNK (4 * 1024 * 1024)
+
+// Update checks race the mirrors, starting the next one if the previous hasn't answered in that long
+#define RACE_STAGGER_MS 250
+
 #if defined(Q_OS_WIN)
     #define FULL_UPDATE_FILES { "windows" }
 #elif defined(Q_OS_MACOS)
@@ -42,7 +67,84 @@ extern "C" {
     #define FULL_UPDATE_FILES { }
 #endif
 
-typedef QPair<QUrl, QByteArray> fDownload;
+// Reading from the network is paced in ticks, so we can apply a bandwidth limit
+#define DOWNLOAD_TICK_MS 100
+#define DOWNLOAD_PROGRESS_TICKS 10
+// When bandwidth limited, how much a reply is allowed to buffer before it stops reading from the socket
+#define DOWNLOAD_READ_BUFFER (64 * 1024)
+#define DEFAULT_MAX_CONCURRENT_DOWNLOADS 2
+
+// Downloads are paused or throttled while playing, and for that long after playback stops
+#define DEFAULT_MIN_IDLE_MS (30 * 1000)
+#define SCHEDULE_NORMAL "normal"
+#define SCHEDULE_THROTTLED "throttled"
+#define SCHEDULE_PAUSED "paused"
+
+struct fDownload {
+    int index; // position in the list of prepared files
+    QUrl url;
+    QByteArray checksum;
+
+    // Set if url is a patch (zstd --patch-from) against the installed patchBase; the patched file must match
+    // targetChecksum, and targetUrl is downloaded instead if anything goes wrong
+    QString patchBase;
+    QUrl targetUrl;
+    QByteArray targetChecksum;
+
+    // Set if url is the zstd compressed targetUrl; it's decompressed as it arrives, and the fallback is the same
+    bool compressed = false;
+
+    // Set if the file can be assembled from blocks of blockSource (see BlockMapDownload); url is downloaded
+    // in full if that fails
+    QUrl blockMapUrl;
+    QByteArray blockMapChecksum;
+    QString blockSource;
+};
+
+struct fMoveJob {
+    QString from;
+    QFile in;
+    QFile out; // staged
+};
+
+#define PATCH_READ_CHUNK (256 * 1024)
+// Patches are downloaded next to the file they make, under its name with this appended
+#define PATCH_SUFFIX ".patch"
+
+// Partially downloaded files are kept in tempPath with a sidecar holding the state needed to resume them;
+// only whole chunks with matching hashes are resumed
+#define PARTIAL_STATE_SUFFIX ".partial"
+#define PARTIAL_CHUNK_SIZE (1024 * 1024)
+
+struct fActiveDownload {
+    fDownload job;
+    QNetworkReply* reply = NULL;
+    QFile output;
+    qint64 received = 0;
+    qint64 total = -1;
+
+    // Hashed while streaming, so verifying costs nothing at the end
+    QCryptographicHash hash{QCryptographicHash::Sha256};
+    QCryptographicHash chunkHash{QCryptographicHash::Sha256};
+    QList<QByteArray> chunks;
+    qint64 chunkFill = 0;
+
+    // For the mirror stats
+    qint64 startedAt = 0;
+
+    // Compressed downloads are hashed both ways: hash is of what we got, outputHash of what we wrote
+    QScopedPointer<ZstdDecoder> decoder;
+    QCryptographicHash outputHash{QCryptographicHash::Sha256};
+
+    // Resuming; not for compressed downloads
+    qint64 resumedFrom = 0;
+    QByteArray etag;
+    bool responseChecked = false;
+    bool invalid = false;
+
+    // Set if writing to output failed; the download is failed rather than resumed
+    QString writeError;
+};
 
 class AutoUpdater : public QObject
 {
@@ -54,27 +156,60 @@ class AutoUpdater : public QObject
     public slots:
     bool isInstalled();
     void checkForUpdates(QString, QString);
+    // Races the endpoints, fastest healthy mirror first; the first valid response wins
+    void checkForUpdatesRace(QStringList, QString);
     void updateFromVersionDesc(QUrl, QByteArray);
 
+    // Stops checks and downloads; jobs in progress are left alone, so an install is never cut short by a check
     void abort();
+    // Cancels the jobs in progress; only for when the user asks for it
+    void abortJobs();
 
     void setForceFullUpdate(bool);
+    void setMaxConcurrentDownloads(int);
+    // bytes per second for all downloads together; 0 means unlimited
+    void setBandwidthLimit(qint64);
+    // pauseDuringPlayback, playbackBandwidthLimit, minIdleMs, bandwidthLimit; missing keys are left as they are
+    void setSchedulingPolicy(QVariantMap);
+    void setPlaybackActive(bool);
 
+    // These wait for a job; cancelled by abortJobs() like the others
     bool moveFileToAppDir(QString);
+    // Puts back the version of a file that moveFileToAppDir() replaced
+    bool rollbackFileInAppDir(QString);
     int executeCmd(QString, QStringList, bool);
 
+    // Async versions of the above; they return a job id, and report through the job signals
+    int startCmd(QString, QStringList);
+    int moveFileToAppDirAsync(QString);
+
     signals:
     void performPing();
     void networkStatus(bool);
     void error(QString, QVariant);
     void checkFinished(QVariant);
     void prepared(QVariantList, QVariant);
+    void downloadProgress(QVariant);
+    void schedulingStateChanged(QVariant);
+
+    void jobOutput(int, QString);
+    void jobProgress(int, QVariant);
+    // ok means the command exited with 0, or the file operation succeeded; jobs cancelled by abortJobs() fail
+    void jobFinished(int, bool, int);
 
     private slots:
     void abortPerform();
+    void cancelJobs();
 
     void checkForUpdatesPerform(QString, QString);
     void checkForUpdatesFinished();
+    void checkForUpdatesRacePerform(QStringList, QString);
+    void startNextRacer();
+    void raceReplyFinished();
+
+    void startCmdPerform(int, QString, QStringList);
+    void moveFileToAppDirPerform(int, QString);
+    void moveFileStep(int);
 
     void updateFromVersionDescPerform(QUrl, QByteArray);
     void updateFromVersionDescFinished();
@@ -83,31 +218,106 @@ class AutoUpdater : public QObject
 
     void downloadFinished();
     void downloadReadyRead();
+    void downloadTick();
+    void blockMapDownloadFinished(bool, QString, QByteArray);
+
+    void setForceFullUpdatePerform(bool);
+    void setMaxConcurrentDownloadsPerform(int);
+    void setBandwidthLimitPerform(qint64);
+    void setSchedulingPolicyPerform(QVariantMap);
+    void setPlaybackActivePerform(bool);
+    void applySchedule();
 
     void emitFatalError(QString, QVariant);
 
     private:
+    QNetworkRequest checkRequest(QUrl, QString);
+    void processCheck(QJsonDocument);
+    void cancelRace();
+    void finishJob(int, bool, int);
+    void finishMove(int, bool, int failCode = 1);
+    bool installStaged(QString, QString);
+    int waitForJob(std::function<void(int)>);
+    QUrl pickMirror(QUrl, QJsonArray);
+
     void enqueueDownload(QUrl, QByteArray);
+    void enqueuePatch(QUrl, QByteArray, QString, QUrl, QByteArray);
+    void enqueueBlockMapDownload(QUrl, QByteArray, QUrl, QByteArray, QString);
+    void enqueueCompressedDownload(QUrl, QByteArray, QUrl, QByteArray);
+    void finishPatch(fDownload, QString);
+    void fallbackToFullDownload(fDownload, QString);
+    QByteArray applyPatch(QString, QString, QString, QString&);
     void startNextDownload();
+    bool startDownload(fDownload);
+    void startBlockMapDownload(fDownload, QString);
+    int downloadsInProgress();
+    qint64 readDownload(fActiveDownload*, qint64);
+    void failDownloadWrite(fActiveDownload*);
+    bool checkDownloadResponse(fActiveDownload*);
+    bool resumeDownload(fActiveDownload*);
+    void savePartialState(fActiveDownload*);
+    void removePartialState(QString);
+    void emitDownloadProgress();
+    void suspendDownloads();
 
     QByteArray getFileChecksum(QString);
+    QString blockSourcePath(QString);
+
+    bool swapIntoPlace(QString, QString, QString);
+    static bool syncPath(QString);
+    static void prewarmFile(QString);
 
     QNetworkAccessManager* manager = NULL;
 
+    ChecksumCache checksumCache;
+    MirrorStats mirrorStats;
+    QElapsedTimer mirrorClock;
+
     // State; must be reset on abort
     QJsonDocument currentVersionDesc;
 
     QNetworkReply* currentCheck = NULL;
-    QNetworkReply* currentDownload = NULL;
 
-    QFile output;
+    // Commands and file copies in progress, by job id
+    QHash<int, QProcess*> jobs;
+    QHash<int, fMoveJob*> moveJobs;
+    QAtomicInt nextJobId{1};
+
+    // Mirrors still to try, and the checks in flight
+    QList<QUrl> raceQueue;
+    QList<QNetworkReply*> raceReplies;
+    QTimer* raceTimer = NULL;
+    QString raceUserAgent;
+    QString raceError;
+    QVariant raceErrorCode;
 
-    // Download queue, prepared files
+    // Download queue, downloads in progress, prepared files (by index, to keep the order of the versionDesc)
     QQueue<fDownload> downloadQueue;
-    QVariantList preparedFiles;
+    QHash<QNetworkReply*, fActiveDownload*> activeDownloads;
+    QHash<BlockMapDownload*, fDownload> blockMapDownloads;
+    QMap<int, QVariant> preparedFiles;
+    int enqueuedCount = 0;
+
+    // Token bucket shared by all downloads
+    QTimer* downloadTimer = NULL;
+    qint64 downloadTokens = 0;
+    int ticksSinceProgress = 0;
+    qint64 bytesSinceProgress = 0;
 
     // options
     bool forceFullUpdate = false;
+    int maxConcurrentDownloads = DEFAULT_MAX_CONCURRENT_DOWNLOADS;
+    qint64 bandwidthLimit = 0;
+    bool pauseDuringPlayback = false;
+    qint64 playbackBandwidthLimit = 0;
+    int minIdleMs = DEFAULT_MIN_IDLE_MS;
+
+    // scheduling; effectiveLimit is what the token bucket actually uses
+    bool playbackActive = false;
+    QTimer* idleTimer = NULL;
+    QString scheduleState = SCHEDULE_NORMAL;
+    qint64 effectiveLimit = 0;
+    bool downloadsHeld = false;
 
     // progress tracking
     bool inProgress = false;
@@ -23,9 +23,18 @@
 
         var endpointArg = "--autoupdater-endpoint="
         args.forEach(function(arg) { if (arg.indexOf(endpointArg) === 0) endpoints = [arg.slice(endpointArg.length)] })
-        autoUpdater.endpoint = function() {
-            return endpoints[Math.floor(Math.random()*endpoints.length)]
-        }
+
+        var maxDownloadsArg = "--autoupdater-max-downloads="
+        var bandwidthArg = "--autoupdater-bandwidth-limit=" // bytes per second
+        args.forEach(function(arg) {
+            if (arg.indexOf(maxDownloadsArg) === 0) autoUpdater.setMaxConcurrentDownloads(parseInt(arg.slice(maxDownloadsArg.length), 10))
+            if (arg.indexOf(bandwidthArg) === 0) autoUpdater.setBandwidthLimit(parseInt(arg.slice(bandwidthArg.length), 10))
+        })
+
+        // Don't compete with playback for bandwidth; the UI can change this with "autoupdater-scheduling-policy"
+        var schedulingPolicy = { pauseDuringPlayback: false, playbackBandwidthLimit: 256 * 1024, minIdleMs: 30 * 1000 }
+        if (args.indexOf("--autoupdater-pause-during-playback") > -1) schedulingPolicy.pauseDuringPlayback = true
+        autoUpdater.setSchedulingPolicy(schedulingPolicy)
 
         if (! doAutoupdate) {
             console.log("Auto-updater: skipping, possibly not running an installed app?")
@@ -36,7 +45,7 @@
         shortTimer.triggered.connect(onTriggered = function() {
             console.log("Auto-updater: checking for new version")
             autoUpdater.abort()
-            autoUpdater.checkForUpdates(autoUpdater.endpoint(), userAgent)
+            autoUpdater.checkForUpdatesRace(endpoints, userAgent)
         });
         onTriggered(); // initial check
 
@@ -63,6 +72,40 @@
             autoUpdaterErr(msg, err);
         });
 
+        autoUpdater.downloadProgress.connect(function(progress) {
+            root.autoUpdaterProgress(progress);
+        });
+        root.autoUpdaterProgress.connect(function(progress) {
+            transport.event("autoupdater-progress", progress);
+        });
+
+        autoUpdater.schedulingStateChanged.connect(function(schedule) {
+            root.autoUpdaterSchedule(schedule);
+        });
+        root.autoUpdaterSchedule.connect(function(schedule) {
+            console.log("Auto-updater: downloads "+schedule.state)
+            transport.event("autoupdater-schedule", schedule);
+        });
+
+        // Commands and file operations run as jobs on the updater's thread, so they don't freeze the UI; their
+        // signals are brought back to the main thread like the others
+        var jobCallbacks = {}
+        function onJobFinished(id, cb) { jobCallbacks[id] = cb }
+        autoUpdater.jobFinished.connect(function(id, ok, code) {
+            root.autoUpdaterJobFinished(id, ok, code);
+        });
+        autoUpdater.jobOutput.connect(function(id, output) {
+            root.autoUpdaterJobOutput(id, output);
+        });
+        root.autoUpdaterJobFinished.connect(function(id, ok, code) {
+            var cb = jobCallbacks[id]
+            delete jobCallbacks[id]
+            if (cb) cb(ok, code)
+        });
+        root.autoUpdaterJobOutput.connect(function(id, output) {
+            console.log("Auto-updater: job "+id+": "+output.trim())
+        });
+
         autoUpdaterErr.connect(function(msg, err) {
             // send to front-end, so we can handle accordingly
             transport.queueEvent("autoupdater-error", {
@@ -76,9 +119,7 @@
 
             if (errorCounter <= 0) {
                 errorCounter = MAX_ERROR_COUNT;
-                errorDialog.text = "Oops! Stremio wasn't able to autoupdate because it's unable to connect to strem.io or stremio.com. Please check your internet connection, make sure you're not offline. If the problem persists, please send a screenshot of the following error message:"
-                errorDialog.detailedText = msg
-                errorDialog.visible = true
+                root.showErrorDialog("Oops! Stremio wasn't able to autoupdate because it's unable to connect to strem.io or stremio.com. Please check your internet connection, make sure you're not offline. If the problem persists, please send a screenshot of the following error message:", msg)
             } else {
                 errorCounter--;
             }
@@ -98,20 +139,31 @@
                 // Prepare partial auto-update
                 //
                 console.log("Auto-updater: executing partial update")
-                var failed = false
-                preparedFiles.forEach(function(f) { if (!autoUpdater.moveFileToAppDir(f)) failed = true })
-                if (failed) {
-                    autoUpdaterErr("preparing partial update failed", null)
-                    return
-                }
-                transport.queueEvent("autoupdater-show-notif", { mode: "reload" })
-                autoUpdater.onNotifClicked = function() {
-                    splashScreen.visible = true
-                    pulseOpacity.running = true
-                    webView.reloadAndBypassCache()
-                    streamingServer.fastReload = true
-                    streamingServer.terminate()
+                var installed = []
+                var installNext = function(i) {
+                    if (i === preparedFiles.length) {
+                        transport.queueEvent("autoupdater-show-notif", { mode: "reload" })
+                        autoUpdater.onNotifClicked = function() {
+                            splashScreen.visible = true
+                            pulseOpacity.running = true
+                            webView.reloadAndBypassCache()
+                            streamingServer.fastReload = true
+                            streamingServer.terminate()
+                        }
+                        return
+                    }
+                    onJobFinished(autoUpdater.moveFileToAppDirAsync(preparedFiles[i]), function(ok) {
+                        if (!ok) {
+                            // Never leave a mix of old and new files
+                            installed.forEach(function(name) { autoUpdater.rollbackFileInAppDir(name) })
+                            autoUpdaterErr("preparing partial update failed", null)
+                            return
+                        }
+                        installed.push(preparedFiles[i].split(/[\\/]/).pop())
+                        installNext(i + 1)
+                    })
                 }
+                installNext(0)
             } else if (Qt.platform.os === "osx" && firstFile && firstFile.match(".dmg$")) {
                 // 
                 // Prepare macOS auto-update (extract from .dmg)
@@ -135,17 +187,18 @@
                     +"; hdiutil detach \"$MNT\"" 
                 ];
 
-                var code = autoUpdater.executeCmd("/bin/sh", args, false)
-                if (code !== 0) {
-                    autoUpdaterErr("preparing macOS .app failed", null);
-                    return;
-                }
-
-                transport.queueEvent("autoupdater-show-notif", { mode: "restart" })
-                autoUpdater.onNotifClicked = function() {
-                    autoUpdater.executeCmd("/bin/sh", ["-c", "sleep 5; open -n /Applications/Stremio.app"], true)
-                    quitApp();
-                }
+                onJobFinished(autoUpdater.startCmd("/bin/sh", args), function(ok, code) {
+                    if (code !== 0) {
+                        autoUpdaterErr("preparing macOS .app failed", null);
+                        return;
+                    }
+
+                    transport.queueEvent("autoupdater-show-notif", { mode: "restart" })
+                    autoUpdater.onNotifClicked = function() {
+                        autoUpdater.executeCmd("/bin/sh", ["-c", "sleep 5; open -n /Applications/Stremio.app"], true)
+                        quitApp();
+                    }
+                })
             } else if ( Qt.platform.os === "windows" && firstFile && firstFile.match(".exe") ) {
                 // 
                 // Prepare launch-based auto-update (launch new installer/appimage on Windows)
@@ -162,18 +215,20 @@
                 console.log("Auto-updater: executing Linux update");
                 
                 var baseName = firstFile.split("/").pop()
-                var code = autoUpdater.executeCmd("/bin/sh",
-                                                  ["-c", "mv '"+firstFile+"' $HOME; chmod +x $HOME/'"+baseName+"'"], false)
-                if (code !== 0) {
-                    autoUpdaterErr("preparing Linux .appimage failed", null);
-                    return;
-                }
-                transport.queueEvent("autoupdater-show-notif", { mode: "launchNew" })
-                autoUpdater.onNotifClicked = function() {
-                    autoUpdater.executeCmd("/bin/sh", ["-c", "$HOME/'"+baseName+"'"], true)
-                                    // crappy, but otherwise we have to write code to get env var
-                    quitApp();
-                }
+                var cmd = autoUpdater.startCmd("/bin/sh",
+                                               ["-c", "mv '"+firstFile+"' $HOME; chmod +x $HOME/'"+baseName+"'"])
+                onJobFinished(cmd, function(ok, code) {
+                    if (code !== 0) {
+                        autoUpdaterErr("preparing Linux .appimage failed", null);
+                        return;
+                    }
+                    transport.queueEvent("autoupdater-show-notif", { mode: "launchNew" })
+                    autoUpdater.onNotifClicked = function() {
+                        autoUpdater.executeCmd("/bin/sh", ["-c", "$HOME/'"+baseName+"'"], true)
+                                        // crappy, but otherwise we have to write code to get env var
+                        quitApp();
+                    }
+                })
             } else {
                 autoUpdaterErr("Insane auto-update: "+preparedFiles.join(", "), null)
             }
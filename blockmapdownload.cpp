@@ -0,0 +1,282 @@
+#include "blockmapdownload.h"
+#include "checksumcache.h"
+
+#include <QCryptographicHash>
+#include <QDebug>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QNetworkRequest>
+
+#include <string.h>
+
+#define MD5_SIZE 16
+
+BlockMapDownload::BlockMapDownload(QNetworkAccessManager* manager, QObject *parent)
+    : QObject(parent), manager(manager) { }
+
+void BlockMapDownload::start(QUrl fileUrl, QUrl blockMapUrl, QByteArray checksum, QString source, QString dest) {
+    url = fileUrl;
+    blockMapChecksum = checksum;
+    sourcePath = source;
+    output.setFileName(dest);
+
+    reply = manager->get(QNetworkRequest(blockMapUrl));
+    QObject::connect(reply, &QNetworkReply::finished, this, &BlockMapDownload::blockMapFinished);
+}
+
+void BlockMapDownload::abort() {
+    done = true;
+    stop();
+}
+
+void BlockMapDownload::stop() {
+    if (reply) {
+        reply->disconnect(this);
+        reply->abort();
+        reply->deleteLater();
+        reply = NULL;
+    }
+    output.close();
+}
+
+void BlockMapDownload::setPaused(bool pause) {
+    paused = pause;
+    if (!paused && !reply && !done && output.isOpen()) fetchNextRange();
+}
+
+// The block map itself is small and always read in one go; output is only open once we're fetching ranges
+void BlockMapDownload::setReadBufferSize(qint64 size) {
+    readBufferSize = size;
+    if (!reply || !output.isOpen()) return;
+    reply->setReadBufferSize(size);
+    if (size == 0 && reply->bytesAvailable() > 0) read(-1);
+}
+
+qint64 BlockMapDownload::bytesAvailable() const {
+    return reply && output.isOpen() ? reply->bytesAvailable() : 0;
+}
+
+void BlockMapDownload::finish(QString err) {
+    if (done) return;
+    done = true;
+    stop();
+
+    if (!err.isEmpty()) {
+        emit finished(false, err, QByteArray());
+        return;
+    }
+    // The file was written out of order, so this is the one time we read it back
+    emit finished(true, QString(), ChecksumCache::sha256(output.fileName()));
+}
+
+void BlockMapDownload::blockMapFinished() {
+    QNetworkReply* r = reply;
+    reply = NULL;
+    r->deleteLater();
+
+    if (r->error() != QNetworkReply::NoError) {
+        finish("network error on block map "+r->url().toString());
+        return;
+    }
+
+    QByteArray data = r->readAll();
+    QString err;
+    if (QCryptographicHash::hash(data, QCryptographicHash::Sha256) != blockMapChecksum) {
+        finish("unable to verify block map checksum");
+    } else if (!parseBlockMap(data, err) || !assemble(err)) {
+        finish(err);
+    } else {
+        fetchNextRange();
+    }
+}
+
+bool BlockMapDownload::parseBlockMap(const QByteArray &data, QString &err) {
+    QJsonObject map = QJsonDocument::fromJson(data).object();
+    fileSize = (qint64)map.value("size").toDouble();
+    blockSize = map.value("blockSize").toInt();
+    QJsonArray weakSums = map.value("weak").toArray();
+    strong = QByteArray::fromHex(map.value("strong").toString().toLatin1());
+
+    qint64 wholeBlocks = blockSize > 0 ? fileSize / blockSize : -1;
+    if (fileSize <= 0 || blockSize <= 0 || weakSums.size() != wholeBlocks || strong.size() != wholeBlocks * MD5_SIZE) {
+        err = "invalid block map";
+        return false;
+    }
+
+    weak.resize(weakSums.size());
+    for (int i = 0; i != weakSums.size(); i++) {
+        weak[i] = (quint32)weakSums[i].toDouble();
+        weakIndex.insert(weak[i], i);
+    }
+    return true;
+}
+
+// rsync's rolling checksum; a and b are returned so that it can be rolled
+quint32 BlockMapDownload::weakChecksum(const uchar* data, int len, quint32 &a, quint32 &b) {
+    a = 0;
+    b = 0;
+    for (int i = 0; i != len; i++) {
+        a += data[i];
+        b += (quint32)(len - i) * data[i];
+    }
+    a &= 0xffff;
+    b &= 0xffff;
+    return a | (b << 16);
+}
+
+// Copies every block we can find in the source into place, and works out what's left to fetch
+bool BlockMapDownload::assemble(QString &err) {
+    if (!output.open(QIODevice::ReadWrite | QIODevice::Truncate) || !output.resize(fileSize)) {
+        err = "unable to create "+output.fileName()+": "+output.errorString();
+        return false;
+    }
+
+    int blockCount = (int)((fileSize + blockSize - 1) / blockSize);
+    QVector<qint64> sourceOffset(blockCount, -1);
+
+    QFile source(sourcePath);
+    const uchar* data = NULL;
+    qint64 len = 0;
+    if (source.open(QIODevice::ReadOnly) && source.size() >= blockSize) {
+        len = source.size();
+        data = source.map(0, len);
+    }
+
+    if (data) {
+        int remaining = weak.size();
+        quint32 a, b;
+        quint32 sum = weakChecksum(data, blockSize, a, b);
+        qint64 k = 0;
+        while (remaining > 0) {
+            bool matched = false;
+            if (weakIndex.contains(sum)) {
+                QByteArray md5 = QCryptographicHash::hash(
+                    QByteArray::fromRawData((const char*)data + k, blockSize), QCryptographicHash::Md5);
+                foreach (int i, weakIndex.values(sum)) {
+                    if (sourceOffset[i] < 0 && memcmp(strong.constData() + i * MD5_SIZE, md5.constData(), MD5_SIZE) == 0) {
+                        sourceOffset[i] = k;
+                        remaining--;
+                        matched = true;
+                    }
+                }
+            }
+
+            if (matched) {
+                // Blocks rarely overlap; jump past this one
+                k += blockSize;
+                if (k + blockSize > len) break;
+                sum = weakChecksum(data + k, blockSize, a, b);
+                continue;
+            }
+
+            if (k + blockSize >= len) break;
+            quint32 out = data[k];
+            quint32 in = data[k + blockSize];
+            a = (a - out + in) & 0xffff;
+            b = (b - (quint32)blockSize * out + a) & 0xffff;
+            sum = a | (b << 16);
+            k++;
+        }
+    }
+
+    for (int i = 0; i != blockCount; i++) {
+        if (sourceOffset[i] < 0) continue;
+        output.seek((qint64)i * blockSize);
+        if (output.write((const char*)data + sourceOffset[i], blockSize) != blockSize) {
+            err = "unable to write "+output.fileName()+": "+output.errorString();
+            return false;
+        }
+        reusedBytes += blockSize;
+    }
+    if (data) source.unmap((uchar*)data);
+
+    // Runs of missing blocks, merged when the gap between them is small
+    int i = 0;
+    while (i != blockCount) {
+        if (sourceOffset[i] >= 0) {
+            i++;
+            continue;
+        }
+        int first = i;
+        int last = i;
+        int j = i + 1;
+        while (j != blockCount && j - last <= BLOCKMAP_MERGE_GAP_BLOCKS) {
+            if (sourceOffset[j] < 0) last = j;
+            j++;
+        }
+        ranges.append(qMakePair((qint64)first * blockSize, qMin((qint64)(last + 1) * blockSize, fileSize) - 1));
+        i = last + 1;
+    }
+
+    qDebug() << "BlockMapDownload: reusing" << reusedBytes << "bytes from" << sourcePath << ", fetching"
+             << ranges.size() << "ranges";
+    return true;
+}
+
+void BlockMapDownload::fetchNextRange() {
+    if (done || paused || reply) return;
+    if (ranges.isEmpty()) {
+        finish(QString());
+        return;
+    }
+
+    currentRange = ranges.takeFirst();
+    rangeWritten = 0;
+    output.seek(currentRange.first);
+
+    QNetworkRequest request(url);
+    request.setRawHeader("Range", "bytes="+QByteArray::number(currentRange.first)+"-"
+                         +QByteArray::number(currentRange.second));
+    reply = manager->get(request);
+    if (readBufferSize > 0) reply->setReadBufferSize(readBufferSize);
+    QObject::connect(reply, &QNetworkReply::readyRead, this, &BlockMapDownload::rangeReadyRead);
+    QObject::connect(reply, &QNetworkReply::finished, this, &BlockMapDownload::rangeFinished);
+}
+
+void BlockMapDownload::rangeReadyRead() {
+    if (readBufferSize == 0) read(-1);
+}
+
+qint64 BlockMapDownload::read(qint64 maxBytes) {
+    if (!reply || done || !output.isOpen()) return 0;
+
+    // Anything else than our range (e.g. a server that ignores ranges and sends everything) is useless here
+    if (rangeWritten == 0) {
+        QByteArray contentRange = reply->rawHeader("Content-Range");
+        if (reply->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt() != 206
+            || !contentRange.startsWith("bytes "+QByteArray::number(currentRange.first)+"-")) {
+            finish("server did not honour range request");
+            return 0;
+        }
+    }
+
+    QByteArray data = maxBytes < 0 ? reply->readAll() : reply->read(maxBytes);
+    qint64 length = currentRange.second - currentRange.first + 1;
+    if (rangeWritten + data.size() > length || output.write(data) != data.size()) {
+        finish("unexpected data for range of "+url.toString());
+        return data.size();
+    }
+    rangeWritten += data.size();
+    fetchedBytes += data.size();
+    return data.size();
+}
+
+void BlockMapDownload::rangeFinished() {
+    QNetworkReply* r = reply;
+    if (!r) return;
+    // There may be data left that our caller didn't get to yet
+    read(-1);
+    // A failed range has already been torn down
+    if (done) return;
+    reply = NULL;
+    r->deleteLater();
+
+    if (r->error() != QNetworkReply::NoError) {
+        finish("network error on range of "+url.toString());
+    } else if (rangeWritten != currentRange.second - currentRange.first + 1) {
+        finish("incomplete range of "+url.toString());
+    } else {
+        fetchNextRange();
+    }
+}
@@ -0,0 +1,92 @@
+#ifndef BLOCKMAPDOWNLOAD_H
+#define BLOCKMAPDOWNLOAD_H
+
+#include <QObject>
+#include <QFile>
+#include <QList>
+#include <QMultiHash>
+#include <QNetworkAccessManager>
+#include <QNetworkReply>
+#include <QPair>
+#include <QUrl>
+#include <QVector>
+
+// Don't make a separate request for a gap of reusable blocks smaller than that
+#define BLOCKMAP_MERGE_GAP_BLOCKS 4
+
+// zsync-style download: assembles a new version of a file mostly out of blocks of an old version we have locally,
+// fetching only what's missing with HTTP range requests
+//
+// The block map is JSON:
+//   { "size": <bytes>, "blockSize": <bytes>, "weak": [<rolling checksum of block 0>, ...], "strong": "<hex>" }
+// where the weak checksum is rsync's rolling checksum (a | b << 16) of each whole block, and strong is the
+// concatenation of the MD5 of each whole block; a trailing partial block is always fetched
+class BlockMapDownload : public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit BlockMapDownload(QNetworkAccessManager* manager, QObject *parent = 0);
+
+    void start(QUrl url, QUrl blockMapUrl, QByteArray blockMapChecksum, QString source, QString dest);
+    void abort();
+
+    // While paused, no new range requests are made
+    void setPaused(bool);
+    // Like QNetworkReply's, for the range requests: with a read buffer, ranges are only read with read(), so
+    // that the caller can pace them; without one, they are read as data comes in
+    void setReadBufferSize(qint64);
+    // Reads up to maxBytes (everything if negative) of the current range into place; returns how much was read
+    qint64 read(qint64 maxBytes);
+    qint64 bytesAvailable() const;
+
+    QString destination() const { return output.fileName(); }
+    qint64 size() const { return fileSize; }
+    qint64 reused() const { return reusedBytes; }
+    qint64 fetched() const { return fetchedBytes; }
+
+signals:
+    // checksum is the SHA-256 of the assembled file
+    void finished(bool ok, QString err, QByteArray checksum);
+
+private slots:
+    void blockMapFinished();
+    void rangeReadyRead();
+    void rangeFinished();
+
+private:
+    bool parseBlockMap(const QByteArray &data, QString &err);
+    bool assemble(QString &err);
+    void fetchNextRange();
+    void stop();
+    void finish(QString err);
+
+    static quint32 weakChecksum(const uchar* data, int len, quint32 &a, quint32 &b);
+
+    QNetworkAccessManager* manager;
+    QNetworkReply* reply = NULL;
+
+    QUrl url;
+    QByteArray blockMapChecksum;
+    QString sourcePath;
+    QFile output;
+
+    qint64 fileSize = 0;
+    int blockSize = 0;
+    QVector<quint32> weak;
+    QByteArray strong;
+    QMultiHash<quint32, int> weakIndex;
+
+    // Ranges to fetch: first and last byte, inclusive
+    QList<QPair<qint64, qint64> > ranges;
+    QPair<qint64, qint64> currentRange;
+    qint64 rangeWritten = 0;
+
+    qint64 reusedBytes = 0;
+    qint64 fetchedBytes = 0;
+    qint64 readBufferSize = 0;
+    bool paused = false;
+    bool done = false;
+};
+
+#endif // BLOCKMAPDOWNLOAD_H
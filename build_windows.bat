@@ -34,6 +34,7 @@ copy windows\DS\* dist-win
 copy C:\tools\ffmpeg.exe dist-win
 copy C:\tools\ffprobe.exe dist-win
 copy C:\OpenSSL-Win32\bin\libcrypto-1_1.dll dist-win
+copy C:\zstd\bin\zstd.dll dist-win
 ::windeployqt --release --no-compiler-runtime --qmldir=. ./dist-win/stremio.exe
 
 ENDLOCAL
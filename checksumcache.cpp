@@ -0,0 +1,192 @@
+#include "checksumcache.h"
+
+#include <QCryptographicHash>
+#include <QDateTime>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QFuture>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QMutexLocker>
+#include <QSaveFile>
+#include <QStandardPaths>
+#include <QtConcurrent>
+
+#include <openssl/evp.h>
+
+#ifdef Q_OS_UNIX
+#include <sys/stat.h>
+#endif
+
+ChecksumCache::ChecksumCache() {
+    QString dir = QStandardPaths::writableLocation(QStandardPaths::AppDataLocation);
+    if (!dir.isEmpty()) storePath = dir + QDir::separator() + CHECKSUM_CACHE_FNAME;
+}
+
+QByteArray ChecksumCache::checksum(const QString &path) {
+    return checksums(QStringList(path)).first();
+}
+
+QList<QByteArray> ChecksumCache::checksums(const QStringList &paths) {
+    ensureLoaded();
+    QList<QByteArray> result;
+    QStringList misses;
+    foreach (const QString &path, paths) {
+        QByteArray sum;
+        if (!lookup(path, sum)) misses.append(path);
+        result.append(sum);
+    }
+
+    if (!misses.isEmpty()) {
+        QList<QByteArray> hashed;
+        if (misses.size() == 1) hashed.append(sha256(misses.first()));
+        else hashed = QtConcurrent::blockingMapped<QList<QByteArray> >(misses, &ChecksumCache::sha256);
+
+        for (int i = 0; i != misses.size(); i++) store(misses[i], hashed[i]);
+        for (int i = 0; i != paths.size(); i++) {
+            if (result[i].isEmpty()) result[i] = hashed[misses.indexOf(paths[i])];
+        }
+        save();
+    }
+
+    return result;
+}
+
+void ChecksumCache::insert(const QString &path, const QByteArray &checksum) {
+    ensureLoaded();
+    store(path, checksum);
+    save();
+}
+
+void ChecksumCache::moved(const QString &from, const QString &to) {
+    ensureLoaded();
+    QMutexLocker lock(&mutex);
+    QString src = QFileInfo(from).absoluteFilePath();
+    if (!entries.contains(src)) return;
+    entries.insert(QFileInfo(to).absoluteFilePath(), entries.take(src));
+    dirty = true;
+    lock.unlock();
+    save();
+}
+
+QByteArray ChecksumCache::sha256(const QString &path) {
+    QByteArray result(EVP_MAX_MD_SIZE, 0);
+    unsigned int len = 0;
+
+    EVP_MD_CTX* ctx = EVP_MD_CTX_create();
+    EVP_DigestInit_ex(ctx, EVP_sha256(), NULL);
+
+    // Like QCryptographicHash before it: a file we can't open hashes like an empty one
+    QFile file(path);
+    if (file.open(QFile::ReadOnly) && file.size() > 0) {
+        uchar* data = file.map(0, file.size());
+        if (data) {
+            EVP_DigestUpdate(ctx, data, file.size());
+            file.unmap(data);
+        } else {
+            QByteArray buf(CHECKSUM_READ_CHUNK, 0);
+            qint64 n;
+            while ((n = file.read(buf.data(), buf.size())) > 0) EVP_DigestUpdate(ctx, buf.constData(), n);
+        }
+    }
+
+    EVP_DigestFinal_ex(ctx, (unsigned char*)result.data(), &len);
+    EVP_MD_CTX_destroy(ctx);
+    result.resize(len);
+    return result;
+}
+
+bool ChecksumCache::statFile(const QString &path, Entry &entry) {
+#ifdef Q_OS_UNIX
+    struct stat st;
+    if (::stat(QFile::encodeName(path).constData(), &st) != 0 || !S_ISREG(st.st_mode)) return false;
+    entry.size = st.st_size;
+    entry.inode = st.st_ino;
+    entry.mtime = QFileInfo(path).lastModified().toMSecsSinceEpoch();
+#else
+    QFileInfo info(path);
+    if (!info.isFile()) return false;
+    entry.size = info.size();
+    entry.inode = 0;
+    entry.mtime = info.lastModified().toMSecsSinceEpoch();
+#endif
+    return true;
+}
+
+bool ChecksumCache::lookup(const QString &path, QByteArray &checksum) {
+    Entry current;
+    if (!statFile(path, current)) return false;
+
+    QMutexLocker lock(&mutex);
+    QHash<QString, Entry>::const_iterator it = entries.constFind(QFileInfo(path).absoluteFilePath());
+    if (it == entries.constEnd()
+        || it->size != current.size || it->mtime != current.mtime || it->inode != current.inode) return false;
+    checksum = it->checksum;
+    return true;
+}
+
+void ChecksumCache::store(const QString &path, const QByteArray &checksum) {
+    Entry entry;
+    // Missing files are not cached
+    if (!statFile(path, entry)) return;
+    entry.checksum = checksum;
+
+    QMutexLocker lock(&mutex);
+    entries.insert(QFileInfo(path).absoluteFilePath(), entry);
+    dirty = true;
+}
+
+// The AutoUpdater is created on the GUI thread at startup, and only uses us later on its own thread
+void ChecksumCache::ensureLoaded() {
+    QMutexLocker lock(&mutex);
+    if (loaded) return;
+    loaded = true;
+    load();
+}
+
+void ChecksumCache::load() {
+    if (storePath.isEmpty()) return;
+    QFile file(storePath);
+    if (!file.open(QFile::ReadOnly)) return;
+
+    QJsonObject obj = QJsonDocument::fromJson(file.readAll()).object();
+    for (QJsonObject::const_iterator it = obj.constBegin(); it != obj.constEnd(); ++it) {
+        QJsonObject e = it.value().toObject();
+        // Forget about files that are gone
+        if (!QFile::exists(it.key())) {
+            dirty = true;
+            continue;
+        }
+        Entry entry;
+        entry.size = (qint64)e.value("size").toDouble();
+        entry.mtime = (qint64)e.value("mtime").toDouble();
+        entry.inode = e.value("inode").toString().toULongLong();
+        entry.checksum = QByteArray::fromHex(e.value("checksum").toString().toLatin1());
+        entries.insert(it.key(), entry);
+    }
+}
+
+void ChecksumCache::save() {
+    QMutexLocker lock(&mutex);
+    if (!dirty || storePath.isEmpty()) return;
+
+    QJsonObject obj;
+    for (QHash<QString, Entry>::const_iterator it = entries.constBegin(); it != entries.constEnd(); ++it) {
+        QJsonObject e;
+        e["size"] = it->size;
+        e["mtime"] = it->mtime;
+        // JSON numbers are doubles
+        e["inode"] = QString::number(it->inode);
+        e["checksum"] = QString(it->checksum.toHex());
+        obj[it.key()] = e;
+    }
+
+    QDir().mkpath(QFileInfo(storePath).absolutePath());
+    // Written to a temporary file and renamed over, so a crash can't leave a truncated cache
+    QSaveFile file(storePath);
+    if (file.open(QFile::WriteOnly)) {
+        file.write(QJsonDocument(obj).toJson(QJsonDocument::Compact));
+        if (file.commit()) dirty = false;
+    }
+}
@@ -0,0 +1,56 @@
+#ifndef CHECKSUMCACHE_H
+#define CHECKSUMCACHE_H
+
+#include <QByteArray>
+#include <QHash>
+#include <QMutex>
+#include <QString>
+#include <QStringList>
+
+#define CHECKSUM_CACHE_FNAME "checksums.json"
+// Used when a file can't be memory mapped
+#define CHECKSUM_READ_CHUNK (1024 * 1024)
+
+// SHA-256 of files, cached by path and invalidated when size, mtime or inode change
+// Persisted in the app data directory, so periodic update checks don't have to re-read files that didn't change;
+// read on first use, on whichever thread that is
+class ChecksumCache
+{
+public:
+    ChecksumCache();
+
+    QByteArray checksum(const QString &path);
+    // Misses are hashed in parallel
+    QList<QByteArray> checksums(const QStringList &paths);
+
+    // For files whose checksum we already know, e.g. hashed while downloading
+    void insert(const QString &path, const QByteArray &checksum);
+    // Renames keep the inode, so the entry can follow the file
+    void moved(const QString &from, const QString &to);
+
+    // Through OpenSSL EVP (uses SHA extensions where available), from a memory map if possible
+    static QByteArray sha256(const QString &path);
+
+private:
+    struct Entry {
+        qint64 size;
+        qint64 mtime;
+        quint64 inode;
+        QByteArray checksum;
+    };
+
+    static bool statFile(const QString &path, Entry &entry);
+    bool lookup(const QString &path, QByteArray &checksum);
+    void store(const QString &path, const QByteArray &checksum);
+    void ensureLoaded();
+    void load();
+    void save();
+
+    QString storePath;
+    QHash<QString, Entry> entries;
+    bool loaded = false;
+    bool dirty = false;
+    QMutex mutex;
+};
+
+#endif // CHECKSUMCACHE_H
@@ -0,0 +1,99 @@
+#include "initscheduler.h"
+#include "startuptracer.h"
+
+#include <QCoreApplication>
+#include <QDebug>
+#include <QThread>
+#include <QTimer>
+#include <QtConcurrent>
+
+InitScheduler* InitScheduler::instance() {
+    static InitScheduler* scheduler = new InitScheduler();
+    return scheduler;
+}
+
+void InitScheduler::add(QString name, std::function<void()> init, Where where) {
+    QSharedPointer<Task> task(new Task());
+    task->name = name;
+    task->init = init;
+    task->where = where;
+    task->state = Task::Pending;
+    task->done.reportStarted();
+
+    QMutexLocker lock(&mutex);
+    tasks.append(task);
+    if (!fallbackScheduled) {
+        fallbackScheduled = true;
+        QTimer::singleShot(INIT_FALLBACK_MS, this, &InitScheduler::firstFrame);
+    }
+}
+
+void InitScheduler::firstFrame() {
+    QMutexLocker lock(&mutex);
+    if (started) return;
+    started = true;
+
+    foreach (QSharedPointer<Task> task, tasks) {
+        if (task->where != WorkerThread || task->state != Task::Pending) continue;
+        task->state = Task::Running;
+        QtConcurrent::run([this, task]() { execute(task); });
+    }
+    lock.unlock();
+
+    runNext();
+}
+
+// One at a time, so input and painting get their turn in between
+void InitScheduler::runNext() {
+    QMutexLocker lock(&mutex);
+    QSharedPointer<Task> next;
+    foreach (QSharedPointer<Task> task, tasks) {
+        if (task->where == MainThread && task->state == Task::Pending) {
+            next = task;
+            break;
+        }
+    }
+    if (next.isNull()) return;
+    next->state = Task::Running;
+    lock.unlock();
+
+    execute(next);
+    QTimer::singleShot(0, this, &InitScheduler::runNext);
+}
+
+void InitScheduler::ensure(QString name) {
+    QMutexLocker lock(&mutex);
+    QSharedPointer<Task> found;
+    foreach (QSharedPointer<Task> task, tasks) {
+        if (task->name == name) found = task;
+    }
+    if (found.isNull() || found->state == Task::Done) return;
+
+    if (found->state == Task::Running) {
+        // Running on another thread: a worker, or the main thread when we're on a worker
+        QFuture<void> done = found->done.future();
+        lock.unlock();
+        done.waitForFinished();
+        return;
+    }
+
+    found->state = Task::Running;
+    lock.unlock();
+    execute(found);
+}
+
+void InitScheduler::execute(QSharedPointer<Task> task) {
+    qint64 start = StartupTracer::now();
+    task->init();
+    qint64 duration = StartupTracer::now() - start;
+
+    QMutexLocker lock(&mutex);
+    task->state = Task::Done;
+    lock.unlock();
+    task->done.reportFinished();
+
+    StartupTracer::instance()->complete(task->name, start, duration, "init");
+    bool onMainThread = QThread::currentThread() == QCoreApplication::instance()->thread();
+    qDebug() << "Initialized" << task->name << "in" << duration / 1000.0 << "ms"
+             << (onMainThread ? "on the main thread" : "on a worker thread");
+}
@@ -0,0 +1,60 @@
+#ifndef INITSCHEDULER_H
+#define INITSCHEDULER_H
+
+#include <QObject>
+#include <QFuture>
+#include <QFutureInterface>
+#include <QList>
+#include <QMutex>
+#include <QSharedPointer>
+#include <QString>
+
+#include <functional>
+
+// Deferred initialization starts by itself this long after the first subsystem is added, if there is no first frame
+#define INIT_FALLBACK_MS 5000
+
+// Initializes subsystems that aren't needed for the first frame after it, or on first use, whichever comes first
+// Main thread ones run one per event loop iteration; worker ones run on the global thread pool
+// Each subsystem's init time is logged, and traced when startup tracing is on
+class InitScheduler : public QObject
+{
+    Q_OBJECT
+
+public:
+    enum Where { MainThread, WorkerThread };
+
+    static InitScheduler* instance();
+
+    void add(QString name, std::function<void()> init, Where where = MainThread);
+
+    // Call before using a subsystem; runs it on the calling thread if it hasn't started yet, or waits for it
+    void ensure(QString name);
+
+public slots:
+    void firstFrame();
+
+private slots:
+    void runNext();
+
+private:
+    struct Task {
+        enum State { Pending, Running, Done };
+        QString name;
+        std::function<void()> init;
+        Where where;
+        State state;
+        // Finished when init has run, wherever it ran; what ensure() waits on
+        QFutureInterface<void> done;
+    };
+
+    InitScheduler() { }
+    void execute(QSharedPointer<Task> task);
+
+    QMutex mutex;
+    QList<QSharedPointer<Task> > tasks;
+    bool started = false;
+    bool fallbackScheduled = false;
+};
+
+#endif // INITSCHEDULER_H
@@ -0,0 +1,180 @@
+#include "instanceforwarder.h"
+
+#include <QDebug>
+#include <QDir>
+#include <QFile>
+#include <QtEndian>
+
+#include <string.h>
+
+#ifdef Q_OS_WIN
+#include <windows.h>
+#include <shellapi.h>
+#else
+#include <errno.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <unistd.h>
+// A primary that goes away mid-write shouldn't kill us with SIGPIPE
+#ifdef MSG_NOSIGNAL
+#define SEND_FLAGS MSG_NOSIGNAL
+#else
+#define SEND_FLAGS 0
+#endif
+#endif
+
+InstanceForwarder::InstanceForwarder(QObject *parent) : QObject(parent) {
+    QObject::connect(&server, &QLocalServer::newConnection, this, &InstanceForwarder::onNewConnection);
+}
+
+QString InstanceForwarder::serverName() {
+#ifdef Q_OS_WIN
+    return QString("stremio-forward-") + QString::fromLocal8Bit(qgetenv("USERNAME"));
+#else
+    QString dir = QString::fromLocal8Bit(qgetenv("XDG_RUNTIME_DIR"));
+    if (dir.isEmpty()) {
+        // /tmp is shared with other users, so the socket goes in a dir of ours that nobody else can put one in
+        dir = QDir::tempPath() + QString("/stremio-%1").arg(getuid());
+        QByteArray path = QFile::encodeName(dir);
+        if (mkdir(path.constData(), 0700) != 0 && errno != EEXIST) return QString();
+        struct stat st;
+        if (lstat(path.constData(), &st) != 0 || !S_ISDIR(st.st_mode) || st.st_uid != getuid() || (st.st_mode & 077))
+            return QString();
+    }
+    return dir + QString("/stremio-forward-%1.sock").arg(getuid());
+#endif
+}
+
+#ifndef Q_OS_WIN
+// Whoever is listening has to be us, or they would get our arguments
+static bool isOwnPeer(int fd) {
+#ifdef SO_PEERCRED
+    struct ucred cred;
+    socklen_t len = sizeof(cred);
+    return getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &cred, &len) == 0 && cred.uid == getuid();
+#else
+    uid_t uid;
+    gid_t gid;
+    return getpeereid(fd, &uid, &gid) == 0 && uid == getuid();
+#endif
+}
+#endif
+
+bool InstanceForwarder::listen() {
+    if (serverName().isEmpty()) {
+        qWarning() << "Unable to listen for other instances: no private directory for the socket";
+        return false;
+    }
+    // We are the primary instance, so whatever is there is left over from a crash
+    QLocalServer::removeServer(serverName());
+    server.setSocketOptions(QLocalServer::UserAccessOption);
+    if (!server.listen(serverName())) {
+        qWarning() << "Unable to listen for other instances:" << server.errorString();
+        return false;
+    }
+    return true;
+}
+
+void InstanceForwarder::onNewConnection() {
+    while (QLocalSocket* socket = server.nextPendingConnection()) {
+        buffers.insert(socket, QByteArray());
+        QObject::connect(socket, &QLocalSocket::readyRead, this, &InstanceForwarder::onReadyRead);
+        QObject::connect(socket, &QLocalSocket::disconnected, this, [this, socket]() {
+            buffers.remove(socket);
+            socket->deleteLater();
+        });
+    }
+}
+
+void InstanceForwarder::onReadyRead() {
+    QLocalSocket* socket = qobject_cast<QLocalSocket*>(sender());
+    if (!socket || !buffers.contains(socket)) return;
+
+    QByteArray &buf = buffers[socket];
+    buf.append(socket->readAll());
+    if (buf.size() < 4) return;
+
+    quint32 len = qFromBigEndian<quint32>((const uchar*)buf.constData());
+    if (len > INSTANCE_FORWARD_MAX_MSG) {
+        socket->abort();
+        return;
+    }
+    if ((quint32)buf.size() < 4 + len) return;
+
+    QByteArray msg = buf.mid(4, len);
+    buf.clear();
+    socket->putChar(INSTANCE_FORWARD_ACK);
+    socket->flush();
+    emit messageReceived(msg);
+}
+
+QByteArray InstanceForwarder::message(int argc, char **argv) {
+#ifdef Q_OS_WIN
+    // argv is in the ANSI code page, which can't hold every path
+    Q_UNUSED(argv)
+    int wargc = 0;
+    LPWSTR* wargv = CommandLineToArgvW(GetCommandLineW(), &wargc);
+    QByteArray msg = "SHOW";
+    if (wargv && wargc > 1) msg = QString::fromWCharArray(wargv[1]).toUtf8();
+    if (wargv) LocalFree(wargv);
+    Q_UNUSED(argc)
+    return msg;
+#else
+    if (argc > 1) return QString::fromLocal8Bit(argv[1]).toUtf8();
+    return "SHOW";
+#endif
+}
+
+bool InstanceForwarder::forward(const QByteArray &msg) {
+    QByteArray packet(4, 0);
+    qToBigEndian<quint32>(msg.size(), (uchar*)packet.data());
+    packet.append(msg);
+    char ack = 0;
+
+#ifdef Q_OS_WIN
+    std::wstring pipe = (QString("\\\\.\\pipe\\") + serverName()).toStdWString();
+    HANDLE h = CreateFileW(pipe.c_str(), GENERIC_READ | GENERIC_WRITE, 0, NULL, OPEN_EXISTING, 0, NULL);
+    if (h == INVALID_HANDLE_VALUE && GetLastError() == ERROR_PIPE_BUSY
+        && WaitNamedPipeW(pipe.c_str(), INSTANCE_FORWARD_TIMEOUT_MS)) {
+        h = CreateFileW(pipe.c_str(), GENERIC_READ | GENERIC_WRITE, 0, NULL, OPEN_EXISTING, 0, NULL);
+    }
+    if (h == INVALID_HANDLE_VALUE) return false;
+
+    DWORD n = 0;
+    bool ok = WriteFile(h, packet.constData(), packet.size(), &n, NULL) && n == (DWORD)packet.size()
+        && ReadFile(h, &ack, 1, &n, NULL) && n == 1;
+    CloseHandle(h);
+    return ok && ack == INSTANCE_FORWARD_ACK;
+#else
+    QByteArray path = QFile::encodeName(serverName());
+    if (path.isEmpty()) return false;
+    struct sockaddr_un addr;
+    if ((size_t)path.size() >= sizeof(addr.sun_path)) return false;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    memcpy(addr.sun_path, path.constData(), path.size());
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) return false;
+
+    // Nobody listening fails right away; a primary that hangs shouldn't hang us too
+    struct timeval tv;
+    tv.tv_sec = INSTANCE_FORWARD_TIMEOUT_MS / 1000;
+    tv.tv_usec = (INSTANCE_FORWARD_TIMEOUT_MS % 1000) * 1000;
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+
+    bool ok = ::connect(fd, (struct sockaddr*)&addr, sizeof(addr)) == 0 && isOwnPeer(fd);
+    qint64 written = 0;
+    while (ok && written < packet.size()) {
+        ssize_t n = ::send(fd, packet.constData() + written, packet.size() - written, SEND_FLAGS);
+        if (n <= 0) ok = false;
+        else written += n;
+    }
+    ok = ok && ::read(fd, &ack, 1) == 1;
+    ::close(fd);
+    return ok && ack == INSTANCE_FORWARD_ACK;
+#endif
+}
@@ -0,0 +1,50 @@
+#ifndef INSTANCEFORWARDER_H
+#define INSTANCEFORWARDER_H
+
+#include <QObject>
+#include <QByteArray>
+#include <QHash>
+#include <QLocalServer>
+#include <QLocalSocket>
+
+#define INSTANCE_FORWARD_ACK '\x06'
+#define INSTANCE_FORWARD_TIMEOUT_MS 1000
+#define INSTANCE_FORWARD_MAX_MSG (64 * 1024)
+
+// Lets a second instance hand its arguments to the running one without starting up Qt
+//
+// The primary instance listens on a local socket (a named pipe on Windows); a message is a 32-bit big-endian
+// length followed by the UTF-8 message, and is acknowledged with a single byte
+// The other end, forward(), uses plain sockets or pipes so it can run first thing in main(); if it doesn't get an
+// acknowledgement, the usual SingleApplication path still applies
+class InstanceForwarder : public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit InstanceForwarder(QObject *parent = 0);
+
+    // Only in the primary instance
+    bool listen();
+
+    // What SingleApplication would have sent: the first argument, or SHOW
+    static QByteArray message(int argc, char **argv);
+    // True if a running instance acknowledged the message
+    static bool forward(const QByteArray &msg);
+
+signals:
+    void messageReceived(QByteArray msg);
+
+private slots:
+    void onNewConnection();
+    void onReadyRead();
+
+private:
+    // Doesn't need the application; empty if there's nowhere only we can reach
+    static QString serverName();
+
+    QLocalServer server;
+    QHash<QLocalSocket*, QByteArray> buffers;
+};
+
+#endif // INSTANCEFORWARDER_H
@@ -1,5 +1,6 @@
 #include <QQmlApplicationEngine>
 #include <QtWebEngine>
+#include <QQuickWebEngineProfile>
 #include <QSysInfo>
 
 #include <clocale>
@@ -22,24 +23,37 @@ typedef QApplication Application;
 #include "mainapplication.h"
 #include "stremioprocess.h"
 #include "mpv.h"
+#include "mpvpipview.h"
 #include "screensaver.h"
 #include "razerchroma.h"
 #include "qclipboardproxy.h"
+#include "startuptracer.h"
+#include "processtelemetry.h"
+#include "webuibundle.h"
+#include "instanceforwarder.h"
+#include "initscheduler.h"
+#include "medialibrary.h"
 
 #else
 #include <QGuiApplication>
 #endif
 
-void InitializeParameters(QQmlApplicationEngine *engine, MainApp& app) {
+void InitializeParameters(QQmlApplicationEngine *engine, MainApp& app, WebUiBundle* webUiBundle) {
     QQmlContext *ctx = engine->rootContext();
-    SystemTray * systemTray = new SystemTray();
 
     ctx->setContextProperty("applicationDirPath", QGuiApplication::applicationDirPath());
     ctx->setContextProperty("appTitle", QString(APP_TITLE));
     ctx->setContextProperty("autoUpdater", app.autoupdater);
+    ctx->setContextProperty("webUiBundle", webUiBundle);
 
-    // Set access to an object of class properties in QML context
-    ctx->setContextProperty("systemTray", systemTray);
+    // Set access to an object of class properties in QML context; it's created after the first frame
+    ctx->setContextProperty("systemTray", (QObject*)nullptr);
+    ctx->setContextProperty("initScheduler", InitScheduler::instance());
+
+    ctx->setContextProperty("tracer", StartupTracer::instance());
+
+    // For sampling processes that aren't ours to start, like the web UI renderer
+    ctx->setContextProperty("processTelemetry", new ProcessTelemetry(&app));
 
     #ifdef QT_DEBUG
         ctx->setContextProperty("debug", true);
@@ -50,6 +64,14 @@ void InitializeParameters(QQmlApplicationEngine *engine, MainApp& app) {
 
 int main(int argc, char **argv)
 {
+    StartupTracer* tracer = StartupTracer::instance();
+    tracer->init(argc, argv);
+
+    #ifndef Q_OS_MACOS
+    // Hand over to a running instance before anything heavy is created
+    if (InstanceForwarder::forward(InstanceForwarder::message(argc, argv))) return 0;
+    #endif
+
     qputenv("QTWEBENGINE_CHROMIUM_FLAGS", "--autoplay-policy=no-user-gesture-required");
     #ifdef _WIN32
     // Default to ANGLE (DirectX), because that seems to eliminate so many issues on Windows
@@ -66,6 +88,9 @@ int main(int argc, char **argv)
     }
     #endif
 
+    // Picture-in-picture draws the player's texture from another window's context
+    Application::setAttribute(Qt::AA_ShareOpenGLContexts);
+
     // This is really broken on Linux
     #ifndef Q_OS_LINUX
     Application::setAttribute(Qt::AA_EnableHighDpiScaling);
@@ -76,7 +101,12 @@ int main(int argc, char **argv)
     Application::setOrganizationName("Smart Code ltd");
     Application::setOrganizationDomain("stremio.com");
 
+    // Custom schemes have to be known before the web engine starts
+    WebUiBundle::registerScheme();
+
+    tracer->begin("MainApp");
     MainApp app(argc, argv, true);
+    tracer->end("MainApp");
     #ifndef Q_OS_MACOS
     if( app.isSecondary() ) {
         if( app.arguments().count() > 1)
@@ -86,33 +116,85 @@ int main(int argc, char **argv)
         //app.sendMessage( app.arguments().join(' ').toUtf8() );
         return 0;
     }
+    InstanceForwarder* forwarder = new InstanceForwarder(&app);
+    forwarder->listen();
+    QObject::connect( forwarder, &InstanceForwarder::messageReceived, &app, [&app](QByteArray msg) {
+        app.processMessage(0, msg);
+    });
     #endif
 
     app.setWindowIcon(QIcon(":/images/stremio_window.png"));
 
+    // Not needed for the first frame
+    InitScheduler* initScheduler = InitScheduler::instance();
+    initScheduler->add("public key", init_public_key, InitScheduler::WorkerThread);
+    initScheduler->add("autoupdater thread", [&app]() { app.startAutoUpdater(); });
+
 
     // Qt sets the locale in the QGuiApplication constructor, but libmpv
     // requires the LC_NUMERIC category to be set to "C", so change it back.
-    std::setlocale(LC_NUMERIC, "C");
+    {
+        TRACE_SCOPE("setlocale");
+        std::setlocale(LC_NUMERIC, "C");
+    }
     
 
+    tracer->begin("QQmlApplicationEngine");
     static QQmlApplicationEngine* engine = new QQmlApplicationEngine();
+    tracer->end("QQmlApplicationEngine");
+
+    {
+        TRACE_SCOPE("qmlRegisterType");
+        qmlRegisterType<Process>("com.stremio.process", 1, 0, "Process");
+        qmlRegisterType<ScreenSaver>("com.stremio.screensaver", 1, 0, "ScreenSaver");
+        qmlRegisterType<MpvObject>("com.stremio.libmpv", 1, 0, "MpvObject");
+        qmlRegisterType<MpvPipView>("com.stremio.libmpv", 1, 0, "MpvPipView");
+        qmlRegisterType<RazerChroma>("com.stremio.razerchroma", 1, 0, "RazerChroma");
+        qmlRegisterType<ClipboardProxy>("com.stremio.clipboard", 1, 0, "Clipboard");
+    }
+
+    // The local copy of the web UI; --webui-bundle-url= points it to another source, e.g. a local HTTP server
+    WebUiBundle* webUiBundle;
+    {
+        TRACE_SCOPE("WebUiBundle");
+        QString shortVer = QStringList(app.applicationVersion().split('.').mid(0, 2)).join('.');
+        QUrl bundleSource("https://app.strem.io/shell-v"+shortVer+"/");
+        QString bundleArg = "--webui-bundle-url=";
+        foreach (const QString &arg, app.arguments()) {
+            if (arg.startsWith(bundleArg)) bundleSource = QUrl(arg.mid(bundleArg.length()));
+        }
+        // Paths are resolved against it
+        if (!bundleSource.path().endsWith('/')) bundleSource.setPath(bundleSource.path()+"/");
+        webUiBundle = new WebUiBundle(bundleSource, &app);
+        QQuickWebEngineProfile::defaultProfile()->installUrlSchemeHandler(WEBUI_SCHEME, webUiBundle);
+    }
+
+    {
+        TRACE_SCOPE("InitializeParameters");
+        InitializeParameters(engine, app, webUiBundle);
+    }
 
-    qmlRegisterType<Process>("com.stremio.process", 1, 0, "Process");
-    qmlRegisterType<ScreenSaver>("com.stremio.screensaver", 1, 0, "ScreenSaver");
-    qmlRegisterType<MpvObject>("com.stremio.libmpv", 1, 0, "MpvObject");
-    qmlRegisterType<RazerChroma>("com.stremio.razerchroma", 1, 0, "RazerChroma");
-    qmlRegisterType<ClipboardProxy>("com.stremio.clipboard", 1, 0, "Clipboard");
+    initScheduler->add("system tray", []() {
+        // Tray icons have to be created on the main thread
+        engine->rootContext()->setContextProperty("systemTray", new SystemTray());
+    });
 
-    InitializeParameters(engine, app); 
+    // Local video files; the index is read and the folders rescanned after the first frame
+    MediaLibrary* mediaLibrary = new MediaLibrary(&app);
+    engine->rootContext()->setContextProperty("mediaLibrary", mediaLibrary);
+    initScheduler->add("media library", [mediaLibrary]() { mediaLibrary->load(); });
 
-    engine->load(QUrl(QStringLiteral("qrc:/main.qml")));
+    {
+        TRACE_SCOPE("engine.load");
+        engine->load(QUrl(QStringLiteral("qrc:/main.qml")));
+    }
 
     #ifndef Q_OS_MACOS
     QObject::connect( &app, &SingleApplication::receivedMessage, &app, &MainApp::processMessage );
     #endif
     QObject::connect( &app, SIGNAL(receivedMessage(QVariant, QVariant)), engine->rootObjects().value(0),
                       SLOT(onAppMessageReceived(QVariant, QVariant)) );
+    tracer->instant("event loop");
     int ret = app.exec();
     delete engine;
     engine = nullptr;
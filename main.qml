@@ -1,5 +1,5 @@
 import QtQuick 2.7
-import QtWebEngine 1.4
+import QtWebEngine 1.11 // for lifecycleState and renderProcessPid
 import QtWebChannel 1.0
 import QtQuick.Window 2.2 // for Window instead of ApplicationWindow; also for Screen
 import QtQuick.Controls 1.4 // for ApplicationWindow
@@ -11,6 +11,7 @@ import com.stremio.clipboard 1.0
 import QtQml 2.2
 
 import "autoupdater.js" as Autoupdater
+import "webuistorage.js" as WebUiStorage
 
 ApplicationWindow {
     id: root
@@ -96,8 +97,25 @@ ApplicationWindow {
             }
             //if (ev === "chroma-toggle") { args.enabled ? chroma.enable() : chroma.disable() }
             if (ev === "screensaver-toggle") shouldDisableScreensaver(args.disabled)
-            if (ev === "file-close") fileDialog.close()
+            if (ev === "server-telemetry-options") {
+                streamingServer.setTelemetryOptions(args)
+                streamingServer.telemetryOptionsApplied = true
+            }
+            if (ev === "autoupdater-scheduling-policy") autoUpdater.setSchedulingPolicy(args)
+            if (ev === "autoupdater-abort") {
+                autoUpdater.abort()
+                autoUpdater.abortJobs()
+            }
+            if (ev === "web-lifecycle-options") webLifecycle.setOptions(args)
+            if (ev === "pip-toggle") setPip(args.enabled)
+            if (ev === "library-add-folder") mediaLibrary.addFolder(args.path)
+            if (ev === "library-remove-folder") mediaLibrary.removeFolder(args.path)
+            if (ev === "library-folders") transport.event("library-folders", mediaLibrary.folders())
+            if (ev === "library-page") transport.event("library-page", mediaLibrary.page(args.offset || 0, args.limit || 100))
+            if (ev === "file-close" && fileDialogLoader.item) fileDialogLoader.item.close()
             if (ev === "file-open") {
+              fileDialogLoader.active = true
+              var fileDialog = fileDialogLoader.item
               if (typeof args !== "undefined") {
                 var fileDialogDefaults = {
                   title: "Please choose",
@@ -167,12 +185,25 @@ ApplicationWindow {
     function quitApp() {
         root.quitting = true;
         webView.destroy();
-        systemTray.hideIconTray();
+        if (systemTray) systemTray.hideIconTray();
         streamingServer.kill();
         streamingServer.waitForFinished(1500);
         Qt.quit();
     }
 
+    // The tray is created after the first frame, so catch it up with the window
+    readonly property QtObject tray: systemTray
+    onTrayChanged: if (tray) tray.alwaysOnTopEnabled(alwaysOnTopAllowed())
+
+    // "Always on top" applies to the picture-in-picture window while there is one
+    function onTopWindow() {
+        return pipLoader.item || root
+    }
+
+    function alwaysOnTopAllowed() {
+        return !!pipLoader.item || (root.visible && root.visibility != Window.FullScreen)
+    }
+
     /* With help Connections object
      * set connections with System tray class
      * */
@@ -180,7 +211,7 @@ ApplicationWindow {
         target: systemTray
 
         function onSignalIconMenuAboutToShow() {
-            systemTray.updateIsOnTop((root.flags & Qt.WindowStaysOnTopHint) === Qt.WindowStaysOnTopHint);
+            systemTray.updateIsOnTop((onTopWindow().flags & Qt.WindowStaysOnTopHint) === Qt.WindowStaysOnTopHint);
 	        systemTray.updateVisibleAction(root.visible);
         }
 
@@ -193,11 +224,12 @@ ApplicationWindow {
         }
 
         function onSignalAlwaysOnTop() {
-            root.raise()
-            if (root.flags & Qt.WindowStaysOnTopHint) {
-                root.flags &= ~Qt.WindowStaysOnTopHint;
+            var win = onTopWindow()
+            win.raise()
+            if (win.flags & Qt.WindowStaysOnTopHint) {
+                win.flags &= ~Qt.WindowStaysOnTopHint;
             } else {
-                root.flags |= Qt.WindowStaysOnTopHint;
+                win.flags |= Qt.WindowStaysOnTopHint;
             }
         }
  
@@ -241,11 +273,57 @@ ApplicationWindow {
         property int errors: 0
         property bool fastReload: false
 
+        // While a file is loaded the server feeds mpv, so it only gets a lower best-effort IO priority and no CPU
+        // cap, or contention would starve the stream; it's only kept out of the way for real while the player is
+        // idle. nice is the same in both since it can't be lowered without CAP_SYS_NICE
+        readonly property var idleResourcePolicy: ({
+            nice: 5, ioClass: "idle", cpuMax: "150000 100000", memoryHigh: "max", cpuAffinity: []
+        })
+        readonly property var playbackResourcePolicy: ({
+            nice: 5, ioClass: "best-effort", ioLevel: 6, cpuMax: "max", memoryHigh: "max", cpuAffinity: []
+        })
+        function updateResourcePolicy() {
+            if (Qt.platform.os !== "linux") return;
+            streamingServer.setResourcePolicy(mpv.fileLoaded ? playbackResourcePolicy : idleResourcePolicy)
+        }
+        onResourcePolicyApplied: function(state) {
+            transport.event("server-resource-policy", state)
+        }
+
+        // Telemetry sampled from /proc; RSS over the limit for long enough schedules a planned restart
+        // that happens between playbacks
+        // Defaults, applied on the first launch only; what the UI sets through server-telemetry-options is kept
+        // across restarts
+        readonly property var telemetryOptions: ({ intervalMs: 5000, windowSize: 60, rssLimitMB: 2048, rssLimitMinutes: 10 })
+        property bool telemetryOptionsApplied: false
+        property bool restartPending: false
+        onTelemetrySampled: function(snapshot) {
+            transport.event("server-telemetry", snapshot)
+        }
+        onRestartRecommended: function(reason, snapshot) {
+            console.log("Streaming server: planned restart requested: "+reason)
+            transport.event("server-planned-restart", { reason: reason, telemetry: snapshot })
+            streamingServer.restartPending = true
+            plannedRestartTimer.start()
+            tryPlannedRestart()
+        }
+        function tryPlannedRestart() {
+            if (!streamingServer.restartPending || streamingServer.fastReload) return;
+            // Only between playbacks: nothing loaded in the player
+            if (!mpv.getProperty("idle-active")) return;
+            console.log("Streaming server: performing planned restart")
+            streamingServer.restartPending = false
+            plannedRestartTimer.stop()
+            streamingServer.fastReload = true
+            streamingServer.terminate()
+        }
+
         onStarted: function() { stayAliveStreamingServer.stop() }
         onFinished: function(code, status) { 
             // status -> QProcess::CrashExit is 1
             if (!streamingServer.fastReload && errors < 5 && (code !== 0 || status !== 0) && !root.quitting) {
-                transport.queueEvent("server-crash", {"code": code, "log": streamingServer.getErrBuff()});
+                transport.queueEvent("server-crash", {"code": code, "log": streamingServer.getErrBuff(),
+                                                      "telemetry": streamingServer.getTelemetry()});
 
                 errors++
                 showStreamingServerErr(code)
@@ -260,6 +338,7 @@ ApplicationWindow {
             }
         }
         onAddressReady: function (address) {
+            tracer.instant("server address ready")
             transport.serverAddress = address
             transport.event("server-address", address)
         }
@@ -267,25 +346,38 @@ ApplicationWindow {
             if (root.quitting) return; // inhibits errors during quitting
             if (streamingServer.fastReload && error == 1) return; // inhibit errors during fast reload mode;
                                                                   // we'll unset that after we've restarted the server
-            transport.queueEvent("server-crash", {"code": error, "log": streamingServer.getErrBuff()});
+            transport.queueEvent("server-crash", {"code": error, "log": streamingServer.getErrBuff(),
+                                                  "telemetry": streamingServer.getTelemetry()});
             showStreamingServerErr(error)
        }
     }
     function showStreamingServerErr(code) {
-        errorDialog.text = streamingServer.errMessage
-        errorDialog.detailedText = 'Stremio streaming server has thrown an error \nQProcess::ProcessError code: ' 
+        showErrorDialog(streamingServer.errMessage,
+            'Stremio streaming server has thrown an error \nQProcess::ProcessError code: ' 
             + code + '\n\n' 
-            + streamingServer.getErrBuff();
-        errorDialog.visible = true
+            + streamingServer.getErrBuff());
     }
     function launchServer() {
         var node_executable = applicationDirPath + "/node"
         if (Qt.platform.os === "windows") node_executable = applicationDirPath + "/stremio-runtime.exe"
+        streamingServer.updateResourcePolicy()
+        if (!streamingServer.telemetryOptionsApplied) {
+            streamingServer.setTelemetryOptions(streamingServer.telemetryOptions)
+            streamingServer.telemetryOptionsApplied = true
+        }
+        tracer.instant("server launch")
         streamingServer.start(node_executable, 
             [applicationDirPath +"/server.js"].concat(Qt.application.arguments.slice(1)), 
             "EngineFS server started at "
         )
     }
+    Timer {
+        id: plannedRestartTimer
+        interval: 60000
+        repeat: true
+        running: false
+        onTriggered: function () { streamingServer.tryPlannedRestart() }
+    }
     // TimerStreamingServer
     Timer {
         id: stayAliveStreamingServer
@@ -301,12 +393,65 @@ ApplicationWindow {
         id: mpv
         anchors.fill: parent
         onMpvEvent: function(ev, args) { transport.event(ev, args) }
+        onFileLoadedChanged: streamingServer.updateResourcePolicy()
+        onPlaybackActiveChanged: {
+            streamingServer.tryPlannedRestart()
+            autoUpdater.setPlaybackActive(playbackActive)
+        }
+    }
+
+    //
+    // Picture-in-picture: a small always-on-top window with what the player renders; no second decode or stream
+    //
+    function setPip(enabled) {
+        if (enabled === pipLoader.active) return
+        mpv.pipActive = enabled
+        pipLoader.active = enabled
+        if (systemTray) systemTray.alwaysOnTopEnabled(alwaysOnTopAllowed())
+        transport.event("pip-changed", { active: enabled })
+    }
+
+    Loader {
+        id: pipLoader
+        active: false
+        sourceComponent: Component {
+            Window {
+                width: 480
+                height: 270
+                minimumWidth: 160
+                minimumHeight: 90
+                x: Screen.desktopAvailableWidth - width - 40
+                y: Screen.desktopAvailableHeight - height - 40
+                visible: true
+                title: appTitle
+                color: "black"
+                flags: Qt.Window | Qt.WindowStaysOnTopHint
+
+                // Not from within the window's own handlers, since that destroys it
+                onClosing: function(event) { Qt.callLater(setPip, false) }
+
+                MpvPipView {
+                    anchors.fill: parent
+                    source: mpv
+                    onStats: function(stats) { transport.event("pip-stats", stats) }
+                }
+
+                // Back to the main window
+                MouseArea {
+                    anchors.fill: parent
+                    onDoubleClicked: {
+                        Qt.callLater(setPip, false)
+                        showWindow()
+                    }
+                }
+            }
+        }
     }
 
     //
     // Main UI (via WebEngineView)
     //
-    function getWebUrl() {
+    function getWebUrl(skipBundle) {
         var params = "?loginFlow=desktop"
         var args = Qt.application.arguments
         var shortVer = Qt.application.version.split('.').slice(0, 2).join('.')
@@ -322,6 +467,12 @@ ApplicationWindow {
         if (args.indexOf("--staging") > -1)
             return "https://staging.strem.io/#"+params
 
+        // The local copy loads without waiting for the network; it's revalidated in the background either way
+        // It's another origin, so it waits until the storage of this one has been exported (see webuistorage.js)
+        webUiBundle.revalidate()
+        if (webUiBundle.available && webUiBundle.storageReady && !skipBundle)
+            return webUiBundle.url+"#"+params
+
         return "https://app.strem.io/shell-v"+shortVer+"/#"+params;
     }
 
@@ -337,6 +488,7 @@ ApplicationWindow {
         }
     }
     function injectJS() {
+        tracer.begin("injectJS")
         splashScreen.visible = false
         pulseOpacity.running = false
         removeSplashTimer.running = false
@@ -349,12 +501,11 @@ ApplicationWindow {
             if (!err) {
                 webView.tries = 0
             } else {
-                errorDialog.text = "User Interface could not be loaded.\n\nPlease try again later or contact the Stremio support team for assistance."
-                errorDialog.detailedText = err
-                errorDialog.visible = true
+                showErrorDialog("User Interface could not be loaded.\n\nPlease try again later or contact the Stremio support team for assistance.", err)
 
                 console.error(err)
             }
+            tracer.end("injectJS")
         });
     }
 
@@ -370,12 +521,112 @@ ApplicationWindow {
         }
     }
 
+    //
+    // Web UI lifecycle
+    //
+    // The web UI is frozen a while after the window is hidden to the tray or minimized, and discarded if that lasts,
+    // so the renderer drops its JS heap, timers and compositor; never while a file is loaded, paused or not, since the
+    // UI tracks the playback
+    Item {
+        id: webLifecycle
+
+        // discardAfterMs: 0 keeps the UI frozen for as long as it's hidden
+        // memoryPressure: tells the UI to drop what it can as soon as it's hidden
+        property var options: ({ freezeAfterMs: 60 * 1000, discardAfterMs: 30 * 60 * 1000, memoryPressure: true })
+
+        readonly property bool idle: (!root.visible || root.visibility === Window.Minimized) && !mpv.fileLoaded
+        // Only a hidden view can be frozen or discarded
+        property bool viewVisible: true
+
+        property var lastSample: null
+        property var transition: null
+
+        function setOptions(opts) {
+            var merged = {}
+            Object.keys(webLifecycle.options).forEach(function(key) {
+                merged[key] = opts.hasOwnProperty(key) ? opts[key] : webLifecycle.options[key]
+            })
+            webLifecycle.options = merged
+        }
+
+        function sample() {
+            var s = processTelemetry.sampleProcess(webView.renderProcessPid)
+            s.at = Date.now()
+            return s
+        }
+
+        function cpuPercent(from, to) {
+            if (!from || !to || from.cpuTime === undefined || to.cpuTime === undefined || to.at <= from.at) return undefined
+            return (to.cpuTime - from.cpuTime) * 100000 / (to.at - from.at)
+        }
+
+        function setState(state) {
+            if (webView.lifecycleState === state) return
+            var before = sample()
+            webLifecycle.transition = { from: webView.lifecycleState, to: state, before: before,
+                                        cpuPercentBefore: cpuPercent(webLifecycle.lastSample, before) }
+            if (state !== WebEngineView.Active) webLifecycle.viewVisible = false
+            webView.lifecycleState = state
+            if (state === WebEngineView.Active) webLifecycle.viewVisible = true
+            webLifecycle.lastSample = before
+            lifecycleSampleTimer.restart()
+        }
+
+        onIdleChanged: {
+            if (webLifecycle.idle) {
+                webLifecycle.lastSample = sample()
+                if (webLifecycle.options.memoryPressure) transport.event("memory-pressure", { level: "moderate" })
+                if (webLifecycle.options.freezeAfterMs > 0) freezeTimer.restart()
+                if (webLifecycle.options.discardAfterMs > 0) discardTimer.restart()
+            } else {
+                freezeTimer.stop()
+                discardTimer.stop()
+                setState(WebEngineView.Active)
+            }
+        }
+
+        Timer {
+            id: freezeTimer
+            interval: webLifecycle.options.freezeAfterMs
+            onTriggered: webLifecycle.setState(WebEngineView.Frozen)
+        }
+
+        Timer {
+            id: discardTimer
+            interval: webLifecycle.options.discardAfterMs
+            onTriggered: webLifecycle.setState(WebEngineView.Discarded)
+        }
+
+        // Reports what the transition saved, once the renderer has settled; a frozen UI gets it when it's back
+        Timer {
+            id: lifecycleSampleTimer
+            interval: 10 * 1000
+            onTriggered: {
+                var t = webLifecycle.transition
+                var after = webLifecycle.sample()
+                var report = {
+                    from: t.from,
+                    to: t.to,
+                    rssBefore: t.before.rss,
+                    // A discarded UI has no renderer
+                    rssAfter: t.to === WebEngineView.Discarded ? 0 : after.rss,
+                    cpuPercentBefore: t.cpuPercentBefore,
+                    cpuPercentAfter: webLifecycle.cpuPercent(t.before, after)
+                }
+                console.log("web UI lifecycle "+t.from+" -> "+t.to+": "+JSON.stringify(report))
+                transport.event("web-lifecycle-changed", report)
+                webLifecycle.lastSample = after
+            }
+        }
+    }
+
     WebEngineView {
         id: webView;
 
         focus: true
+        visible: webLifecycle.viewVisible
 
-        readonly property string mainUrl: getWebUrl()
+        property string mainUrl: getWebUrl()
         
         url: webView.mainUrl;
         anchors.fill: parent
@@ -384,6 +635,17 @@ ApplicationWindow {
 
         readonly property int maxTries: 20
 
+        // Brings the storage exported from the https origin into the local bundle's, before the UI reads it
+        userScripts: [
+            WebEngineScript {
+                name: "webUiStorageImport"
+                injectionPoint: WebEngineScript.DocumentCreation
+                worldId: WebEngineScript.MainWorld
+                sourceCode: webUiBundle.storageMigrated || !webUiBundle.storageReady ? ""
+                            : WebUiStorage.importSource(webUiBundle.pendingStorage(), webUiBundle.url)
+            }
+        ]
+
         Component.onCompleted: function() {
             console.log("Loading web UI from URL: "+webView.mainUrl)
 
@@ -408,11 +670,28 @@ ApplicationWindow {
             }
 
             if (successfullyLoaded) {
+                tracer.instant("web UI loaded", { url: webView.url.toString() })
                 injectJS()
+
+                // Exported every time the https origin is used until the local bundle takes over, so it's current
+                var loadedUrl = webView.url.toString()
+                if (loadedUrl.indexOf(webUiBundle.url) === 0) {
+                    webUiBundle.finishStorageMigration()
+                } else if (loadedUrl.indexOf("https://app.strem.io/") === 0 && !webUiBundle.storageMigrated) {
+                    WebUiStorage.exportStorage(webView, function(json) {
+                        if (json) webUiBundle.saveStorage(json)
+                    })
+                }
             }
 
             var shouldRetry = loadRequest.status == WebEngineView.LoadFailedStatus ||
                     loadRequest.status == WebEngineView.LoadStoppedStatus
+
+            // A broken local copy should not keep us from loading the web UI
+            if (loadRequest.status == WebEngineView.LoadFailedStatus && webView.mainUrl.indexOf(webUiBundle.url) === 0) {
+                console.log("Unable to load the local web UI bundle, falling back to the network")
+                webView.mainUrl = getWebUrl(true)
+            }
             if ( shouldRetry && webView.tries < webView.maxTries) {
                 retryTimer.restart()
             }
@@ -460,39 +739,45 @@ ApplicationWindow {
             }
         }
 
-        Menu {
-            id: ctxMenu
-            MenuItem {
-                text: "Undo"
-                shortcut: StandardKey.Undo
-                onTriggered: webView.triggerWebAction(WebEngineView.Undo)
-            }
-            MenuItem {
-                text: "Redo"
-                shortcut: StandardKey.Redo
-                onTriggered: webView.triggerWebAction(WebEngineView.Redo)
-            }
-            MenuSeparator { }
-            MenuItem {
-                text: "Cut"
-                shortcut: StandardKey.Cut
-                onTriggered: webView.triggerWebAction(WebEngineView.Cut)
-            }
-            MenuItem {
-                text: "Copy"
-                shortcut: StandardKey.Copy
-                onTriggered: webView.triggerWebAction(WebEngineView.Copy)
-            }
-            MenuItem {
-                text: "Paste"
-                shortcut: StandardKey.Paste
-                onTriggered: webView.triggerWebAction(WebEngineView.Paste)
-            }
-            MenuSeparator { }
-            MenuItem {
-                text: "Select All"
-                shortcut: StandardKey.SelectAll
-                onTriggered: webView.triggerWebAction(WebEngineView.SelectAll)
+        // Created the first time it's needed
+        Loader {
+            id: ctxMenuLoader
+            active: false
+            sourceComponent: Component {
+                Menu {
+                    MenuItem {
+                        text: "Undo"
+                        shortcut: StandardKey.Undo
+                        onTriggered: webView.triggerWebAction(WebEngineView.Undo)
+                    }
+                    MenuItem {
+                        text: "Redo"
+                        shortcut: StandardKey.Redo
+                        onTriggered: webView.triggerWebAction(WebEngineView.Redo)
+                    }
+                    MenuSeparator { }
+                    MenuItem {
+                        text: "Cut"
+                        shortcut: StandardKey.Cut
+                        onTriggered: webView.triggerWebAction(WebEngineView.Cut)
+                    }
+                    MenuItem {
+                        text: "Copy"
+                        shortcut: StandardKey.Copy
+                        onTriggered: webView.triggerWebAction(WebEngineView.Copy)
+                    }
+                    MenuItem {
+                        text: "Paste"
+                        shortcut: StandardKey.Paste
+                        onTriggered: webView.triggerWebAction(WebEngineView.Paste)
+                    }
+                    MenuSeparator { }
+                    MenuItem {
+                        text: "Select All"
+                        shortcut: StandardKey.SelectAll
+                        onTriggered: webView.triggerWebAction(WebEngineView.SelectAll)
+                    }
+                }
             }
         }
 
@@ -501,7 +786,8 @@ ApplicationWindow {
             request.accepted = true;
             // Allow menu inside editalbe objects
             if (request.isContentEditable) {
-                ctxMenu.popup();
+                ctxMenuLoader.active = true
+                ctxMenuLoader.item.popup();
             }
         }
 
@@ -552,55 +838,73 @@ ApplicationWindow {
 
     //
     // Err dialog
+    // The dialogs are rarely used, so they're only created when first needed
     //
-    MessageDialog {
-        id: errorDialog
-        title: "Stremio - Application Error"
-        // onAccepted handler does not work
-        //icon: StandardIcon.Critical
-        //standardButtons: StandardButton.Ok
-    }
-
-    FileDialog {
-      id: fileDialog
-      folder: shortcuts.home
-      onAccepted: {
-        var fileProtocol = "file://"
-        var onWindows = Qt.platform.os === "windows" ? 1 : 0
-        var pathSeparators = ["/", "\\"]
-        var files = fileDialog.fileUrls.filter(function(fileUrl) {
-          // Ignore network drives and alike
-          return fileUrl.startsWith(fileProtocol)
-        })
-        .map(function(fileUrl) {
-          // Send actual path and not file protocol URL
-          return decodeURIComponent(fileUrl
-            .substring(fileProtocol.length + onWindows))
-            .replace(/\//g, pathSeparators[onWindows])
-        })
-        transport.event("file-selected", {
-          files: files,
-          title: fileDialog.title,
-          selectExisting: fileDialog.selectExisting,
-          selectFolder: fileDialog.selectFolder,
-          selectMultiple: fileDialog.selectMultiple,
-          nameFilters: fileDialog.nameFilters,
-          selectedNameFilter: fileDialog.selectedNameFilter,
-          data: fileDialog.data
-        })
-      }
-      onRejected: {
-        transport.event("file-rejected", {
-          title: fileDialog.title,
-          selectExisting: fileDialog.selectExisting,
-          selectFolder: fileDialog.selectFolder,
-          selectMultiple: fileDialog.selectMultiple,
-          nameFilters: fileDialog.nameFilters,
-          selectedNameFilter: fileDialog.selectedNameFilter,
-          data: fileDialog.data
-        })
-      }
-      property var data: {}
+    Loader {
+        id: errorDialogLoader
+        active: false
+        sourceComponent: Component {
+            MessageDialog {
+                title: "Stremio - Application Error"
+                // onAccepted handler does not work
+                //icon: StandardIcon.Critical
+                //standardButtons: StandardButton.Ok
+            }
+        }
+    }
+    function showErrorDialog(text, detailedText) {
+        errorDialogLoader.active = true
+        errorDialogLoader.item.text = text
+        errorDialogLoader.item.detailedText = detailedText
+        errorDialogLoader.item.visible = true
+    }
+
+    Loader {
+        id: fileDialogLoader
+        active: false
+        sourceComponent: Component {
+            FileDialog {
+              id: fileDialog
+              folder: shortcuts.home
+              onAccepted: {
+                var fileProtocol = "file://"
+                var onWindows = Qt.platform.os === "windows" ? 1 : 0
+                var pathSeparators = ["/", "\\"]
+                var files = fileDialog.fileUrls.filter(function(fileUrl) {
+                  // Ignore network drives and alike
+                  return fileUrl.startsWith(fileProtocol)
+                })
+                .map(function(fileUrl) {
+                  // Send actual path and not file protocol URL
+                  return decodeURIComponent(fileUrl
+                    .substring(fileProtocol.length + onWindows))
+                    .replace(/\//g, pathSeparators[onWindows])
+                })
+                transport.event("file-selected", {
+                  files: files,
+                  title: fileDialog.title,
+                  selectExisting: fileDialog.selectExisting,
+                  selectFolder: fileDialog.selectFolder,
+                  selectMultiple: fileDialog.selectMultiple,
+                  nameFilters: fileDialog.nameFilters,
+                  selectedNameFilter: fileDialog.selectedNameFilter,
+                  data: fileDialog.data
+                })
+              }
+              onRejected: {
+                transport.event("file-rejected", {
+                  title: fileDialog.title,
+                  selectExisting: fileDialog.selectExisting,
+                  selectFolder: fileDialog.selectFolder,
+                  selectMultiple: fileDialog.selectMultiple,
+                  nameFilters: fileDialog.nameFilters,
+                  selectedNameFilter: fileDialog.selectedNameFilter,
+                  data: fileDialog.data
+                })
+              }
+              property var data: {}
+            }
+        }
     }
 
     //
@@ -613,7 +917,7 @@ ApplicationWindow {
 
     onVisibilityChanged: {
         var enabledAlwaysOnTop = root.visible && root.visibility != Window.FullScreen;
-        systemTray.alwaysOnTopEnabled(enabledAlwaysOnTop);
+        if (systemTray) systemTray.alwaysOnTopEnabled(alwaysOnTopAllowed());
         if (!enabledAlwaysOnTop) {
             root.flags &= ~Qt.WindowStaysOnTopHint;
         }
@@ -646,6 +950,10 @@ ApplicationWindow {
     //
     signal autoUpdaterErr(var msg, var err);
     signal autoUpdaterRestartTimer();
+    signal autoUpdaterProgress(var progress);
+    signal autoUpdaterSchedule(var schedule);
+    signal autoUpdaterJobFinished(var id, var ok, var code);
+    signal autoUpdaterJobOutput(var id, var output);
 
     // Explanation: when the long timer expires, we schedule the short timer; we do that, 
     // because in case the computer has been asleep for a long time, we want another short timer so we don't check
@@ -664,10 +972,36 @@ ApplicationWindow {
         onTriggered: function() { } // empty, set if auto-updater is enabled in initAutoUpdater()
     }
 
+    // What's not needed for the first frame is initialized after it
+    Connections {
+        target: root
+        function onFrameSwapped() {
+            initScheduler.firstFrame()
+            enabled = false
+        }
+    }
+
+    // The index is saved in batches, so this is a hint to fetch pages again rather than a per-file event
+    Connections {
+        target: mediaLibrary
+        function onChanged(status) { transport.event("library-changed", status) }
+    }
+
+    // Only the first frame is of interest to the startup trace
+    Connections {
+        target: root
+        enabled: tracer.enabled
+        function onFrameSwapped() {
+            tracer.instant("first frame")
+            enabled = false
+        }
+    }
+
     //
     // On complete handler
     //
     Component.onCompleted: function() {
+        tracer.instant("main.qml completed")
         console.log('Stremio Shell version: '+Qt.application.version)
 
         // Kind of hacky way to ensure there are no Qt bindings going on; otherwise when we go to fullscreen
@@ -15,9 +15,9 @@ class MainApp : public APP_TYPE
 
   public: 
     MainApp(int &argc, char **argv, bool unique) : APP_TYPE(argc, argv, unique) {
+      // Calls made before the thread is started are queued until then
       autoupdater = new AutoUpdater();
       autoupdater->moveToThread(&autoupdaterThread);
-      autoupdaterThread.start();
     };
     ~MainApp() {
       delete autoupdater;
@@ -27,6 +27,10 @@ class MainApp : public APP_TYPE
 
     AutoUpdater* autoupdater;
 
+    void startAutoUpdater() {
+      autoupdaterThread.start();
+    }
+
     protected:
     bool event (QEvent *event) 
     {
@@ -0,0 +1,368 @@
+#include "medialibrary.h"
+
+#include <QDataStream>
+#include <QDateTime>
+#include <QDebug>
+#include <QDir>
+#include <QDirIterator>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QFileInfo>
+#include <QSaveFile>
+#include <QStandardPaths>
+#include <QtConcurrent>
+#include <QtEndian>
+
+#include <algorithm>
+
+#include <mpv/client.h>
+#include <mpv/qthelper.hpp>
+
+MediaLibrary::MediaLibrary(QObject *parent) : QObject(parent) {
+    QString dir = QStandardPaths::writableLocation(QStandardPaths::AppDataLocation);
+    if (!dir.isEmpty()) indexPath = dir + QDir::separator() + LIBRARY_INDEX_FNAME;
+
+    probePool.setMaxThreadCount(qBound(1, QThread::idealThreadCount() / 2, LIBRARY_MAX_PROBE_THREADS));
+
+    QObject::connect(&watcher, &QFileSystemWatcher::directoryChanged, this, &MediaLibrary::onDirectoryChanged);
+
+    rescanTimer.setSingleShot(true);
+    rescanTimer.setInterval(LIBRARY_RESCAN_DELAY_MS);
+    QObject::connect(&rescanTimer, &QTimer::timeout, this, &MediaLibrary::rescan);
+
+    saveTimer.setSingleShot(true);
+    saveTimer.setInterval(LIBRARY_SAVE_DELAY_MS);
+    QObject::connect(&saveTimer, &QTimer::timeout, this, &MediaLibrary::save);
+}
+
+MediaLibrary::~MediaLibrary() {
+    probePool.clear();
+    probePool.waitForDone();
+    if (saveTimer.isActive()) save();
+}
+
+// INDEX
+// magic, version, folders, then count and for each: path, size, mtime, duration, hash, tracks
+void MediaLibrary::load() {
+    if (loaded) return;
+    loaded = true;
+
+    QFile file(indexPath);
+    if (!indexPath.isEmpty() && file.open(QFile::ReadOnly)) {
+        QDataStream in(&file);
+        in.setVersion(QDataStream::Qt_5_12);
+        quint32 magic, version, count;
+        in >> magic >> version;
+        if (magic == LIBRARY_INDEX_MAGIC && version == LIBRARY_INDEX_VERSION) {
+            in >> roots >> count;
+            for (quint32 i = 0; i < count && in.status() == QDataStream::Ok; i++) {
+                QString path;
+                Entry entry;
+                in >> path >> entry.size >> entry.mtime >> entry.duration >> entry.hash >> entry.tracks;
+                entries.insert(path, entry);
+            }
+        }
+        if (in.status() != QDataStream::Ok) {
+            qWarning() << "Media library: index is damaged, starting over";
+            roots.clear();
+            entries.clear();
+        }
+    }
+    qDebug() << "Media library:" << entries.size() << "files in" << roots.size() << "folders";
+
+    // Whatever changed while we weren't running
+    foreach (const QString &root, roots) scan(root);
+}
+
+void MediaLibrary::save() {
+    saveTimer.stop();
+    if (indexPath.isEmpty()) return;
+
+    QDir().mkpath(QFileInfo(indexPath).absolutePath());
+    QSaveFile file(indexPath);
+    if (!file.open(QFile::WriteOnly)) {
+        qWarning() << "Media library: unable to write" << indexPath;
+        return;
+    }
+    QDataStream out(&file);
+    out.setVersion(QDataStream::Qt_5_12);
+    out << (quint32)LIBRARY_INDEX_MAGIC << (quint32)LIBRARY_INDEX_VERSION << roots << (quint32)entries.size();
+    for (QHash<QString, Entry>::const_iterator it = entries.constBegin(); it != entries.constEnd(); ++it) {
+        out << it.key() << it->size << it->mtime << it->duration << it->hash << it->tracks;
+    }
+    if (!file.commit()) qWarning() << "Media library: unable to write" << indexPath;
+
+    QVariantMap status;
+    status["total"] = entries.size();
+    status["probing"] = probing.size();
+    emit changed(status);
+}
+
+void MediaLibrary::markDirty() {
+    orderDirty = true;
+    if (!saveTimer.isActive()) saveTimer.start();
+}
+
+// FOLDERS
+void MediaLibrary::addFolder(QString path) {
+    load();
+    path = QDir::cleanPath(QFileInfo(path).absoluteFilePath());
+    if (roots.contains(path) || !QFileInfo(path).isDir()) return;
+    roots.append(path);
+    markDirty();
+    scan(path);
+}
+
+void MediaLibrary::removeFolder(QString path) {
+    load();
+    path = QDir::cleanPath(QFileInfo(path).absoluteFilePath());
+    if (!roots.removeOne(path)) return;
+
+    // What another root still covers stays, with nested roots
+    QString prefix = path + "/";
+    QStringList watched = watcher.directories();
+    foreach (const QString &dir, watched) {
+        if ((dir == path || dir.startsWith(prefix)) && !isInLibrary(dir)) watcher.removePath(dir);
+    }
+    for (QHash<QString, Entry>::iterator it = entries.begin(); it != entries.end();) {
+        if (it.key().startsWith(prefix) && !isInLibrary(it.key())) it = entries.erase(it);
+        else ++it;
+    }
+    markDirty();
+}
+
+void MediaLibrary::onDirectoryChanged(QString path) {
+    pendingRescans.insert(path);
+    rescanTimer.start();
+}
+
+void MediaLibrary::rescan() {
+    QSet<QString> dirs = pendingRescans;
+    pendingRescans.clear();
+    foreach (const QString &dir, dirs) scan(dir);
+}
+
+// SCANNING
+// Walking the tree is done on the pool, the index is only touched here
+void MediaLibrary::scan(QString root) {
+    QtConcurrent::run(&probePool, [this, root]() {
+        QVariantList files;
+        QStringList dirs;
+        if (QFileInfo(root).isDir()) dirs.append(root);
+        QDirIterator it(root, QDir::Files | QDir::Dirs | QDir::NoDotAndDotDot, QDirIterator::Subdirectories);
+        while (it.hasNext()) {
+            it.next();
+            QFileInfo info = it.fileInfo();
+            if (info.isDir()) {
+                dirs.append(info.absoluteFilePath());
+            } else if (isVideo(info.fileName())) {
+                QVariantList file;
+                file << info.absoluteFilePath() << info.size() << info.lastModified().toMSecsSinceEpoch();
+                files.append(QVariant(file));
+            }
+        }
+        QMetaObject::invokeMethod(this, [this, root, files, dirs]() { onScanned(root, files, dirs); },
+                                  Qt::QueuedConnection);
+    });
+}
+
+void MediaLibrary::onScanned(QString root, QVariantList files, QStringList dirs) {
+    // Removed from the library while it was being scanned
+    if (!isInLibrary(root)) return;
+
+    QStringList current = watcher.directories();
+    QSet<QString> watched(current.begin(), current.end());
+    foreach (const QString &dir, dirs) {
+        if (watched.size() >= LIBRARY_MAX_WATCHED_DIRS) break;
+        if (watched.contains(dir)) continue;
+        watcher.addPath(dir);
+        watched.insert(dir);
+    }
+
+    // Gone since the last time
+    QSet<QString> seen;
+    foreach (const QVariant &v, files) seen.insert(v.toList().value(0).toString());
+    QString prefix = root + "/";
+    bool removed = false;
+    for (QHash<QString, Entry>::iterator it = entries.begin(); it != entries.end();) {
+        if (it.key().startsWith(prefix) && !seen.contains(it.key())) {
+            it = entries.erase(it);
+            removed = true;
+        } else {
+            ++it;
+        }
+    }
+    if (removed) markDirty();
+
+    // New or changed
+    foreach (const QVariant &v, files) {
+        QVariantList file = v.toList();
+        QString path = file.value(0).toString();
+        qint64 size = file.value(1).toLongLong();
+        qint64 mtime = file.value(2).toLongLong();
+
+        QHash<QString, Entry>::const_iterator existing = entries.constFind(path);
+        if (existing != entries.constEnd() && existing->size == size && existing->mtime == mtime) continue;
+        if (probing.contains(path)) continue;
+
+        probing.insert(path);
+        QtConcurrent::run(&probePool, [this, path, size, mtime]() {
+            QVariantMap entry = probe(path, size, mtime);
+            QMetaObject::invokeMethod(this, [this, entry]() { onProbed(entry); }, Qt::QueuedConnection);
+        });
+    }
+}
+
+void MediaLibrary::onProbed(QVariantMap result) {
+    QString path = result["path"].toString();
+    probing.remove(path);
+
+    // Removed from the library while it was being probed
+    if (!isInLibrary(path)) return;
+
+    Entry entry;
+    entry.size = result["size"].toLongLong();
+    entry.mtime = result["mtime"].toLongLong();
+    entry.duration = result["duration"].toDouble();
+    entry.hash = result["hash"].toULongLong();
+    entry.tracks = result["tracks"].toList();
+    entries.insert(path, entry);
+    markDirty();
+}
+
+bool MediaLibrary::isInLibrary(const QString &path) const {
+    foreach (const QString &root, roots) {
+        if (path == root || path.startsWith(root + "/")) return true;
+    }
+    return false;
+}
+
+// PAGING
+QVariantMap MediaLibrary::page(int offset, int limit) {
+    load();
+    if (orderDirty) {
+        ordered = entries.keys();
+        std::sort(ordered.begin(), ordered.end());
+        orderDirty = false;
+    }
+
+    offset = qMax(0, offset);
+    limit = qBound(0, limit, LIBRARY_MAX_PAGE);
+    QVariantList items;
+    for (int i = offset; i < ordered.size() && i < offset + limit; i++) {
+        items.append(toVariant(ordered[i], entries.value(ordered[i])));
+    }
+
+    QVariantMap result;
+    result["total"] = ordered.size();
+    result["offset"] = offset;
+    result["probing"] = probing.size();
+    result["items"] = items;
+    return result;
+}
+
+QVariantMap MediaLibrary::toVariant(const QString &path, const Entry &entry) const {
+    QVariantMap item;
+    item["path"] = path;
+    item["name"] = QFileInfo(path).fileName();
+    item["size"] = entry.size;
+    item["mtime"] = entry.mtime;
+    if (entry.duration >= 0) item["duration"] = entry.duration;
+    // 64 bits don't fit a JS number
+    item["hash"] = QString("%1").arg(entry.hash, 16, 16, QChar('0'));
+    item["tracks"] = entry.tracks;
+    return item;
+}
+
+// PROBING
+bool MediaLibrary::isVideo(const QString &path) {
+    static const QStringList extensions = QStringList() << "mkv" << "mp4" << "m4v" << "avi" << "mov" << "webm"
+        << "wmv" << "flv" << "ts" << "m2ts" << "mpg" << "mpeg" << "ogv" << "3gp";
+    return extensions.contains(QFileInfo(path).suffix().toLower());
+}
+
+// Size plus the sum of the 64-bit little-endian words in the first and last 64KB
+quint64 MediaLibrary::openSubtitlesHash(const QString &path, qint64 size) {
+    QFile file(path);
+    if (!file.open(QFile::ReadOnly)) return 0;
+
+    quint64 hash = size;
+    qint64 chunk = qMin<qint64>(LIBRARY_HASH_CHUNK, size);
+    QByteArray head = file.read(chunk);
+    file.seek(qMax<qint64>(0, size - chunk));
+    QByteArray tail = file.read(chunk);
+
+    foreach (const QByteArray &data, QList<QByteArray>() << head << tail) {
+        for (int i = 0; i + 8 <= data.size(); i += 8) {
+            hash += qFromLittleEndian<quint64>((const uchar*)data.constData() + i);
+        }
+    }
+    return hash;
+}
+
+// A headless mpv that opens the file paused, without audio or video output
+QVariantMap MediaLibrary::probe(QString path, qint64 size, qint64 mtime) {
+    QVariantMap result;
+    result["path"] = path;
+    result["size"] = size;
+    result["mtime"] = mtime;
+    result["duration"] = -1.0;
+    result["hash"] = openSubtitlesHash(path, size);
+
+    mpv_handle *mpv = mpv_create();
+    if (!mpv) return result;
+    mpv_set_option_string(mpv, "vo", "null");
+    mpv_set_option_string(mpv, "ao", "null");
+    mpv_set_option_string(mpv, "pause", "yes");
+    mpv_set_option_string(mpv, "config", "no");
+    mpv_set_option_string(mpv, "load-scripts", "no");
+    mpv_set_option_string(mpv, "ytdl", "no");
+    mpv_set_option_string(mpv, "terminal", "no");
+    if (mpv_initialize(mpv) < 0) {
+        mpv_terminate_destroy(mpv);
+        return result;
+    }
+
+    QByteArray file = path.toUtf8();
+    const char *cmd[] = {"loadfile", file.constData(), nullptr};
+    mpv_command(mpv, cmd);
+
+    // For the whole probe, however many events the file keeps coming up with
+    QElapsedTimer elapsed;
+    elapsed.start();
+    bool loaded = false;
+    while (!loaded) {
+        double remaining = LIBRARY_PROBE_TIMEOUT_S - elapsed.elapsed() / 1000.0;
+        if (remaining <= 0) break;
+        mpv_event *event = mpv_wait_event(mpv, remaining);
+        if (event->event_id == MPV_EVENT_FILE_LOADED) loaded = true;
+        else if (event->event_id == MPV_EVENT_NONE || event->event_id == MPV_EVENT_END_FILE
+                 || event->event_id == MPV_EVENT_SHUTDOWN) break;
+    }
+
+    if (loaded) {
+        QVariant duration = mpv::qt::get_property(mpv, "duration");
+        if (duration.canConvert<double>()) result["duration"] = duration.toDouble();
+
+        // Only what's useful for browsing and picking tracks
+        QVariantList tracks;
+        foreach (const QVariant &t, mpv::qt::get_property(mpv, "track-list").toList()) {
+            QVariantMap track = t.toMap();
+            QVariantMap compact;
+            compact["type"] = track["type"];
+            compact["codec"] = track["codec"];
+            if (track.contains("lang")) compact["lang"] = track["lang"];
+            if (track.contains("title")) compact["title"] = track["title"];
+            if (track.contains("demux-w")) compact["width"] = track["demux-w"];
+            if (track.contains("demux-h")) compact["height"] = track["demux-h"];
+            if (track.contains("demux-channel-count")) compact["channels"] = track["demux-channel-count"];
+            tracks.append(compact);
+        }
+        result["tracks"] = tracks;
+    } else {
+        qWarning() << "Media library: unable to probe" << path;
+    }
+
+    mpv_terminate_destroy(mpv);
+    return result;
+}
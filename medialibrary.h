@@ -0,0 +1,97 @@
+#ifndef MEDIALIBRARY_H
+#define MEDIALIBRARY_H
+
+#include <QObject>
+#include <QFileSystemWatcher>
+#include <QHash>
+#include <QSet>
+#include <QStringList>
+#include <QThreadPool>
+#include <QTimer>
+#include <QVariantList>
+#include <QVariantMap>
+
+#define LIBRARY_INDEX_FNAME "library.idx"
+#define LIBRARY_INDEX_MAGIC 0x534d4c42 // SMLB
+#define LIBRARY_INDEX_VERSION 1
+#define LIBRARY_MAX_PROBE_THREADS 4
+// How long mpv gets to open a file, in all
+#define LIBRARY_PROBE_TIMEOUT_S 10
+// inotify watches are a limited resource; directories past this are only picked up by rescans
+#define LIBRARY_MAX_WATCHED_DIRS 4096
+#define LIBRARY_RESCAN_DELAY_MS 1000
+#define LIBRARY_SAVE_DELAY_MS 2000
+#define LIBRARY_MAX_PAGE 500
+// Size of each of the two chunks the OpenSubtitles hash reads
+#define LIBRARY_HASH_CHUNK (64 * 1024)
+
+// Local video files in user-selected folders, probed once and kept in a binary index in the app data dir
+// Folders are watched (inotify on Linux); new or changed files, by size and mtime, are probed on a small thread
+// pool with a headless mpv for duration and streams, and get an OpenSubtitles hash
+// The UI reads the index in pages, sorted by path
+class MediaLibrary : public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit MediaLibrary(QObject *parent = 0);
+    virtual ~MediaLibrary();
+
+    // Reads the index and starts watching; done by the InitScheduler
+    void load();
+
+public slots:
+    void addFolder(QString path);
+    void removeFolder(QString path);
+    QStringList folders() const { return roots; }
+
+    // { total, offset, probing, items: [{ path, name, size, mtime, duration, hash, tracks }] }
+    QVariantMap page(int offset, int limit);
+
+signals:
+    // { total, probing }, at most once per LIBRARY_SAVE_DELAY_MS
+    void changed(QVariantMap status);
+
+private slots:
+    void onDirectoryChanged(QString path);
+    void rescan();
+    void save();
+
+private:
+    struct Entry {
+        qint64 size = 0;
+        qint64 mtime = 0;
+        double duration = -1;
+        quint64 hash = 0;
+        QVariantList tracks;
+    };
+
+    void scan(QString root);
+    void onScanned(QString root, QVariantList files, QStringList dirs);
+    void onProbed(QVariantMap entry);
+    void markDirty();
+    bool isInLibrary(const QString &path) const;
+    QVariantMap toVariant(const QString &path, const Entry &entry) const;
+
+    static bool isVideo(const QString &path);
+    static quint64 openSubtitlesHash(const QString &path, qint64 size);
+    static QVariantMap probe(QString path, qint64 size, qint64 mtime);
+
+    QString indexPath;
+    QStringList roots;
+    QHash<QString, Entry> entries;
+    // Sorted paths, rebuilt lazily for paging
+    QStringList ordered;
+    bool orderDirty = true;
+
+    QFileSystemWatcher watcher;
+    QSet<QString> pendingRescans;
+    QTimer rescanTimer;
+    QTimer saveTimer;
+
+    QThreadPool probePool;
+    QSet<QString> probing;
+    bool loaded = false;
+};
+
+#endif // MEDIALIBRARY_H
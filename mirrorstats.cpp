@@ -0,0 +1,113 @@
+#include "mirrorstats.h"
+
+#include <QDateTime>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QSaveFile>
+#include <QStandardPaths>
+
+#include <algorithm>
+
+MirrorStats::MirrorStats() {
+    QString dir = QStandardPaths::writableLocation(QStandardPaths::AppDataLocation);
+    if (!dir.isEmpty()) storePath = dir + QDir::separator() + MIRROR_STATS_FNAME;
+}
+
+void MirrorStats::recordSuccess(const QUrl &url, qint64 latencyMs) {
+    ensureLoaded();
+    Entry &entry = entries[url.host()];
+    entry.latencyMs = entry.latencyMs < 0
+        ? latencyMs
+        : MIRROR_EWMA_ALPHA * latencyMs + (1 - MIRROR_EWMA_ALPHA) * entry.latencyMs;
+    entry.failures = 0;
+    save();
+}
+
+void MirrorStats::recordFailure(const QUrl &url) {
+    ensureLoaded();
+    Entry &entry = entries[url.host()];
+    entry.failures++;
+    entry.lastFailure = QDateTime::currentMSecsSinceEpoch();
+    save();
+}
+
+double MirrorStats::score(const QString &host) const {
+    QHash<QString, Entry>::const_iterator it = entries.constFind(host);
+    if (it == entries.constEnd()) return MIRROR_UNKNOWN_LATENCY_MS;
+
+    double result = it->latencyMs < 0 ? MIRROR_UNKNOWN_LATENCY_MS : it->latencyMs;
+    if (QDateTime::currentMSecsSinceEpoch() - it->lastFailure < MIRROR_FAILURE_MEMORY_MS) {
+        result += it->failures * MIRROR_FAILURE_PENALTY_MS;
+    }
+    return result;
+}
+
+QList<QUrl> MirrorStats::order(const QList<QUrl> &urls) {
+    ensureLoaded();
+    QList<QUrl> result = urls;
+    std::stable_sort(result.begin(), result.end(), [this](const QUrl &a, const QUrl &b) {
+        return score(a.host()) < score(b.host());
+    });
+    return result;
+}
+
+QVariantMap MirrorStats::toVariant() {
+    ensureLoaded();
+    QVariantMap result;
+    for (QHash<QString, Entry>::const_iterator it = entries.constBegin(); it != entries.constEnd(); ++it) {
+        QVariantMap e;
+        e["latencyMs"] = it->latencyMs;
+        e["failures"] = it->failures;
+        e["lastFailure"] = it->lastFailure;
+        e["score"] = score(it.key());
+        result[it.key()] = e;
+    }
+    return result;
+}
+
+// The AutoUpdater is created on the GUI thread at startup, and only uses us later on its own thread
+void MirrorStats::ensureLoaded() {
+    if (loaded) return;
+    loaded = true;
+    load();
+}
+
+void MirrorStats::load() {
+    if (storePath.isEmpty()) return;
+    QFile file(storePath);
+    if (!file.open(QFile::ReadOnly)) return;
+
+    QJsonObject obj = QJsonDocument::fromJson(file.readAll()).object();
+    for (QJsonObject::const_iterator it = obj.constBegin(); it != obj.constEnd(); ++it) {
+        QJsonObject e = it.value().toObject();
+        Entry entry;
+        entry.latencyMs = e.value("latencyMs").toDouble(-1);
+        entry.failures = e.value("failures").toInt();
+        entry.lastFailure = (qint64)e.value("lastFailure").toDouble();
+        entries.insert(it.key(), entry);
+    }
+}
+
+void MirrorStats::save() {
+    if (storePath.isEmpty()) return;
+
+    QJsonObject obj;
+    for (QHash<QString, Entry>::const_iterator it = entries.constBegin(); it != entries.constEnd(); ++it) {
+        QJsonObject e;
+        e["latencyMs"] = it->latencyMs;
+        e["failures"] = it->failures;
+        e["lastFailure"] = it->lastFailure;
+        obj[it.key()] = e;
+    }
+
+    QDir().mkpath(QFileInfo(storePath).absolutePath());
+    // Written to a temporary file and renamed over, so a crash can't leave a truncated file
+    QSaveFile file(storePath);
+    if (file.open(QFile::WriteOnly)) {
+        file.write(QJsonDocument(obj).toJson(QJsonDocument::Compact));
+        file.commit();
+    }
+}
@@ -0,0 +1,51 @@
+#ifndef MIRRORSTATS_H
+#define MIRRORSTATS_H
+
+#include <QHash>
+#include <QList>
+#include <QString>
+#include <QUrl>
+#include <QVariantMap>
+
+#define MIRROR_STATS_FNAME "mirrors.json"
+// Weight of the latest sample in the latency average
+#define MIRROR_EWMA_ALPHA 0.3
+// What we assume for a mirror we've never heard back from
+#define MIRROR_UNKNOWN_LATENCY_MS 500
+// Each recent failure counts like this much extra latency; failures older than MIRROR_FAILURE_MEMORY_MS are forgiven
+#define MIRROR_FAILURE_PENALTY_MS 2000
+#define MIRROR_FAILURE_MEMORY_MS (60 * 60 * 1000)
+
+// Latency and failure history of update mirrors, by host
+// Persisted in the app data directory, so that every check starts with the fastest healthy mirror
+// Only used on the AutoUpdater's thread
+class MirrorStats
+{
+public:
+    MirrorStats();
+
+    void recordSuccess(const QUrl &url, qint64 latencyMs);
+    void recordFailure(const QUrl &url);
+
+    // Best first; mirrors that score the same keep their order
+    QList<QUrl> order(const QList<QUrl> &urls);
+    QVariantMap toVariant();
+
+private:
+    struct Entry {
+        double latencyMs = -1;
+        int failures = 0;
+        qint64 lastFailure = 0;
+    };
+
+    double score(const QString &host) const;
+    void ensureLoaded();
+    void load();
+    void save();
+
+    QString storePath;
+    QHash<QString, Entry> entries;
+    bool loaded = false;
+};
+
+#endif // MIRRORSTATS_H
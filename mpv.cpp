@@ -5,14 +5,27 @@
 
 #include <QObject>
 #include <QJsonObject>
+#include <QDebug>
 
 #include <QtGlobal>
 #include <QOpenGLContext>
+#include <QOpenGLExtraFunctions>
+#include <QOpenGLFunctions>
+#include <QOpenGLTextureBlitter>
+#include <QRunnable>
 
 #include <QtGui/QOpenGLFramebufferObject>
+#ifndef QT_OPENGL_ES_2
+#include <QtGui/QOpenGLTimeMonitor>
+#endif
 
 #include <QtQuick/QQuickWindow>
 #include <QtQuick/QQuickView>
+#include <QtGui/QScreen>
+
+#ifdef Q_OS_UNIX
+#include <sys/resource.h>
+#endif
 
 #if defined(Q_OS_WIN32)
 #include <windows.h>
@@ -38,13 +51,174 @@ static void *get_proc_address_mpv(void *ctx, const char *name)
     return reinterpret_cast<void *>(glctx->getProcAddress(QByteArray(name)));
 }
 
+#ifndef GL_SYNC_GPU_COMMANDS_COMPLETE
+#define GL_SYNC_GPU_COMMANDS_COMPLETE 0x9117
+#endif
+#ifndef GL_TIMEOUT_IGNORED
+#define GL_TIMEOUT_IGNORED 0xFFFFFFFFFFFFFFFFull
+#endif
+
+// Fences between the GL contexts sharing a frame; without sync objects, all we can do is wait for the GPU
+bool hasFenceSync(QOpenGLContext *ctx)
+{
+    if (ctx->isOpenGLES()) return ctx->format().majorVersion() >= 3;
+    return ctx->format().version() >= qMakePair(3, 2) || ctx->hasExtension("GL_ARB_sync");
+}
+
+GLsync insertFence()
+{
+    QOpenGLContext *ctx = QOpenGLContext::currentContext();
+    if (!hasFenceSync(ctx)) {
+        ctx->functions()->glFinish();
+        return 0;
+    }
+    GLsync fence = ctx->extraFunctions()->glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    // Another context can only wait on it once it's been submitted
+    ctx->functions()->glFlush();
+    return fence;
+}
+
+// Makes the GPU wait, not us
+void waitFence(GLsync fence)
+{
+    if (fence) QOpenGLContext::currentContext()->extraFunctions()->glWaitSync(fence, 0, GL_TIMEOUT_IGNORED);
+}
+
+void deleteFence(GLsync fence)
+{
+    if (fence) QOpenGLContext::currentContext()->extraFunctions()->glDeleteSync(fence);
+}
+
+// Where a frame of the given size goes in target, keeping its aspect ratio
+QMatrix4x4 fitTransform(QSize size, QSize target)
+{
+    QSizeF fitted = QSizeF(size).scaled(target, Qt::KeepAspectRatio);
+    QRectF rect(QPointF((target.width() - fitted.width()) / 2, (target.height() - fitted.height()) / 2), fitted);
+    return QOpenGLTextureBlitter::targetTransform(rect, QRect(QPoint(0, 0), target));
+}
+
 } // namespace
 
 
+// From cheapest to best looking; every tier sets everything so switching in either direction is complete
+struct QualityTier {
+    const char *name;
+    const char *scale;
+    const char *cscale;
+    const char *dscale;
+    const char *dither;
+    const char *deband;
+    const char *interpolation;
+};
+
+static const QualityTier quality_tiers[] = {
+    {"fast", "bilinear", "bilinear", "bilinear", "no", "no", "no"},
+    {"balanced", "spline36", "spline36", "mitchell", "auto", "no", "no"},
+    {"high", "ewa_lanczossharp", "ewa_lanczossharp", "mitchell", "auto", "yes", "no"},
+    {"max", "ewa_lanczossharp", "ewa_lanczossharp", "mitchell", "auto", "yes", "yes"},
+};
+static const int quality_tier_count = sizeof(quality_tiers) / sizeof(quality_tiers[0]);
+
 class MpvRenderer : public QQuickFramebufferObject::Renderer
 {
     MpvObject *obj;
 
+    // Stats, on the render thread
+    int fbo_allocations = 0;
+    bool resizing = false;
+    int resize_frames = 0;
+    double resize_render_ms = 0;
+    double resize_max_ms = 0;
+    int frames = 0;
+    double render_ms = 0;
+    double render_max_ms = 0;
+
+    // While picture-in-picture is shown it has mpv's render context, and we draw its frames
+    bool pip = false;
+    QOpenGLTextureBlitter blitter;
+
+#ifndef QT_OPENGL_ES_2
+    // A timestamp before and after each frame; mpv times its own passes with GL_TIME_ELAPSED queries, and those
+    // can't nest, so ours are timestamps. Empty if the context has no timer queries
+    QList<QOpenGLTimeMonitor *> gpu_timers;
+    QList<bool> gpu_timer_pending;
+    int gpu_timer_next = 0;
+    bool gpu_timers_checked = false;
+#endif
+
+    void addFrameTime(double ms)
+    {
+        frames++;
+        render_ms += ms;
+        render_max_ms = qMax(render_max_ms, ms);
+        if (resizing) {
+            resize_frames++;
+            resize_render_ms += ms;
+            resize_max_ms = qMax(resize_max_ms, ms);
+        }
+    }
+
+#ifndef QT_OPENGL_ES_2
+    // Takes the results that are in, and returns the timer for this frame, or null if it's still busy
+    QOpenGLTimeMonitor *nextGpuTimer()
+    {
+        if (!gpu_timers_checked) {
+            gpu_timers_checked = true;
+            for (int i = 0; i < GPU_TIMER_FRAMES; i++) {
+                QOpenGLTimeMonitor *timer = new QOpenGLTimeMonitor();
+                timer->setSampleCount(2);
+                if (!timer->create()) {
+                    delete timer;
+                    qDebug() << "MPV: no GPU timer queries, timing render calls on the CPU";
+                    break;
+                }
+                gpu_timers.append(timer);
+                gpu_timer_pending.append(false);
+            }
+            if (gpu_timers.size() < GPU_TIMER_FRAMES) {
+                qDeleteAll(gpu_timers);
+                gpu_timers.clear();
+                gpu_timer_pending.clear();
+            }
+        }
+        if (gpu_timers.isEmpty()) return nullptr;
+
+        for (int i = 0; i < gpu_timers.size(); i++) {
+            if (!gpu_timer_pending[i] || !gpu_timers[i]->isResultAvailable()) continue;
+            QVector<GLuint64> intervals = gpu_timers[i]->waitForIntervals();
+            if (!intervals.isEmpty()) addFrameTime(intervals[0] / 1e6);
+            gpu_timers[i]->reset();
+            gpu_timer_pending[i] = false;
+        }
+
+        int i = gpu_timer_next;
+        if (gpu_timer_pending[i]) return nullptr;
+        gpu_timer_next = (gpu_timer_next + 1) % gpu_timers.size();
+        gpu_timer_pending[i] = true;
+        return gpu_timers[i];
+    }
+#endif
+
+    void drawSharedFrame()
+    {
+        QElapsedTimer timer;
+        timer.start();
+        QOpenGLFunctions *f = QOpenGLContext::currentContext()->functions();
+        f->glClearColor(0, 0, 0, 1);
+        f->glClear(GL_COLOR_BUFFER_BIT);
+
+        QSize size;
+        GLuint texture = obj->lockSharedFrame(size);
+        if (texture && !size.isEmpty()) {
+            if (!blitter.isCreated()) blitter.create();
+            blitter.bind();
+            blitter.blit(texture, fitTransform(size, framebufferObject()->size()), QOpenGLTextureBlitter::OriginBottomLeft);
+            blitter.release();
+        }
+        obj->unlockSharedFrame();
+        addFrameTime(timer.nsecsElapsed() / 1e6);
+    }
+
     public:
     MpvRenderer(MpvObject *new_obj)
         : obj{new_obj}
@@ -54,35 +228,61 @@ class MpvRenderer : public QQuickFramebufferObject::Renderer
         std::setlocale(LC_NUMERIC, "C");
     }
 
+    // Destroyed on the render thread, with the context current
     virtual ~MpvRenderer()
     {
+#ifndef QT_OPENGL_ES_2
+        qDeleteAll(gpu_timers);
+#endif
+        if (blitter.isCreated()) blitter.destroy();
     }
 
     // This function is called when a new FBO is needed.
     // This happens on the initial frame.
     QOpenGLFramebufferObject *createFramebufferObject(const QSize &size)
     {
-        // init mpv_gl:
-        if (!obj->mpv_gl)
-        {
-            mpv_opengl_init_params gl_init_params{get_proc_address_mpv, nullptr, nullptr};
-            mpv_render_param params[]{
-                {MPV_RENDER_PARAM_API_TYPE, const_cast<char *>(MPV_RENDER_API_TYPE_OPENGL)},
-                {MPV_RENDER_PARAM_OPENGL_INIT_PARAMS, &gl_init_params},
-                {MPV_RENDER_PARAM_INVALID, nullptr}};
-
-            if (mpv_render_context_create(&obj->mpv_gl, obj->mpv, params) < 0)
-                throw std::runtime_error("failed to initialize mpv GL context");
-            mpv_render_context_set_update_callback(obj->mpv_gl, on_mpv_redraw, obj);
-        }
-
+        fbo_allocations++;
+        qDebug() << "MPV: FBO allocation" << fbo_allocations << size;
         return QQuickFramebufferObject::Renderer::createFramebufferObject(size);
     }
 
+    // The FBO doesn't follow the item size; it's only reallocated once a resize has settled
+    void synchronize(QQuickFramebufferObject *)
+    {
+        if (obj->fbo_resize_pending) {
+            obj->fbo_resize_pending = false;
+            if (resize_frames > 0) {
+                qDebug() << "MPV: resize drew" << resize_frames << "scaled frames, avg"
+                         << resize_render_ms / resize_frames << "ms, max" << resize_max_ms << "ms";
+            }
+            resize_frames = 0;
+            resize_render_ms = 0;
+            resize_max_ms = 0;
+            invalidateFramebufferObject();
+        }
+        resizing = obj->resize_in_progress;
+        pip = obj->pip_active;
+
+        obj->render_frames += frames;
+        obj->render_ms_total += render_ms;
+        obj->render_ms_max = qMax(obj->render_ms_max, render_max_ms);
+        frames = 0;
+        render_ms = 0;
+        render_max_ms = 0;
+    }
+
     void render()
     {
         obj->window()->resetOpenGLState();
 
+        // Also handed over here if the render job in pipChanged() didn't get to run
+        if (pip) obj->releaseRenderContext(MpvObject::MainHost);
+        if (pip || !obj->acquireRenderContext(MpvObject::MainHost)) {
+            drawSharedFrame();
+            obj->window()->resetOpenGLState();
+            return;
+        }
+
         QOpenGLFramebufferObject *fbo = framebufferObject();
         mpv_opengl_fbo mpfbo{static_cast<int>(fbo->handle()), fbo->width(), fbo->height(), 0};
         int flip_y{0};
@@ -98,7 +298,21 @@ class MpvRenderer : public QQuickFramebufferObject::Renderer
             {MPV_RENDER_PARAM_INVALID, nullptr}};
         // See render_gl.h on what OpenGL environment mpv expects, and
         // other API details.
+        // The call only submits the work; what the frame costs is the GPU time, when we can measure it
+#ifndef QT_OPENGL_ES_2
+        QOpenGLTimeMonitor *gpuTimer = nextGpuTimer();
+        if (gpuTimer) gpuTimer->recordSample();
+        QElapsedTimer timer;
+        timer.start();
+        mpv_render_context_render(obj->mpv_gl, params);
+        if (gpuTimer) gpuTimer->recordSample();
+        else if (gpu_timers.isEmpty()) addFrameTime(timer.nsecsElapsed() / 1e6);
+#else
+        QElapsedTimer timer;
+        timer.start();
         mpv_render_context_render(obj->mpv_gl, params);
+        addFrameTime(timer.nsecsElapsed() / 1e6);
+#endif
 
         obj->window()->resetOpenGLState();
      }
@@ -120,6 +334,23 @@ MpvObject::MpvObject(QQuickItem * parent)
     // doUpdate() function is run on the GUI thread.
     connect(this, &MpvObject::onUpdate, this, &MpvObject::doUpdate,
             Qt::QueuedConnection);
+    // Picture-in-picture renders on its own thread; we draw each frame it has
+    connect(this, &MpvObject::frameRendered, this, &QQuickItem::update, Qt::QueuedConnection);
+    connect(this, &MpvObject::pipActiveChanged, this, &MpvObject::pipChanged);
+
+    suspend_timer.setSingleShot(true);
+    suspend_timer.setInterval(VIDEO_SUSPEND_DELAY_MS);
+    connect(&suspend_timer, &QTimer::timeout, this, &MpvObject::suspendVideo);
+    cpu_clock.start();
+
+    setTextureFollowsItemSize(false);
+    resize_timer.setSingleShot(true);
+    resize_timer.setInterval(FBO_RESIZE_DEBOUNCE_MS);
+    connect(&resize_timer, &QTimer::timeout, this, &MpvObject::resizeSettled);
+
+    governor_timer.setInterval(GOVERNOR_INTERVAL_MS);
+    connect(&governor_timer, &QTimer::timeout, this, &MpvObject::evaluateQuality);
+    governor_timer.start();
 
     initialize_mpv();
 
@@ -178,6 +409,32 @@ void MpvObject::initialize_mpv() {
     foreach (const QString &name, observed_properties) {
         mpv_observe_property(mpv, 0, name.toStdString().c_str(), MPV_FORMAT_NODE);
     }
+
+    // Used to tell whether we're actually playing something
+    mpv_observe_property(mpv, MPV_OBSERVE_INTERNAL, "pause", MPV_FORMAT_FLAG);
+    mpv_observe_property(mpv, MPV_OBSERVE_INTERNAL, "idle-active", MPV_FORMAT_FLAG);
+
+    // The scalers are left to mpv's config until the governor runs; it may be turned off before then
+    quality_tier_applied = false;
+}
+
+void MpvObject::handle_internal_property(mpv_event_property *prop)
+{
+    if (prop->format != MPV_FORMAT_FLAG) return;
+
+    QString name(prop->name);
+    bool value = *(int *)prop->data;
+    if (name == "pause") core_paused = value;
+    if (name == "idle-active" && value != core_idle_active) {
+        core_idle_active = value;
+        Q_EMIT fileLoadedChanged(!core_idle_active);
+    }
+
+    bool active = !core_paused && !core_idle_active;
+    if (active != playback_active) {
+        playback_active = active;
+        Q_EMIT playbackActiveChanged(playback_active);
+    }
 }
 
 void MpvObject::on_update(void *ctx)
@@ -189,9 +446,353 @@ void MpvObject::on_update(void *ctx)
 // connected to onUpdate(); signal makes sure it runs on the GUI thread
 void MpvObject::doUpdate()
 {
+    // Picture-in-picture renders then, and we follow its frames
+    if (pip_active) {
+        Q_EMIT pipFrameWanted();
+        return;
+    }
+    // Nothing to show, and nobody to show it to
+    if (video_suspended) return;
+    update();
+}
+
+//
+// mpv's render context lives in one GL context at a time, created by whoever renders first; it's handed over by
+// freeing it in one and creating it again in the other, which mpv supports mid-playback
+//
+bool MpvObject::acquireRenderContext(RenderHost host)
+{
+    QMutexLocker lock(&render_host_mutex);
+    if (render_host == host) return true;
+    if (render_host != NoHost) return false;
+
+    mpv_opengl_init_params gl_init_params{get_proc_address_mpv, nullptr, nullptr};
+    mpv_render_param params[]{
+        {MPV_RENDER_PARAM_API_TYPE, const_cast<char *>(MPV_RENDER_API_TYPE_OPENGL)},
+        {MPV_RENDER_PARAM_OPENGL_INIT_PARAMS, &gl_init_params},
+        {MPV_RENDER_PARAM_INVALID, nullptr}};
+
+    if (mpv_render_context_create(&mpv_gl, mpv, params) < 0)
+        throw std::runtime_error("failed to initialize mpv GL context");
+    mpv_render_context_set_update_callback(mpv_gl, on_mpv_redraw, this);
+    render_host = host;
+    return true;
+}
+
+void MpvObject::releaseRenderContext(RenderHost host)
+{
+    QMutexLocker lock(&render_host_mutex);
+    if (render_host != host) return;
+    mpv_render_context_free(mpv_gl);
+    mpv_gl = nullptr;
+    render_host = NoHost;
+    // So the other one takes it over
+    QMetaObject::invokeMethod(this, "doUpdate", Qt::QueuedConnection);
+}
+
+void MpvObject::pipChanged(bool active)
+{
+    // Picture-in-picture hands it back once its view goes away
+    if (!active) {
+        update();
+        return;
+    }
+    // Released on our render thread, where it was created; the job only runs if the window is exposed, otherwise
+    // it's released on the next frame we render
+    if (window()) window()->scheduleRenderJob(QRunnable::create([this]() { releaseRenderContext(MainHost); }),
+                                              QQuickWindow::NoStage);
     update();
 }
 
+//
+// Quality governor: converges on the best looking tier this machine renders within the frame budget
+//
+QString MpvObject::qualityTierName() const
+{
+    return quality_tiers[quality_tier].name;
+}
+
+void MpvObject::applyQualityTier()
+{
+    const QualityTier &tier = quality_tiers[quality_tier];
+    quality_tier_applied = true;
+    mpv::qt::set_property(mpv, "scale", tier.scale);
+    mpv::qt::set_property(mpv, "cscale", tier.cscale);
+    mpv::qt::set_property(mpv, "dscale", tier.dscale);
+    mpv::qt::set_property(mpv, "dither-depth", tier.dither);
+    mpv::qt::set_property(mpv, "deband", tier.deband);
+    mpv::qt::set_property(mpv, "interpolation", tier.interpolation);
+}
+
+void MpvObject::evaluateQuality()
+{
+    int frames = render_frames;
+    double totalMs = render_ms_total;
+    double maxMs = render_ms_max;
+    render_frames = 0;
+    render_ms_total = 0;
+    render_ms_max = 0;
+    if (frames > 0) last_render_ms = totalMs / frames;
+
+    qint64 drops = getProperty("frame-drop-count").toLongLong() + getProperty("vo-delayed-frame-count").toLongLong();
+    // The counters start over with every file
+    qint64 newDrops = qMax<qint64>(0, drops - last_drop_count);
+    last_drop_count = drops;
+
+    // With picture-in-picture, our frames are only draws of its
+    if (!quality_governor_enabled || !playback_active || video_suspended || pip_active || frames < GOVERNOR_MIN_FRAMES) {
+        good_windows = 0;
+        return;
+    }
+    // First time enabled with this mpv instance: start from the current tier, and measure it next time
+    if (!quality_tier_applied) {
+        applyQualityTier();
+        skip_windows = 1;
+        return;
+    }
+    // Shaders are recompiled after a switch, which isn't representative
+    if (skip_windows > 0) {
+        skip_windows--;
+        return;
+    }
+
+    double refreshRate = window() && window()->screen() ? window()->screen()->refreshRate() : 0;
+    double budgetMs = 1000.0 / (refreshRate > 0 ? refreshRate : 60);
+    double avgMs = totalMs / frames;
+
+    if (avgMs > budgetMs * GOVERNOR_OVER_BUDGET || newDrops > GOVERNOR_MAX_DROPS) {
+        good_windows = 0;
+        if (quality_tier > 0) {
+            tier_failed_at[quality_tier] = cpu_clock.elapsed();
+            setQualityTier(quality_tier - 1, "over budget", avgMs, budgetMs, newDrops);
+        }
+    } else if (avgMs < budgetMs * GOVERNOR_UNDER_BUDGET && newDrops == 0 && maxMs < budgetMs) {
+        int next = quality_tier + 1;
+        bool failedRecently = tier_failed_at.contains(next)
+            && cpu_clock.elapsed() - tier_failed_at.value(next) < GOVERNOR_RETRY_MS;
+        if (++good_windows >= GOVERNOR_UPGRADE_WINDOWS && next < quality_tier_count && !failedRecently) {
+            good_windows = 0;
+            setQualityTier(next, "headroom", avgMs, budgetMs, newDrops);
+        }
+    } else {
+        good_windows = 0;
+    }
+}
+
+void MpvObject::setQualityTier(int tier, QString reason, double renderMs, double budgetMs, qint64 drops)
+{
+    quality_tier = tier;
+    skip_windows = 1;
+    applyQualityTier();
+
+    QJsonObject stats;
+    stats["tier"] = tier;
+    stats["name"] = qualityTierName();
+    stats["reason"] = reason;
+    stats["renderMs"] = renderMs;
+    stats["budgetMs"] = budgetMs;
+    stats["drops"] = drops;
+    qDebug() << "MPV: quality tier" << stats;
+    Q_EMIT qualityTierChanged(tier);
+    Q_EMIT mpvEvent("mpv-quality-tier", stats);
+}
+
+//
+// Frames picture-in-picture renders, drawn by the main view: PiP alternates between its buffers, and only renders
+// into or deletes one once the fence we put after our last draw from it has passed; we wait on the fence put after
+// the frame was rendered. Everything is on the render threads, with the context current
+//
+void MpvObject::publishFrame(int buffer, GLuint texture, QSize size)
+{
+    GLsync ready = insertFence();
+    QMutexLocker lock(&shared_frame_mutex);
+    deleteFence(shared_ready);
+    shared_ready = ready;
+    shared_buffer = buffer;
+    shared_texture = texture;
+    shared_size = size;
+}
+
+void MpvObject::waitFrameReleased(int buffer)
+{
+    GLsync released;
+    {
+        QMutexLocker lock(&shared_frame_mutex);
+        released = shared_released[buffer];
+        shared_released[buffer] = 0;
+    }
+    waitFence(released);
+    deleteFence(released);
+}
+
+void MpvObject::unpublishFrames()
+{
+    {
+        QMutexLocker lock(&shared_frame_mutex);
+        deleteFence(shared_ready);
+        shared_ready = 0;
+        shared_buffer = -1;
+        shared_texture = 0;
+        shared_size = QSize();
+    }
+    for (int i = 0; i < PIP_FRAME_BUFFERS; i++) waitFrameReleased(i);
+}
+
+// Held until unlockSharedFrame(), so the frame can't be replaced while we draw it
+GLuint MpvObject::lockSharedFrame(QSize &size)
+{
+    shared_frame_mutex.lock();
+    waitFence(shared_ready);
+    size = shared_size;
+    return shared_texture;
+}
+
+void MpvObject::unlockSharedFrame()
+{
+    if (shared_buffer >= 0) {
+        deleteFence(shared_released[shared_buffer]);
+        shared_released[shared_buffer] = insertFence();
+    }
+    shared_frame_mutex.unlock();
+}
+
+// Dragging the window edge or going full screen goes through many sizes; only the last one gets an FBO
+void MpvObject::geometryChanged(const QRectF &newGeometry, const QRectF &oldGeometry)
+{
+    QQuickFramebufferObject::geometryChanged(newGeometry, oldGeometry);
+    if (newGeometry.size() == oldGeometry.size()) return;
+    resize_in_progress = true;
+    resize_timer.start();
+}
+
+void MpvObject::resizeSettled()
+{
+    resize_in_progress = false;
+    fbo_resize_pending = true;
+    update();
+}
+
+//
+// Occlusion: while the window is minimized, hidden to the tray or not exposed, the video track is turned off so
+// mpv doesn't decode it, and we don't render
+//
+void MpvObject::itemChange(ItemChange change, const ItemChangeData &value)
+{
+    if (change == ItemSceneChange) {
+        if (tracked_window) {
+            tracked_window->removeEventFilter(this);
+            disconnect(tracked_window, nullptr, this, nullptr);
+        }
+        tracked_window = value.window;
+        if (tracked_window) {
+            tracked_window->installEventFilter(this);
+            connect(tracked_window, &QWindow::visibilityChanged, this, &MpvObject::updateOcclusion);
+        }
+        updateOcclusion();
+    }
+    QQuickFramebufferObject::itemChange(change, value);
+}
+
+// Exposure has no signal of its own
+bool MpvObject::eventFilter(QObject *watched, QEvent *event)
+{
+    if (watched == tracked_window && event->type() == QEvent::Expose) updateOcclusion();
+    return QQuickFramebufferObject::eventFilter(watched, event);
+}
+
+bool MpvObject::isOccluded() const
+{
+    return !tracked_window || !tracked_window->isVisible() || tracked_window->visibility() == QWindow::Minimized
+        || !tracked_window->isExposed();
+}
+
+void MpvObject::updateOcclusion()
+{
+    if (!isOccluded()) {
+        suspend_timer.stop();
+        if (video_suspended) resumeVideo();
+        else if (visible_at == 0) {
+            visible_cpu = processCpuSeconds();
+            visible_at = cpu_clock.elapsed();
+        }
+        return;
+    }
+    if (!video_suspended && !suspend_timer.isActive()) suspend_timer.start();
+}
+
+void MpvObject::suspendVideo()
+{
+    // Nothing is decoded while paused anyway
+    if (video_suspended || !isOccluded() || !playback_active || pip_active) return;
+
+    // Only if there is a video track to turn off
+    QVariant vid = getProperty("vid");
+    if (vid.type() != QVariant::LongLong && vid.type() != QVariant::Int) return;
+
+    suspended_cpu = processCpuSeconds();
+    suspended_at = cpu_clock.elapsed();
+    cpu_percent_visible = -1;
+    if (visible_at > 0 && suspended_at > visible_at && visible_cpu >= 0)
+        cpu_percent_visible = (suspended_cpu - visible_cpu) * 100000.0 / (suspended_at - visible_at);
+
+    suspended_vid = vid;
+    video_suspended = true;
+    mpv::qt::set_property(mpv, "vid", "no");
+    qDebug() << "MPV: video suspended while the window is not visible";
+    Q_EMIT videoSuspendedChanged(true);
+}
+
+void MpvObject::resumeVideo()
+{
+    double pos = getProperty("time-pos").toDouble();
+    mpv::qt::set_property(mpv, "vid", suspended_vid);
+    // Back to the keyframe, so there is a picture right away instead of waiting for the next one
+    mpv::qt::command(mpv, QVariantList() << "seek" << pos << "absolute+keyframes");
+
+    double cpu = processCpuSeconds();
+    qint64 now = cpu_clock.elapsed();
+    QJsonObject stats;
+    stats["suspendedMs"] = now - suspended_at;
+    if (suspended_cpu >= 0 && now > suspended_at)
+        stats["cpuPercentSuspended"] = (cpu - suspended_cpu) * 100000.0 / (now - suspended_at);
+    if (cpu_percent_visible >= 0) stats["cpuPercentVisible"] = cpu_percent_visible;
+    qDebug() << "MPV: video resumed" << stats;
+    Q_EMIT mpvEvent("mpv-video-resumed", stats);
+
+    visible_cpu = cpu;
+    visible_at = now;
+    resetVideoSuspension();
+}
+
+void MpvObject::resetVideoSuspension()
+{
+    suspended_vid = QVariant();
+    if (video_suspended) {
+        video_suspended = false;
+        Q_EMIT videoSuspendedChanged(false);
+    }
+}
+
+double MpvObject::processCpuSeconds()
+{
+#ifdef Q_OS_UNIX
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0) return -1;
+    return usage.ru_utime.tv_sec + usage.ru_utime.tv_usec / 1e6 + usage.ru_stime.tv_sec + usage.ru_stime.tv_usec / 1e6;
+#elif defined(Q_OS_WIN32)
+    FILETIME creation, exit, kernel, user;
+    if (!GetProcessTimes(GetCurrentProcess(), &creation, &exit, &kernel, &user)) return -1;
+    ULARGE_INTEGER k, u;
+    k.LowPart = kernel.dwLowDateTime;
+    k.HighPart = kernel.dwHighDateTime;
+    u.LowPart = user.dwLowDateTime;
+    u.HighPart = user.dwHighDateTime;
+    return (k.QuadPart + u.QuadPart) / 1e7;
+#else
+    return -1;
+#endif
+}
+
 void MpvObject::command(const QVariant& params)
 {
     // does mpv_command_node internally; maybe we should use async? However, it seems async is not really needed atm...
@@ -241,6 +842,12 @@ void MpvObject::handle_mpv_event(mpv_event *event) {
         // case MPV_EVENT_CLIENT_MESSAGE:
         case MPV_EVENT_PROPERTY_CHANGE: {
             mpv_event_property *prop = (mpv_event_property *) event->data;
+            if (event->reply_userdata == MPV_OBSERVE_INTERNAL) {
+                handle_internal_property(prop);
+                break;
+            }
+            // The web UI shouldn't see the track go away while we're only saving on decoding
+            if (video_suspended && QString(prop->name) == "vid") break;
             eventJson["name"] = QString(prop->name);
 
             // NOTE: because we always observe as node, we can handle only that case; we are handling the others, to be safe :)
@@ -270,6 +877,7 @@ void MpvObject::handle_mpv_event(mpv_event *event) {
         case MPV_EVENT_END_FILE: {
             // Hide player back when playback is finished
             this->setVisible(false);
+            resetVideoSuspension();
             mpv_event_end_file *endFile = (mpv_event_end_file *)event->data;
             switch (endFile->reason) {
                 case MPV_END_FILE_REASON_ERROR:
@@ -289,11 +897,23 @@ void MpvObject::handle_mpv_event(mpv_event *event) {
         case MPV_EVENT_SHUTDOWN: {
             if (mpv_gl) // only initialized if something got drawn
             {
+                QMutexLocker lock(&render_host_mutex);
                 mpv_render_context_free(mpv_gl);
                 mpv_gl = nullptr;
+                render_host = NoHost;
             }
             mpv_terminate_destroy(mpv);
             mpv = mpv_create();
+            core_paused = true;
+            if (!core_idle_active) {
+                core_idle_active = true;
+                Q_EMIT fileLoadedChanged(false);
+            }
+            resetVideoSuspension();
+            if (playback_active) {
+                playback_active = false;
+                Q_EMIT playbackActiveChanged(false);
+            }
             initialize_mpv();
             break;
         }
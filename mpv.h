@@ -3,6 +3,13 @@
 #define MPV_ENABLE_DEPRECATED 0
 
 #include <QtQuick/QQuickFramebufferObject>
+#include <QtQuick/QQuickWindow>
+#include <QElapsedTimer>
+#include <QHash>
+#include <QMutex>
+#include <QtGui/qopengl.h>
+#include <QPointer>
+#include <QTimer>
 
 #include <mpv/client.h>
 #include <mpv/render_gl.h>
@@ -10,14 +17,54 @@
 
 class MpvRenderer;
 
+// reply_userdata for properties we observe for ourselves; those are not forwarded as mpvEvent
+#define MPV_OBSERVE_INTERNAL 1
+
+// How long the window has to stay out of sight before video decoding is suspended
+#define VIDEO_SUSPEND_DELAY_MS 2000
+
+// How long the size has to stay the same before the FBO is reallocated; until then, the old one is drawn scaled
+#define FBO_RESIZE_DEBOUNCE_MS 150
+
+// Quality governor: every interval, the average render time is compared to the frame budget
+// Over budget, or dropping frames, steps down right away; it steps up only after enough windows well under budget,
+// and not into a tier that failed recently
+#define GOVERNOR_INTERVAL_MS 2000
+#define GOVERNOR_MIN_FRAMES 10
+#define GOVERNOR_OVER_BUDGET 0.75
+#define GOVERNOR_UNDER_BUDGET 0.35
+#define GOVERNOR_MAX_DROPS 2
+#define GOVERNOR_UPGRADE_WINDOWS 5
+#define GOVERNOR_RETRY_MS (5 * 60 * 1000)
+#define GOVERNOR_DEFAULT_TIER 1
+// Render times are measured on the GPU, with timer queries read back that many frames later so we never wait on them
+#define GPU_TIMER_FRAMES 3
+
+// Picture-in-picture renders into that many textures in turn, so the main view can draw one while the next is rendered
+#define PIP_FRAME_BUFFERS 2
+
 class MpvObject : public QQuickFramebufferObject
 {
     Q_OBJECT
+    // true while a file is loaded and not paused
+    Q_PROPERTY(bool playbackActive READ playbackActive NOTIFY playbackActiveChanged)
+    // true while a file is loaded, paused or not (mpv's idle-active is false)
+    Q_PROPERTY(bool fileLoaded READ fileLoaded NOTIFY fileLoadedChanged)
+    // true while the video track is turned off because the window can't be seen; audio and the clock keep going
+    Q_PROPERTY(bool videoSuspended READ videoSuspended NOTIFY videoSuspendedChanged)
+    // Rendering profile picked by the quality governor, from 0 (cheapest) up
+    Q_PROPERTY(int qualityTier READ qualityTier NOTIFY qualityTierChanged)
+    Q_PROPERTY(QString qualityTierName READ qualityTierName NOTIFY qualityTierChanged)
+    // Turning it off keeps the current tier
+    Q_PROPERTY(bool qualityGovernorEnabled MEMBER quality_governor_enabled NOTIFY qualityGovernorEnabledChanged)
+    // Set while a picture-in-picture view is shown; it renders the video then, and the video is never suspended
+    Q_PROPERTY(bool pipActive MEMBER pip_active NOTIFY pipActiveChanged)
 
     mpv_handle *mpv;
     mpv_render_context *mpv_gl;
 
     friend class MpvRenderer;
+    friend class MpvPipRenderer;
 
 public:
     static void on_update(void *ctx);
@@ -26,6 +73,15 @@ public:
     virtual ~MpvObject();
     virtual Renderer *createRenderer() const;
 
+    bool playbackActive() const { return playback_active; }
+    bool fileLoaded() const { return !core_idle_active; }
+    bool videoSuspended() const { return video_suspended; }
+    int qualityTier() const { return quality_tier; }
+    QString qualityTierName() const;
+
+    // Average render time over the last governor interval
+    double lastRenderMs() const { return last_render_ms; }
+
 public slots:
     void command(const QVariant& params);
     void setProperty(const QString& name, const QVariant& value);
@@ -35,16 +91,101 @@ public slots:
 signals:
     void onUpdate();
     void mpvEvent(const QString& ev, const QVariant& value);
+    void playbackActiveChanged(bool active);
+    void fileLoadedChanged(bool loaded);
+    void videoSuspendedChanged(bool suspended);
+    void qualityTierChanged(int tier);
+    void qualityGovernorEnabledChanged(bool enabled);
+    void pipActiveChanged(bool active);
+    // For picture-in-picture to render a frame
+    void pipFrameWanted();
+    // Emitted from picture-in-picture's render thread after every frame it renders
+    void frameRendered();
+
+protected:
+    void itemChange(ItemChange change, const ItemChangeData &value) override;
+    void geometryChanged(const QRectF &newGeometry, const QRectF &oldGeometry) override;
+    bool eventFilter(QObject *watched, QEvent *event) override;
 
 private slots:
     void doUpdate();
     void on_mpv_events();
+    void updateOcclusion();
+    void suspendVideo();
+    void resizeSettled();
+    void evaluateQuality();
+    void pipChanged(bool active);
 
 private:
     static void wakeup(void *ctx);
     void handle_mpv_event(mpv_event *event);
     void initialize_mpv();
+    void handle_internal_property(mpv_event_property *prop);
     QSet<QString> observed_properties;
+
+    bool core_paused = true;
+    bool core_idle_active = true;
+    bool playback_active = false;
+
+    // Occlusion
+    bool isOccluded() const;
+    void resumeVideo();
+    void resetVideoSuspension();
+    static double processCpuSeconds();
+    QPointer<QQuickWindow> tracked_window;
+    QTimer suspend_timer;
+    bool video_suspended = false;
+    QVariant suspended_vid;
+    // CPU time and wall clock at the last time the video became visible, and when it was suspended
+    QElapsedTimer cpu_clock;
+    double visible_cpu = 0;
+    qint64 visible_at = 0;
+    double suspended_cpu = 0;
+    qint64 suspended_at = 0;
+    double cpu_percent_visible = -1;
+
+    // Resizing; the flags are read by the renderer while the GUI thread is blocked in synchronize()
+    QTimer resize_timer;
+    bool resize_in_progress = false;
+    bool fbo_resize_pending = false;
+
+    // Quality governor; render stats are handed over by the renderer in synchronize()
+    void setQualityTier(int tier, QString reason, double renderMs, double budgetMs, qint64 drops);
+    void applyQualityTier();
+    QTimer governor_timer;
+    bool quality_governor_enabled = true;
+    int quality_tier = GOVERNOR_DEFAULT_TIER;
+    bool quality_tier_applied = false;
+    int render_frames = 0;
+    double render_ms_total = 0;
+    double render_ms_max = 0;
+    qint64 last_drop_count = 0;
+    int good_windows = 0;
+    int skip_windows = 0;
+    QHash<int, qint64> tier_failed_at;
+    double last_render_ms = 0;
+
+    // Which view's GL context has mpv's render context: ours, or picture-in-picture's while it's shown, so the
+    // video keeps playing there with the main window minimized or in the tray
+    enum RenderHost { NoHost, MainHost, PipHost };
+    bool acquireRenderContext(RenderHost host);
+    void releaseRenderContext(RenderHost host);
+    QMutex render_host_mutex;
+    RenderHost render_host = NoHost;
+
+    // Frames picture-in-picture renders, for the main view; written on PiP's render thread, read on ours
+    void publishFrame(int buffer, GLuint texture, QSize size);
+    void waitFrameReleased(int buffer);
+    void unpublishFrames();
+    GLuint lockSharedFrame(QSize &size);
+    void unlockSharedFrame();
+    bool pip_active = false;
+    QMutex shared_frame_mutex;
+    GLsync shared_ready = 0;
+    GLsync shared_released[PIP_FRAME_BUFFERS] = {};
+    int shared_buffer = -1;
+    GLuint shared_texture = 0;
+    QSize shared_size;
 };
 
 #endif
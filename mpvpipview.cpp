@@ -0,0 +1,148 @@
+#include "mpvpipview.h"
+
+#include <QDebug>
+#include <QElapsedTimer>
+#include <QOpenGLContext>
+#include <QOpenGLFunctions>
+#include <QOpenGLTextureBlitter>
+#include <QtGui/QOpenGLFramebufferObject>
+#include <QtQuick/QQuickWindow>
+
+class MpvPipRenderer : public QQuickFramebufferObject::Renderer
+{
+    MpvPipView *view;
+    MpvObject *src = nullptr;
+    bool active = false;
+    QOpenGLTextureBlitter blitter;
+
+    // What mpv renders into, in turn; at the main view's size while it's visible, so it draws them unscaled
+    QOpenGLFramebufferObject *buffers[PIP_FRAME_BUFFERS] = {};
+    int next_buffer = 0;
+    QSize frame_size;
+
+    int frames = 0;
+    double render_ms = 0;
+
+public:
+    MpvPipRenderer(MpvPipView *new_view) : view{new_view} { }
+
+    // Destroyed on the render thread, with the context current
+    virtual ~MpvPipRenderer()
+    {
+        if (src) {
+            src->unpublishFrames();
+            src->releaseRenderContext(MpvObject::PipHost);
+        }
+        for (int i = 0; i < PIP_FRAME_BUFFERS; i++) delete buffers[i];
+        if (blitter.isCreated()) blitter.destroy();
+    }
+
+    void synchronize(QQuickFramebufferObject *)
+    {
+        // The source outlives us; it's only set once
+        if (view->src) src = view->src;
+        active = src && src->pip_active;
+        if (!src || src->isOccluded()) {
+            frame_size = QSize();
+        } else if (!src->resize_in_progress) {
+            frame_size = (QSizeF(src->width(), src->height()) * src->window()->effectiveDevicePixelRatio()).toSize();
+        }
+
+        view->frames += frames;
+        view->render_ms += render_ms;
+        frames = 0;
+        render_ms = 0;
+    }
+
+    void render()
+    {
+        QOpenGLFunctions *f = QOpenGLContext::currentContext()->functions();
+        QOpenGLFramebufferObject *fbo = framebufferObject();
+
+        // Until the main view has handed mpv's render context over, there's nothing to draw
+        if (!active || !src->acquireRenderContext(MpvObject::PipHost)) {
+            f->glClearColor(0, 0, 0, 1);
+            f->glClear(GL_COLOR_BUFFER_BIT);
+            view->window()->resetOpenGLState();
+            return;
+        }
+
+        QElapsedTimer timer;
+        timer.start();
+        QSize size = frame_size.isEmpty() ? fbo->size() : frame_size;
+        int buffer = next_buffer;
+        next_buffer = (next_buffer + 1) % PIP_FRAME_BUFFERS;
+        // The main view may still be drawing the last frame in it
+        src->waitFrameReleased(buffer);
+        if (!buffers[buffer] || buffers[buffer]->size() != size) {
+            delete buffers[buffer];
+            buffers[buffer] = new QOpenGLFramebufferObject(size);
+        }
+
+        view->window()->resetOpenGLState();
+        mpv_opengl_fbo mpfbo{static_cast<int>(buffers[buffer]->handle()), size.width(), size.height(), 0};
+        int flip_y{0};
+        mpv_render_param params[] = {
+            {MPV_RENDER_PARAM_OPENGL_FBO, &mpfbo},
+            {MPV_RENDER_PARAM_FLIP_Y, &flip_y},
+            {MPV_RENDER_PARAM_INVALID, nullptr}};
+        mpv_render_context_render(src->mpv_gl, params);
+        view->window()->resetOpenGLState();
+
+        src->publishFrame(buffer, buffers[buffer]->texture(), size);
+        Q_EMIT src->frameRendered();
+
+        fbo->bind();
+        f->glClearColor(0, 0, 0, 1);
+        f->glClear(GL_COLOR_BUFFER_BIT);
+        if (!blitter.isCreated()) blitter.create();
+        // Fit, keeping the aspect ratio of the main view
+        QSizeF fitted = QSizeF(size).scaled(fbo->size(), Qt::KeepAspectRatio);
+        QRectF target(QPointF((fbo->width() - fitted.width()) / 2, (fbo->height() - fitted.height()) / 2), fitted);
+        blitter.bind();
+        blitter.blit(buffers[buffer]->texture(), QOpenGLTextureBlitter::targetTransform(target, QRect(QPoint(0, 0), fbo->size())),
+                     QOpenGLTextureBlitter::OriginBottomLeft);
+        blitter.release();
+
+        frames++;
+        render_ms += timer.nsecsElapsed() / 1e6;
+
+        view->window()->resetOpenGLState();
+    }
+};
+
+MpvPipView::MpvPipView(QQuickItem * parent) : QQuickFramebufferObject(parent)
+{
+    stats_timer.setInterval(PIP_STATS_INTERVAL_MS);
+    connect(&stats_timer, &QTimer::timeout, this, &MpvPipView::reportStats);
+    stats_timer.start();
+}
+
+QQuickFramebufferObject::Renderer *MpvPipView::createRenderer() const
+{
+    return new MpvPipRenderer(const_cast<MpvPipView *>(this));
+}
+
+void MpvPipView::setSource(MpvObject* source)
+{
+    if (src == source) return;
+    if (src) disconnect(src, &MpvObject::pipFrameWanted, this, &MpvPipView::update);
+    src = source;
+    if (src) connect(src, &MpvObject::pipFrameWanted, this, &MpvPipView::update);
+    emit sourceChanged();
+    update();
+}
+
+void MpvPipView::reportStats()
+{
+    if (!src || frames == 0) return;
+
+    QVariantMap s;
+    s["renderMs"] = src->lastRenderMs();
+    s["pipRenderMs"] = render_ms / frames;
+    s["pipFrames"] = frames;
+    frames = 0;
+    render_ms = 0;
+    qDebug() << "MPV: picture-in-picture" << s;
+    emit stats(s);
+}
@@ -0,0 +1,48 @@
+#ifndef MPVPIPVIEW_H
+#define MPVPIPVIEW_H
+
+#include <QtQuick/QQuickFramebufferObject>
+#include <QTimer>
+#include <QPointer>
+#include <QVariantMap>
+
+#include "mpv.h"
+
+// How often the render cost of both views is reported while picture-in-picture is shown
+#define PIP_STATS_INTERVAL_MS 5000
+
+// Picture-in-picture: the video of an MpvObject, scaled to fit, in another window
+// No second decode or stream: while it's shown, mpv renders in this window's GL context, so it doesn't depend on the
+// main window being exposed, and the main view draws the frames from here (Qt::AA_ShareOpenGLContexts)
+class MpvPipView : public QQuickFramebufferObject
+{
+    Q_OBJECT
+    Q_PROPERTY(MpvObject* source READ source WRITE setSource NOTIFY sourceChanged)
+
+    friend class MpvPipRenderer;
+
+public:
+    MpvPipView(QQuickItem * parent = 0);
+    virtual Renderer *createRenderer() const;
+
+    MpvObject* source() const { return src; }
+    void setSource(MpvObject* source);
+
+signals:
+    void sourceChanged();
+    // renderMs is the main view's draw of our frames, pipRenderMs ours, with mpv's render; both averages over the interval
+    void stats(QVariantMap stats);
+
+private slots:
+    void reportStats();
+
+private:
+    QPointer<MpvObject> src;
+
+    // Handed over by the renderer in synchronize()
+    int frames = 0;
+    double render_ms = 0;
+    QTimer stats_timer;
+};
+
+#endif // MPVPIPVIEW_H
@@ -0,0 +1,173 @@
+#include "processtelemetry.h"
+
+#include <QDir>
+#include <QFile>
+
+#ifdef Q_OS_LINUX
+#include <unistd.h>
+#endif
+
+#define DEFAULT_INTERVAL_MS 5000
+
+ProcessTelemetry::ProcessTelemetry(QObject *parent) : QObject(parent) {
+    // Precision doesn't matter here, let the OS batch our wakeups with others
+    timer.setTimerType(Qt::VeryCoarseTimer);
+    timer.setInterval(DEFAULT_INTERVAL_MS);
+    QObject::connect(&timer, &QTimer::timeout, this, &ProcessTelemetry::onTimer);
+}
+
+void ProcessTelemetry::setOptions(const QVariantMap &options) {
+    if (options.contains("intervalMs")) timer.setInterval(qMax(1000, options.value("intervalMs").toInt()));
+    if (options.contains("windowSize")) windowSize = qMax(2, options.value("windowSize").toInt());
+    if (options.contains("rssLimitMB")) rssLimit = options.value("rssLimitMB").toLongLong() * 1024 * 1024;
+    if (options.contains("rssLimitMinutes")) rssLimitMs = options.value("rssLimitMinutes").toLongLong() * 60 * 1000;
+    if (options.contains("fdLimit")) fdLimit = options.value("fdLimit").toLongLong();
+    rssAboveSince = -1;
+    thresholdReported = false;
+}
+
+QVariantMap ProcessTelemetry::options() const {
+    QVariantMap opts;
+    opts["intervalMs"] = timer.interval();
+    opts["windowSize"] = windowSize;
+    opts["rssLimitMB"] = rssLimit / (1024 * 1024);
+    opts["rssLimitMinutes"] = rssLimitMs / (60 * 1000);
+    opts["fdLimit"] = fdLimit;
+    return opts;
+}
+
+void ProcessTelemetry::start(qint64 newPid) {
+    pid = newPid;
+    window.clear();
+    rssAboveSince = -1;
+    thresholdReported = false;
+    clock.start();
+#ifdef Q_OS_LINUX
+    if (pid > 0) {
+        onTimer();
+        timer.start();
+    }
+#endif
+}
+
+void ProcessTelemetry::stop() {
+    timer.stop();
+}
+
+void ProcessTelemetry::onTimer() {
+    Sample s;
+    if (!readSample(pid, s)) return; // process is probably gone; finished() will stop us
+    s.at = clock.elapsed();
+
+    window.append(s);
+    while (window.size() > windowSize) window.removeFirst();
+
+    QVariantMap snap = snapshot();
+    emit sampled(snap);
+
+    if (thresholdReported) return;
+
+    if (rssLimit > 0 && s.rss > rssLimit) {
+        if (rssAboveSince < 0) rssAboveSince = s.at;
+        if (s.at - rssAboveSince >= rssLimitMs) {
+            thresholdReported = true;
+            emit thresholdExceeded(QString("RSS above %1 MB for %2 minutes")
+                                   .arg(rssLimit / (1024 * 1024)).arg(rssLimitMs / (60 * 1000)), snap);
+            return;
+        }
+    } else {
+        rssAboveSince = -1;
+    }
+
+    if (fdLimit > 0 && s.fds > fdLimit) {
+        thresholdReported = true;
+        emit thresholdExceeded(QString("more than %1 open file descriptors").arg(fdLimit), snap);
+    }
+}
+
+QVariantMap ProcessTelemetry::snapshot() const {
+    QVariantMap snap;
+    snap["pid"] = pid;
+    if (window.isEmpty()) return snap;
+
+    const Sample &last = window.last();
+    const Sample &first = window.first();
+    snap["uptimeMs"] = last.at;
+    snap["rss"] = last.rss;
+    snap["cpuTime"] = last.cpuTime;
+    snap["fds"] = last.fds;
+    snap["readBytes"] = last.readBytes;
+    snap["writeBytes"] = last.writeBytes;
+
+    qint64 rssMin = last.rss, rssMax = last.rss, rssSum = 0;
+    foreach (const Sample &s, window) {
+        rssMin = qMin(rssMin, s.rss);
+        rssMax = qMax(rssMax, s.rss);
+        rssSum += s.rss;
+    }
+    qint64 span = last.at - first.at;
+    QVariantMap win;
+    win["samples"] = window.size();
+    win["spanMs"] = span;
+    win["rssMin"] = rssMin;
+    win["rssMax"] = rssMax;
+    win["rssAvg"] = rssSum / window.size();
+    if (span > 0) {
+        win["cpuPercent"] = (last.cpuTime - first.cpuTime) * 100000.0 / span;
+        win["readBytesPerSec"] = (last.readBytes - first.readBytes) * 1000 / span;
+        win["writeBytesPerSec"] = (last.writeBytes - first.writeBytes) * 1000 / span;
+    }
+    snap["window"] = win;
+    return snap;
+}
+
+QVariantMap ProcessTelemetry::sample(qint64 pid) {
+    QVariantMap result;
+    result["pid"] = pid;
+    Sample s;
+    if (!readSample(pid, s)) return result;
+    result["rss"] = s.rss;
+    result["cpuTime"] = s.cpuTime;
+    result["fds"] = s.fds;
+    result["readBytes"] = s.readBytes;
+    result["writeBytes"] = s.writeBytes;
+    return result;
+}
+
+bool ProcessTelemetry::readSample(qint64 pid, Sample &s) {
+    s = Sample();
+#ifdef Q_OS_LINUX
+    if (pid <= 0) return false;
+    QString base = QString("/proc/%1/").arg(pid);
+
+    // utime and stime are fields 14 and 15; the command name (field 2) may contain spaces, so skip past it
+    QFile stat(base + "stat");
+    if (!stat.open(QFile::ReadOnly)) return false;
+    QByteArray statLine = stat.readAll();
+    QList<QByteArray> fields = statLine.mid(statLine.lastIndexOf(')') + 2).split(' ');
+    if (fields.size() < 13) return false;
+    static const double ticks = sysconf(_SC_CLK_TCK);
+    s.cpuTime = (fields[11].toLongLong() + fields[12].toLongLong()) / ticks;
+
+    QFile status(base + "status");
+    if (status.open(QFile::ReadOnly)) {
+        foreach (const QByteArray &line, status.readAll().split('\n')) {
+            if (line.startsWith("VmRSS:")) s.rss = line.mid(6).trimmed().split(' ').first().toLongLong() * 1024;
+        }
+    }
+
+    QFile io(base + "io");
+    if (io.open(QFile::ReadOnly)) {
+        foreach (const QByteArray &line, io.readAll().split('\n')) {
+            if (line.startsWith("read_bytes:")) s.readBytes = line.mid(11).trimmed().toLongLong();
+            if (line.startsWith("write_bytes:")) s.writeBytes = line.mid(12).trimmed().toLongLong();
+        }
+    }
+
+    s.fds = QDir(base + "fd").entryList(QDir::AllEntries | QDir::System | QDir::NoDotAndDotDot).size();
+    return true;
+#else
+    Q_UNUSED(pid)
+    return false;
+#endif
+}
@@ -0,0 +1,71 @@
+#ifndef PROCESSTELEMETRY_H
+#define PROCESSTELEMETRY_H
+
+#include <QObject>
+#include <QTimer>
+#include <QVariantMap>
+#include <QVector>
+#include <QElapsedTimer>
+
+// Periodically samples /proc/<pid>/{stat,status,io,fd} of a child process and keeps a rolling window of samples
+// Only implemented on Linux; elsewhere snapshots only contain the pid
+class ProcessTelemetry : public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit ProcessTelemetry(QObject *parent = 0);
+
+    // Supported options:
+    //   intervalMs      - sampling interval
+    //   windowSize      - number of samples kept
+    //   rssLimitMB      - RSS threshold; 0 disables it
+    //   rssLimitMinutes - how long RSS has to stay above rssLimitMB before thresholdExceeded is emitted
+    //   fdLimit         - open file descriptors threshold; 0 disables it
+    void setOptions(const QVariantMap &options);
+    QVariantMap options() const;
+
+    void start(qint64 pid);
+    void stop();
+
+    // Latest sample together with min/max/avg over the window; still available after the process has exited
+    QVariantMap snapshot() const;
+
+    // One-off sample of any process
+    static QVariantMap sample(qint64 pid);
+    Q_INVOKABLE QVariantMap sampleProcess(qint64 pid) const { return sample(pid); }
+
+signals:
+    void sampled(QVariantMap snapshot);
+    void thresholdExceeded(QString reason, QVariantMap snapshot);
+
+private slots:
+    void onTimer();
+
+private:
+    struct Sample {
+        qint64 at; // ms since start()
+        qint64 rss; // bytes
+        double cpuTime; // seconds, user + system
+        qint64 fds;
+        qint64 readBytes;
+        qint64 writeBytes;
+    };
+
+    static bool readSample(qint64 pid, Sample &s);
+
+    QTimer timer;
+    QElapsedTimer clock;
+    qint64 pid = 0;
+    QVector<Sample> window;
+
+    int windowSize = 60;
+    qint64 rssLimit = 0;
+    qint64 rssLimitMs = 0;
+    qint64 fdLimit = 0;
+
+    qint64 rssAboveSince = -1;
+    bool thresholdReported = false;
+};
+
+#endif // PROCESSTELEMETRY_H
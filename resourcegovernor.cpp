@@ -0,0 +1,224 @@
+#include "resourcegovernor.h"
+
+#include <QDebug>
+#include <QDir>
+#include <QFile>
+#include <QCoreApplication>
+
+#ifdef Q_OS_LINUX
+#include <sched.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+
+// Not exported by glibc; see linux/ioprio.h
+#define IOPRIO_CLASS_SHIFT 13
+#define IOPRIO_PRIO_MASK ((1UL << IOPRIO_CLASS_SHIFT) - 1)
+#define IOPRIO_WHO_PROCESS 1
+
+enum { IOPRIO_CLASS_NONE, IOPRIO_CLASS_RT, IOPRIO_CLASS_BE, IOPRIO_CLASS_IDLE };
+
+#define CGROUP2_MOUNT "/sys/fs/cgroup"
+
+static const char* ioClassNames[] = { "none", "realtime", "best-effort", "idle" };
+#endif
+
+ResourceGovernor::~ResourceGovernor() {
+    release();
+}
+
+QVariantMap ResourceGovernor::apply(qint64 pid, const QVariantMap &policy) {
+#ifdef Q_OS_LINUX
+    QStringList errors;
+    QList<qint64> tids = threadsOf(pid);
+
+    // nice, ioprio and affinity are per-thread on Linux, so apply them to each task of the process
+    if (policy.contains("nice")) {
+        int nice = policy.value("nice").toInt();
+        foreach (qint64 tid, tids) {
+            if (setpriority(PRIO_PROCESS, (id_t)tid, nice) != 0) {
+                errors << QString("nice %1 on %2: %3").arg(nice).arg(tid).arg(strerror(errno));
+                break;
+            }
+        }
+    }
+
+    if (policy.contains("ioClass")) {
+        QString name = policy.value("ioClass").toString();
+        int ioClass = IOPRIO_CLASS_NONE;
+        for (int i = 0; i != 4; i++) if (name == ioClassNames[i]) ioClass = i;
+        int level = ioClass == IOPRIO_CLASS_IDLE ? 0 : qBound(0, policy.value("ioLevel", 4).toInt(), 7);
+        int prio = (ioClass << IOPRIO_CLASS_SHIFT) | level;
+        foreach (qint64 tid, tids) {
+            if (syscall(SYS_ioprio_set, IOPRIO_WHO_PROCESS, (int)tid, prio) != 0) {
+                errors << QString("ioprio %1/%2 on %3: %4").arg(name).arg(level).arg(tid).arg(strerror(errno));
+                break;
+            }
+        }
+    }
+
+    if (policy.contains("cpuAffinity")) {
+        QVariantList cpus = policy.value("cpuAffinity").toList();
+        long cpuCount = sysconf(_SC_NPROCESSORS_ONLN);
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        if (cpus.isEmpty()) {
+            for (long i = 0; i < cpuCount && i < CPU_SETSIZE; i++) CPU_SET(i, &set);
+        } else {
+            foreach (const QVariant &cpu, cpus) {
+                int i = cpu.toInt();
+                if (i >= 0 && i < cpuCount && i < CPU_SETSIZE) CPU_SET(i, &set);
+            }
+        }
+        if (CPU_COUNT(&set) == 0) {
+            errors << "cpuAffinity: no valid CPUs given";
+        } else {
+            foreach (qint64 tid, tids) {
+                if (sched_setaffinity((pid_t)tid, sizeof(set), &set) != 0) {
+                    errors << QString("cpuAffinity on %1: %2").arg(tid).arg(strerror(errno));
+                    break;
+                }
+            }
+        }
+    }
+
+    if (policy.contains("cpuMax") || policy.contains("memoryHigh")) {
+        if (ensureCgroup(pid, errors)) {
+            if (policy.contains("cpuMax"))
+                writeCgroupFile("cpu.max", policy.value("cpuMax").toString().toLatin1(), errors);
+            if (policy.contains("memoryHigh"))
+                writeCgroupFile("memory.high", policy.value("memoryHigh").toString().toLatin1(), errors);
+        }
+    }
+
+    foreach (const QString &err, errors) qWarning() << "ResourceGovernor:" << err;
+
+    QVariantMap result = state(pid);
+    result["errors"] = errors;
+    return result;
+#else
+    Q_UNUSED(policy)
+    QVariantMap result = state(pid);
+    result["errors"] = QStringList("resource policies are only supported on Linux");
+    return result;
+#endif
+}
+
+QVariantMap ResourceGovernor::state(qint64 pid) {
+    QVariantMap result;
+    result["pid"] = pid;
+#ifdef Q_OS_LINUX
+    if (pid <= 0) return result;
+
+    errno = 0;
+    int nice = getpriority(PRIO_PROCESS, (id_t)pid);
+    if (errno == 0) result["nice"] = nice;
+
+    int prio = (int)syscall(SYS_ioprio_get, IOPRIO_WHO_PROCESS, (int)pid);
+    if (prio >= 0) {
+        int ioClass = prio >> IOPRIO_CLASS_SHIFT;
+        result["ioClass"] = ioClass < 4 ? ioClassNames[ioClass] : "unknown";
+        result["ioLevel"] = (int)(prio & IOPRIO_PRIO_MASK);
+    }
+
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    if (sched_getaffinity((pid_t)pid, sizeof(set), &set) == 0) {
+        QVariantList cpus;
+        for (int i = 0; i < CPU_SETSIZE; i++) if (CPU_ISSET(i, &set)) cpus << i;
+        result["cpuAffinity"] = cpus;
+    }
+
+    if (!cgroupPath.isEmpty()) {
+        result["cgroup"] = cgroupPath;
+        result["cpuMax"] = readCgroupFile("cpu.max");
+        result["memoryHigh"] = readCgroupFile("memory.high");
+    }
+#endif
+    return result;
+}
+
+void ResourceGovernor::release() {
+#ifdef Q_OS_LINUX
+    if (cgroupPath.isEmpty()) return;
+    // Only succeeds once the child is gone, which is the only time we call it
+    if (!QDir().rmdir(cgroupPath)) qWarning() << "ResourceGovernor: unable to remove" << cgroupPath;
+    cgroupPath.clear();
+#endif
+}
+
+#ifdef Q_OS_LINUX
+QList<qint64> ResourceGovernor::threadsOf(qint64 pid) {
+    QList<qint64> tids;
+    QDir tasks(QString("/proc/%1/task").arg(pid));
+    foreach (const QString &tid, tasks.entryList(QDir::Dirs | QDir::NoDotAndDotDot)) tids << tid.toLongLong();
+    if (tids.isEmpty()) tids << pid;
+    return tids;
+}
+
+bool ResourceGovernor::ensureCgroup(qint64 pid, QStringList &errors) {
+    if (cgroupPath.isEmpty()) {
+        // cgroup v2 only: the unified hierarchy line looks like "0::/user.slice/.../app.scope"
+        QFile self("/proc/self/cgroup");
+        QString own;
+        if (self.open(QFile::ReadOnly)) {
+            foreach (const QByteArray &line, self.readAll().split('\n')) {
+                if (line.startsWith("0::")) own = QString::fromLocal8Bit(line.mid(3));
+            }
+        }
+        if (own.isEmpty()) {
+            errors << "cgroup: cgroup v2 hierarchy not found";
+            return false;
+        }
+
+        // We cannot nest it under our own cgroup (no internal processes rule), so we create a sibling
+        QDir parent(CGROUP2_MOUNT + own);
+        if (!parent.cdUp()) {
+            errors << "cgroup: no parent for " + own;
+            return false;
+        }
+        QString name = QString("stremio-server-%1").arg(QCoreApplication::applicationPid());
+        if (!parent.exists(name) && !parent.mkdir(name)) {
+            errors << "cgroup: unable to create " + parent.filePath(name);
+            return false;
+        }
+        cgroupPath = parent.filePath(name);
+
+        // Controllers may already be enabled; if they are not and we're not allowed to, the writes below will fail
+        QFile subtree(parent.filePath("cgroup.subtree_control"));
+        if (subtree.open(QFile::WriteOnly | QFile::Unbuffered)) {
+            subtree.write("+cpu +memory");
+            subtree.close();
+        }
+    }
+
+    QFile procs(cgroupPath + "/cgroup.procs");
+    QByteArray current;
+    if (procs.open(QFile::ReadOnly)) {
+        current = procs.readAll();
+        procs.close();
+    }
+    if (current.split('\n').contains(QByteArray::number(pid))) return true;
+
+    return writeCgroupFile("cgroup.procs", QByteArray::number(pid), errors);
+}
+
+QString ResourceGovernor::readCgroupFile(const QString &name) {
+    QFile file(cgroupPath + "/" + name);
+    if (!file.open(QFile::ReadOnly)) return QString();
+    return QString::fromLatin1(file.readAll()).trimmed();
+}
+
+bool ResourceGovernor::writeCgroupFile(const QString &name, const QByteArray &value, QStringList &errors) {
+    QFile file(cgroupPath + "/" + name);
+    // cgroupfs reports errors on write, not on open
+    if (!file.open(QFile::WriteOnly | QFile::Unbuffered) || file.write(value) != value.size()) {
+        errors << QString("cgroup: unable to write '%1' to %2: %3")
+                  .arg(QString::fromLatin1(value), name, file.errorString());
+        return false;
+    }
+    return true;
+}
+#endif
@@ -0,0 +1,41 @@
+#ifndef RESOURCEGOVERNOR_H
+#define RESOURCEGOVERNOR_H
+
+#include <QObject>
+#include <QString>
+#include <QVariantMap>
+
+// Applies a CPU/IO/memory policy to a child process (and all of its threads)
+// Supported policy keys:
+//   nice        - int, -20..19
+//   ioClass     - "realtime", "best-effort" or "idle"
+//   ioLevel     - int, 0..7 (only meaningful for realtime and best-effort)
+//   cpuMax      - cgroup v2 cpu.max value, e.g. "max" or "200000 100000"
+//   memoryHigh  - cgroup v2 memory.high value, e.g. "max" or bytes
+//   cpuAffinity - list of CPU indexes; empty list means all CPUs
+// The cgroup is transient: it is created next to our own cgroup on first use and removed by release()
+// Everything is best-effort; the returned state is read back from the kernel and contains an "errors" list
+class ResourceGovernor : public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit ResourceGovernor(QObject *parent = 0) : QObject(parent) { }
+    ~ResourceGovernor();
+
+    QVariantMap apply(qint64 pid, const QVariantMap &policy);
+    QVariantMap state(qint64 pid);
+    void release();
+
+private:
+#ifdef Q_OS_LINUX
+    QList<qint64> threadsOf(qint64 pid);
+    bool ensureCgroup(qint64 pid, QStringList &errors);
+    QString readCgroupFile(const QString &name);
+    bool writeCgroupFile(const QString &name, const QByteArray &value, QStringList &errors);
+
+    QString cgroupPath;
+#endif
+};
+
+#endif // RESOURCEGOVERNOR_H
@@ -2,10 +2,18 @@
 #include <QtCore/QLibrary>
 #ifdef Q_OS_LINUX
 #include <QtDBus/QDBusConnection>
-#include <QtDBus/QDBusInterface>
-#include <QtDBus/QDBusReply>
-static QDBusInterface screenSaverInterface("org.freedesktop.ScreenSaver", 
-           "/org/freedesktop/ScreenSaver", "org.freedesktop.ScreenSaver");
+#include <QtDBus/QDBusMessage>
+#include <QtDBus/QDBusObjectPath>
+#include <QtDBus/QDBusPendingCall>
+#define SCREENSAVER_SERVICE "org.freedesktop.ScreenSaver"
+#define SCREENSAVER_PATH "/org/freedesktop/ScreenSaver"
+#define SCREENSAVER_IFACE "org.freedesktop.ScreenSaver"
+// Used in Flatpak, or when there is no screensaver service
+#define PORTAL_SERVICE "org.freedesktop.portal.Desktop"
+#define PORTAL_PATH "/org/freedesktop/portal/desktop"
+#define PORTAL_INHIBIT_IFACE "org.freedesktop.portal.Inhibit"
+#define PORTAL_REQUEST_IFACE "org.freedesktop.portal.Request"
+#define PORTAL_INHIBIT_IDLE 8
 #endif //Q_OS_LINUX
 #if defined(Q_OS_MAC) && !defined(Q_OS_IOS)
 //http://www.cocoachina.com/macdev/cocoa/2010/0201/453.html
@@ -105,13 +113,94 @@ ScreenSaver& ScreenSaver::instance()
     return sSS;
 }
 
-ScreenSaver::ScreenSaver()
-{
 #ifdef Q_OS_LINUX
+ScreenSaver::ScreenSaver() : ScreenSaver(QDBusConnection::sessionBus())
+{
+}
+
+ScreenSaver::ScreenSaver(const QDBusConnection &bus) : bus(bus)
+{
     cookieID = 0;
+    backend = qEnvironmentVariableIsSet("FLATPAK_ID") ? Portal : FreeDesktop;
+}
+#else
+ScreenSaver::ScreenSaver()
+{
+}
 #endif //Q_OS_LINUX
+
+#ifdef Q_OS_LINUX
+// At most one call is in flight; whatever was asked for in the meantime is applied when it's done
+void ScreenSaver::reconcile()
+{
+    if (inFlight) return;
+    bool inhibited = backend == Portal ? !portalHandle.isEmpty() : cookieID != 0;
+    if (wantInhibited == inhibited) return;
+
+    QDBusMessage msg;
+    if (backend == Portal) {
+        if (wantInhibited) {
+            QVariantMap options;
+            options["reason"] = QString("video");
+            msg = QDBusMessage::createMethodCall(PORTAL_SERVICE, PORTAL_PATH, PORTAL_INHIBIT_IFACE, "Inhibit");
+            msg << QString() << (uint)PORTAL_INHIBIT_IDLE << options;
+        } else {
+            // The inhibition lasts as long as its request object
+            msg = QDBusMessage::createMethodCall(PORTAL_SERVICE, portalHandle, PORTAL_REQUEST_IFACE, "Close");
+        }
+    } else {
+        if (wantInhibited) {
+            msg = QDBusMessage::createMethodCall(SCREENSAVER_SERVICE, SCREENSAVER_PATH, SCREENSAVER_IFACE, "Inhibit");
+            msg << QString("stremio") << QString("video");
+        } else {
+            msg = QDBusMessage::createMethodCall(SCREENSAVER_SERVICE, SCREENSAVER_PATH, SCREENSAVER_IFACE, "UnInhibit");
+            msg << cookieID;
+        }
+    }
+
+    inFlight = true;
+    bool inhibiting = wantInhibited;
+    QDBusPendingCallWatcher* watcher = new QDBusPendingCallWatcher(bus.asyncCall(msg), this);
+    QObject::connect(watcher, &QDBusPendingCallWatcher::finished, this, [this, inhibiting](QDBusPendingCallWatcher* w) {
+        callFinished(w, inhibiting);
+    });
 }
 
+void ScreenSaver::callFinished(QDBusPendingCallWatcher* watcher, bool inhibiting)
+{
+    watcher->deleteLater();
+    inFlight = false;
+    QDBusMessage reply = watcher->reply();
+    const char* method = inhibiting ? "Inhibit" : "UnInhibit";
+
+    if (reply.type() == QDBusMessage::ErrorMessage) {
+        qWarning("ScreenSaver::Dbus %s Failed: %s", method, qPrintable(reply.errorMessage()));
+        if (inhibiting && backend == FreeDesktop && reply.errorName() == "org.freedesktop.DBus.Error.ServiceUnknown") {
+            qDebug("ScreenSaver::No screensaver service, using the inhibit portal");
+            backend = Portal;
+            reconcile();
+        } else if (!inhibiting) {
+            // Most likely gone along with the service
+            cookieID = 0;
+            portalHandle.clear();
+            reconcile();
+        }
+        // A failed Inhibit is retried on the next toggle rather than right away
+        return;
+    }
+
+    if (inhibiting) {
+        if (backend == Portal) portalHandle = reply.arguments().value(0).value<QDBusObjectPath>().path();
+        else cookieID = reply.arguments().value(0).toUInt();
+    } else {
+        cookieID = 0;
+        portalHandle.clear();
+    }
+    qDebug("ScreenSaver::Dbus %s Successful (%s)", method, backend == Portal ? "portal" : "screensaver");
+    reconcile();
+}
+#endif //Q_OS_LINUX
+
 //http://msdn.microsoft.com/en-us/library/windows/desktop/ms724947%28v=vs.85%29.aspx
 //http://msdn.microsoft.com/en-us/library/windows/desktop/aa373208%28v=vs.85%29.aspx
 /* TODO:
@@ -150,27 +239,10 @@ bool ScreenSaver::enable(bool yes)
 #endif //USE_NATIVE_EVENT
 #endif //defined(Q_OS_WIN) && !defined(Q_OS_WINRT)
 #ifdef Q_OS_LINUX
-    if (yes) {
-        if (cookieID) {
-            screenSaverInterface.call("UnInhibit", cookieID);
-            rv = true;
-            qDebug("ScreenSaver:: UnInhibit Successful %d", cookieID);
-        } else {
-            qWarning("ScreenSaver::Asked for Dbus UnInhibit, but Inhibit never called. Ignoring");
-        }
-    } else {
-        if(screenSaverInterface.isValid()) {
-            QDBusReply<uint> reply = screenSaverInterface.call(
-                "Inhibit", "stremio", "video");
-            if (reply.isValid()) {
-                cookieID = reply.value();
-                rv = true;
-                qDebug("ScreenSaver::Dbus Inhibit Successful %d", cookieID);
-            } else {   
-                qWarning("ScreenSaver::Dbus Inhibit Failed");
-            }
-        }
-    }
+    // Doesn't wait for the bus; toggles are coalesced and the outcome is logged once it's known
+    wantInhibited = !yes;
+    reconcile();
+    return true;
 #endif //Q_OS_LINUX
 #if defined(Q_OS_MAC) && !defined(Q_OS_IOS)
     // kIOPMAssertionTypeNoDisplaySleep prevents display sleep,
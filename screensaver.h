@@ -2,6 +2,10 @@
 #define SCREENSAVER_H
 
 #include <QtCore/QObject>
+#ifdef Q_OS_LINUX
+#include <QtDBus/QDBusConnection>
+#include <QtDBus/QDBusPendingCallWatcher>
+#endif //Q_OS_LINUX
 
 // TODO: read QtSystemInfo.ScreenSaver
 
@@ -15,6 +19,10 @@ class ScreenSaver : public QObject
 public:
     static ScreenSaver& instance();
     ScreenSaver();
+#ifdef Q_OS_LINUX
+    // Talks to the given bus instead of the session bus
+    explicit ScreenSaver(const QDBusConnection &bus);
+#endif //Q_OS_LINUX
     // enable: just restore the previous settings. settings changed during the object life will ignored
     bool enable(bool yes);
 public slots:
@@ -22,7 +30,16 @@ public slots:
     void disable();
 private:
 #ifdef Q_OS_LINUX
+    // org.freedesktop.ScreenSaver, or the inhibit portal when sandboxed or when there is no such service
+    enum Backend { FreeDesktop, Portal };
+    void reconcile();
+    void callFinished(QDBusPendingCallWatcher* watcher, bool inhibiting);
+    QDBusConnection bus;
+    Backend backend;
+    bool wantInhibited = false;
+    bool inFlight = false;
     uint32_t cookieID;
+    QString portalHandle;
 #endif //Q_OS_LINUX
 #if defined(Q_OS_MAC) && !defined(Q_OS_IOS)
     IOPMAssertionID assertionID;
@@ -0,0 +1,127 @@
+#include "startuptracer.h"
+
+#include <QCoreApplication>
+#include <QDebug>
+#include <QFile>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QThread>
+#include <QTimer>
+
+#include <string.h>
+
+#ifdef Q_OS_UNIX
+#include <sys/resource.h>
+#include <unistd.h>
+#endif
+
+// Started during static initialization, so it's as close to process start as we can get
+static QElapsedTimer& traceClock() {
+    static QElapsedTimer timer;
+    if (!timer.isValid()) timer.start();
+    return timer;
+}
+static struct StartClock { StartClock() { traceClock(); } } startClock;
+
+StartupTracer* StartupTracer::instance() {
+    static StartupTracer* tracer = new StartupTracer();
+    return tracer;
+}
+
+qint64 StartupTracer::now() {
+    return traceClock().nsecsElapsed() / 1000;
+}
+
+void StartupTracer::init(int argc, char **argv) {
+    const char* flag = "--trace-startup=";
+    for (int i = 1; i < argc; i++) {
+        if (strncmp(argv[i], flag, strlen(flag)) == 0) path = QString::fromLocal8Bit(argv[i] + strlen(flag));
+    }
+    if (path.isEmpty()) path = QString::fromLocal8Bit(qgetenv("STREMIO_TRACE_STARTUP"));
+    enabled = !path.isEmpty();
+    if (!enabled) return;
+
+    qDebug() << "Tracing startup to" << path;
+    complete("static init to main", 0, now(), "process");
+}
+
+void StartupTracer::begin(QString name, QString category) {
+    if (enabled) record(name, category, "B", now(), -1, QVariantMap());
+}
+
+void StartupTracer::end(QString name, QString category) {
+    if (enabled) record(name, category, "E", now(), -1, QVariantMap());
+}
+
+// Milestones carry the memory use at the time, for comparing what startup costs
+void StartupTracer::instant(QString name, QVariantMap args) {
+    if (!enabled) return;
+    args["rssKB"] = residentKB();
+    record(name, "startup", "i", now(), -1, args);
+}
+
+qint64 StartupTracer::residentKB() {
+#if defined(Q_OS_LINUX)
+    QFile statm("/proc/self/statm");
+    if (!statm.open(QFile::ReadOnly)) return -1;
+    QList<QByteArray> fields = statm.readAll().split(' ');
+    if (fields.size() < 2) return -1;
+    return fields[1].toLongLong() * sysconf(_SC_PAGESIZE) / 1024;
+#elif defined(Q_OS_UNIX)
+    // Only the peak is available without platform specific APIs
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0) return -1;
+#ifdef Q_OS_MACOS
+    return usage.ru_maxrss / 1024;
+#else
+    return usage.ru_maxrss;
+#endif
+#else
+    return -1;
+#endif
+}
+
+void StartupTracer::complete(QString name, qint64 startUs, qint64 durationUs, QString category) {
+    if (enabled) record(name, category, "X", startUs, durationUs, QVariantMap());
+}
+
+void StartupTracer::record(QString name, QString category, QString phase, qint64 ts, qint64 dur, QVariantMap args) {
+    QJsonObject event;
+    event["name"] = name;
+    event["cat"] = category;
+    event["ph"] = phase;
+    event["ts"] = ts;
+    if (dur >= 0) event["dur"] = dur;
+    if (phase == "i") event["s"] = "p";
+    event["pid"] = QCoreApplication::applicationPid();
+    event["tid"] = (qint64)(quintptr)QThread::currentThreadId();
+    if (!args.isEmpty()) event["args"] = QJsonObject::fromVariantMap(args);
+
+    QMutexLocker lock(&mutex);
+    events.append(event);
+
+    // Scheduled from the first event on the main thread once there is one, since it has the event loop
+    QCoreApplication* app = QCoreApplication::instance();
+    if (!writeScheduled && app && QThread::currentThread() == app->thread()) {
+        writeScheduled = true;
+        QTimer::singleShot(STARTUP_TRACE_WINDOW_MS, this, &StartupTracer::write);
+        QObject::connect(app, &QCoreApplication::aboutToQuit, this, &StartupTracer::write);
+    }
+}
+
+void StartupTracer::write() {
+    if (!enabled) return;
+
+    QJsonObject trace;
+    QMutexLocker lock(&mutex);
+    trace["traceEvents"] = events;
+    lock.unlock();
+    trace["displayTimeUnit"] = QString("ms");
+
+    QFile file(path);
+    if (!file.open(QFile::WriteOnly)) {
+        qWarning() << "Unable to write startup trace to" << path;
+        return;
+    }
+    file.write(QJsonDocument(trace).toJson(QJsonDocument::Compact));
+}
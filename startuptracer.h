@@ -0,0 +1,70 @@
+#ifndef STARTUPTRACER_H
+#define STARTUPTRACER_H
+
+#include <QObject>
+#include <QElapsedTimer>
+#include <QJsonArray>
+#include <QMutex>
+#include <QString>
+#include <QVariantMap>
+
+// Startup events are written this long after the tracer is enabled, and again on exit
+#define STARTUP_TRACE_WINDOW_MS (30 * 1000)
+
+// Records startup phases with monotonic timestamps (from static initialization), and writes them as a Chrome
+// trace-event JSON file that can be opened in chrome://tracing or Perfetto
+// Enabled with --trace-startup=<file> or STREMIO_TRACE_STARTUP=<file>; everything is a no-op otherwise
+class StartupTracer : public QObject
+{
+    Q_OBJECT
+    Q_PROPERTY(bool enabled READ isEnabled CONSTANT)
+
+public:
+    static StartupTracer* instance();
+
+    // Looks for the flag and the env var; call first thing in main()
+    void init(int argc, char **argv);
+    bool isEnabled() const { return enabled; }
+
+    // Microseconds since static initialization
+    static qint64 now();
+    static qint64 residentKB();
+
+    // Spans that end on the same thread as they began; complete() is for ones measured elsewhere
+    Q_INVOKABLE void begin(QString name, QString category = "startup");
+    Q_INVOKABLE void end(QString name, QString category = "startup");
+    // Instants also record the resident memory
+    Q_INVOKABLE void instant(QString name, QVariantMap args = QVariantMap());
+    void complete(QString name, qint64 startUs, qint64 durationUs, QString category = "startup");
+
+public slots:
+    void write();
+
+private:
+    StartupTracer() { }
+    void record(QString name, QString category, QString phase, qint64 ts, qint64 dur, QVariantMap args);
+
+    bool enabled = false;
+    bool writeScheduled = false;
+    QString path;
+    QJsonArray events;
+    QMutex mutex;
+};
+
+// Traces the rest of the enclosing scope as a span
+class StartupTraceScope
+{
+public:
+    StartupTraceScope(const char* name) : name(name), start(StartupTracer::now()) { }
+    ~StartupTraceScope() { StartupTracer::instance()->complete(name, start, StartupTracer::now() - start); }
+
+private:
+    const char* name;
+    qint64 start;
+};
+
+#define TRACE_SCOPE_CONCAT2(a, b) a##b
+#define TRACE_SCOPE_CONCAT(a, b) TRACE_SCOPE_CONCAT2(a, b)
+#define TRACE_SCOPE(name) StartupTraceScope TRACE_SCOPE_CONCAT(traceScope, __LINE__)(name)
+
+#endif // STARTUPTRACER_H
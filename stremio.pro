@@ -10,7 +10,7 @@ QMAKE_TARGET_BUNDLE_PREFIX = com.smartcodeltd
 
 QMAKE_INFO_PLIST = Info.plist
 
-QT += qml quick network
+QT += qml quick network concurrent
 CONFIG += c++11
 
 include(deps/singleapplication/singleapplication.pri)
@@ -55,6 +55,19 @@ win32{
     INCLUDEPATH += C:/OpenSSL-Win32/include
 }
 
+# zstd (update patches)
+unix:!mac {
+    LIBS += -lzstd
+}
+mac {
+    LIBS += -L${ZSTD_BIN_PATH}/lib -lzstd
+    INCLUDEPATH += ${ZSTD_BIN_PATH}/include
+}
+win32{
+    LIBS += C:/zstd/lib/zstd.lib
+    INCLUDEPATH += C:/zstd/include
+}
+
 # Razer Chroma SDK
 win32 {
     include(deps/chroma/chroma.pri)
@@ -63,20 +76,34 @@ win32 {
 QT += widgets
 
 # TODO: if def WEBENGINE
-QT += webengine webchannel dbus
+QT += webengine webenginecore webchannel dbus
 WEBENGINE_CONFIG+=use_proprietary_codecs
 
 SOURCES += main.cpp \
     mpv.cpp \
+    mpvpipview.cpp \
     stremioprocess.cpp \
+    startuptracer.cpp \
+    medialibrary.cpp \
+    initscheduler.cpp \
+    instanceforwarder.cpp \
+    webuibundle.cpp \
+    resourcegovernor.cpp \
+    processtelemetry.cpp \
     screensaver.cpp \
     autoupdater.cpp \
+    blockmapdownload.cpp \
+    checksumcache.cpp \
+    mirrorstats.cpp \
+    zstddecoder.cpp \
     systemtray.cpp \
     razerchroma.cpp \
     qclipboardproxy.cpp \
     verifysig.c
 
 RESOURCES += qml.qrc
+# Compile the QML and JS ahead of time
+CONFIG += qtquickcompiler
 
 # Additional import path used to resolve QML modules in Qt Creator's code model
 QML_IMPORT_PATH =
@@ -86,10 +113,22 @@ include(deployment.pri)
 
 HEADERS += \
     mpv.h \
+    mpvpipview.h \
     stremioprocess.h \
+    startuptracer.h \
+    medialibrary.h \
+    initscheduler.h \
+    instanceforwarder.h \
+    webuibundle.h \
+    resourcegovernor.h \
+    processtelemetry.h \
     screensaver.h \
     mainapplication.h \
     autoupdater.h \
+    blockmapdownload.h \
+    checksumcache.h \
+    mirrorstats.h \
+    zstddecoder.h \
     systemtray.h \
     razerchroma.h \
     qclipboardproxy.h \
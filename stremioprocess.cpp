@@ -8,6 +8,11 @@ HANDLE jobMainProcess = NULL;
 
 #define ERR_BUF_LINES 200
 
+Process::Process(QObject *parent) : QProcess(parent) {
+    QObject::connect(&telemetry, &ProcessTelemetry::sampled, this, &Process::telemetrySampled);
+    QObject::connect(&telemetry, &ProcessTelemetry::thresholdExceeded, this, &Process::restartRecommended);
+}
+
 void Process::start(const QString &program, const QVariantList &arguments, QString mPattern) {
 #ifdef WIN32
     // On windows, Child processes by default survive death of their parent, unlike on *nix
@@ -51,10 +56,13 @@ void Process::start(const QString &program, const QVariantList &arguments, QStri
     // the lack of stderr
     //this->setProcessChannelMode(QProcess::ForwardedErrorChannel);
 
-    QObject::connect(this, &QProcess::errorOccurred, this, &Process::onError);
-    QObject::connect(this, &QProcess::readyReadStandardOutput, this, &Process::onOutput);
-    QObject::connect(this, &QProcess::readyReadStandardError, this, &Process::onStdErr);
-    QObject::connect(this, &QProcess::started, this, &Process::onStarted);
+    // start() is called again on every restart, so make sure we're connected only once
+    QObject::connect(this, &QProcess::errorOccurred, this, &Process::onError, Qt::UniqueConnection);
+    QObject::connect(this, &QProcess::readyReadStandardOutput, this, &Process::onOutput, Qt::UniqueConnection);
+    QObject::connect(this, &QProcess::readyReadStandardError, this, &Process::onStdErr, Qt::UniqueConnection);
+    QObject::connect(this, &QProcess::started, this, &Process::onStarted, Qt::UniqueConnection);
+    QObject::connect(this, QOverload<int, QProcess::ExitStatus>::of(&QProcess::finished), this, &Process::onFinished,
+                     Qt::UniqueConnection);
 
     QProcess::start(program, args);
 }
@@ -104,6 +112,37 @@ void Process::onStarted() {
         qDebug() << "[WIN32] AssignProcessToJobObject failed with code: " << err;
     };
 #endif
+    applyResourcePolicy();
+    telemetry.start(processId());
+}
+
+void Process::onFinished() {
+    // Keeps the last snapshot, so it can be attached to crash reports
+    telemetry.stop();
+    // The transient cgroup can only be removed once it's empty
+    governor.release();
+}
+
+void Process::setTelemetryOptions(const QVariantMap &options) {
+    telemetry.setOptions(options);
+}
+
+QVariantMap Process::getTelemetry() {
+    return telemetry.snapshot();
+}
+
+void Process::setResourcePolicy(const QVariantMap &policy) {
+    resourcePolicy = policy;
+    if (state() == QProcess::Running) applyResourcePolicy();
+}
+
+QVariantMap Process::getResourceState() {
+    return governor.state(processId());
+}
+
+void Process::applyResourcePolicy() {
+    if (resourcePolicy.isEmpty()) return;
+    emit resourcePolicyApplied(governor.apply(processId(), resourcePolicy));
 }
 
 void Process::checkServerAddressMessage(QByteArray message) {
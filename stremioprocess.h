@@ -6,13 +6,24 @@
 #include <QObject>
 #include <iostream>
 
+#include "resourcegovernor.h"
+#include "processtelemetry.h"
+
 class Process : public QProcess {
     Q_OBJECT
 
 public:
-    Process(QObject *parent = 0) : QProcess(parent) { }
+    Process(QObject *parent = 0);
     Q_INVOKABLE void start(const QString &program, const QVariantList &arguments, const QString mPattern);
 
+    // Stored and (re-)applied every time the process starts; applied immediately if it's running
+    Q_INVOKABLE void setResourcePolicy(const QVariantMap &policy);
+    Q_INVOKABLE QVariantMap getResourceState();
+
+    // See ProcessTelemetry::setOptions
+    Q_INVOKABLE void setTelemetryOptions(const QVariantMap &options);
+    Q_INVOKABLE QVariantMap getTelemetry();
+
 private:
     void checkServerAddressMessage(QByteArray message);
 
@@ -20,11 +31,17 @@ private:
     QByteArrayList errBuff;
     bool magicPatternFound = true; // will be set to false if we are searching for one
 
+    void applyResourcePolicy();
+    QVariantMap resourcePolicy;
+    ResourceGovernor governor;
+    ProcessTelemetry telemetry;
+
 private slots:
     void onError(QProcess::ProcessError error);
     void onOutput();
     void onStdErr();
     void onStarted();
+    void onFinished();
 
 public slots:
     bool waitForFinished(int msecs = 30000);
@@ -33,5 +50,8 @@ public slots:
 signals:
     void addressReady(QString address);
     void errorThrown(int error);
+    void resourcePolicyApplied(QVariantMap state);
+    void telemetrySampled(QVariantMap snapshot);
+    void restartRecommended(QString reason, QVariantMap snapshot);
 };
 #endif // STREMIOPROCESS_H
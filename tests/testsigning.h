@@ -0,0 +1,33 @@
+#ifndef TESTSIGNING_H
+#define TESTSIGNING_H
+
+#include <QByteArray>
+
+// Mixing C and C++ :(
+extern "C" {
+#include <verifysig.h>
+}
+
+// Signs data the way the update descriptors and the web UI manifest are signed, with the private test key
+inline QByteArray signWithTestKey(const QByteArray &data) {
+    BIO* bio = BIO_new_mem_buf(testPrivateKey, -1);
+    EVP_PKEY* pkey = PEM_read_bio_PrivateKey(bio, NULL, NULL, NULL);
+    BIO_free(bio);
+    if (!pkey) return QByteArray();
+
+    QByteArray sig;
+    size_t len = 0;
+    EVP_MD_CTX* ctx = EVP_MD_CTX_create();
+    if (EVP_DigestSignInit(ctx, NULL, EVP_sha256(), NULL, pkey) == 1
+        && EVP_DigestSignUpdate(ctx, data.constData(), data.size()) == 1
+        && EVP_DigestSignFinal(ctx, NULL, &len) == 1) {
+        sig.resize((int)len);
+        if (EVP_DigestSignFinal(ctx, (unsigned char*)sig.data(), &len) == 1) sig.resize((int)len);
+        else sig.clear();
+    }
+    EVP_MD_CTX_destroy(ctx);
+    EVP_PKEY_free(pkey);
+    return sig;
+}
+
+#endif // TESTSIGNING_H
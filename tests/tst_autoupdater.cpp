@@ -0,0 +1,554 @@
+#include <QtTest>
+#include <QCoreApplication>
+#include <QDir>
+#include <QElapsedTimer>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QSignalSpy>
+#include <QStandardPaths>
+#include <QTemporaryDir>
+
+#include "autoupdater.h"
+#include "updateserver.h"
+#include "testsigning.h"
+
+#ifdef Q_OS_UNIX
+#include <sys/resource.h>
+#endif
+
+#include <zstd.h>
+
+#define TEST_SHELL_VERSION "1.0.0"
+#define CYCLE_TIMEOUT_MS 60000
+
+// Full check -> versionDesc -> download -> verify cycles against UpdateServer, with what's served signed by the test
+// key; each cycle's throughput, CPU per MB and peak memory are reported (the server runs in the same process, so
+// serving is part of the CPU time)
+class TestAutoUpdater : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void initTestCase();
+    void init();
+    void cleanup();
+
+    void preparesSignedUpdate();
+    void rejectsBadSignature();
+    void rejectsCorruptPayload();
+    void reportsDroppedConnection();
+    void resumesDroppedDownload();
+    void restartsOnUnsatisfiableRange();
+    void reportsCheckError();
+    void appliesPatch_data();
+    void appliesPatch();
+    void decompressesPayload_data();
+    void decompressesPayload();
+    void throttlesBlockMapDownload();
+    void throughput_data();
+    void throughput();
+
+private:
+    struct Cycle {
+        bool finished = false;
+        QVariantList prepared;
+        QString error;
+    };
+
+    // serverExtra goes into the versionDesc entry of server.js, e.g. its patches
+    void publish(const QByteArray &server, const QByteArray &asar, bool badSignature = false,
+                 const QJsonObject &serverExtra = QJsonObject());
+    // files as they go into the versionDesc
+    void publishFiles(const QJsonObject &files, bool badSignature = false);
+    Cycle runCycle(const QString &label);
+    static QByteArray randomData(int size, int seed);
+    static QByteArray zstdCompress(const QByteArray &data, const QByteArray &prefix = QByteArray());
+    // What BlockMapDownload expects for data
+    static QByteArray blockMap(const QByteArray &data, int blockSize);
+    // Where the updater looks for what's installed
+    static QString installedPath(const QString &name);
+    static double cpuSeconds();
+    static qint64 peakRssKB();
+
+    QTemporaryDir tempDir;
+    UpdateServer server;
+    AutoUpdater* updater = NULL;
+};
+
+void TestAutoUpdater::initTestCase() {
+    QStandardPaths::setTestModeEnabled(true);
+    QVERIFY(tempDir.isValid());
+    // Where the updater downloads to
+    qputenv("TMPDIR", QFile::encodeName(tempDir.path()));
+    qputenv("TMP", QFile::encodeName(tempDir.path()));
+    qputenv("TEMP", QFile::encodeName(tempDir.path()));
+    QCOMPARE(QDir::cleanPath(QDir::tempPath()), QDir::cleanPath(tempDir.path()));
+
+    // The same version as what's published means a partial update: server.js and stremio.asar
+    QCoreApplication::setApplicationVersion(TEST_SHELL_VERSION);
+    init_public_key();
+    QVERIFY(server.start());
+}
+
+void TestAutoUpdater::init() {
+    foreach (const QString &name, QDir(tempDir.path()).entryList(QDir::Files)) QFile::remove(tempDir.filePath(name));
+    server.clear();
+    updater = new AutoUpdater();
+}
+
+void TestAutoUpdater::cleanup() {
+    delete updater;
+    updater = NULL;
+    QFile::remove(installedPath(SERVER_FNAME));
+    qunsetenv("APPIMAGE");
+}
+
+QString TestAutoUpdater::installedPath(const QString &name) {
+    return QCoreApplication::applicationDirPath() + QDir::separator() + name;
+}
+
+// What `zstd` makes, or `zstd --patch-from=<prefix>` with a prefix
+QByteArray TestAutoUpdater::zstdCompress(const QByteArray &data, const QByteArray &prefix) {
+    ZSTD_CCtx* cctx = ZSTD_createCCtx();
+    QByteArray out((int)ZSTD_compressBound(data.size()), 0);
+    size_t r = prefix.isEmpty() ? 0 : ZSTD_CCtx_refPrefix(cctx, prefix.constData(), prefix.size());
+    if (!ZSTD_isError(r)) r = ZSTD_compress2(cctx, out.data(), out.size(), data.constData(), data.size());
+    ZSTD_freeCCtx(cctx);
+    if (ZSTD_isError(r)) return QByteArray();
+    out.resize((int)r);
+    return out;
+}
+
+QByteArray TestAutoUpdater::blockMap(const QByteArray &data, int blockSize) {
+    QJsonArray weak;
+    QByteArray strong;
+    for (int k = 0; k + blockSize <= data.size(); k += blockSize) {
+        quint32 a = 0, b = 0;
+        for (int i = 0; i != blockSize; i++) {
+            a += (uchar)data[k + i];
+            b += (quint32)(blockSize - i) * (uchar)data[k + i];
+        }
+        weak.append((double)((a & 0xffff) | ((b & 0xffff) << 16)));
+        strong += QCryptographicHash::hash(data.mid(k, blockSize), QCryptographicHash::Md5);
+    }
+    QJsonObject map;
+    map["size"] = data.size();
+    map["blockSize"] = blockSize;
+    map["weak"] = weak;
+    map["strong"] = QString(strong.toHex());
+    return QJsonDocument(map).toJson(QJsonDocument::Compact);
+}
+
+QByteArray TestAutoUpdater::randomData(int size, int seed) {
+    QByteArray data(size, 0);
+    quint32 x = seed * 2654435761u + 1;
+    for (int i = 0; i < size; i++) {
+        x ^= x << 13; x ^= x >> 17; x ^= x << 5;
+        data[i] = (char)(x & 0xff);
+    }
+    return data;
+}
+
+void TestAutoUpdater::publish(const QByteArray &serverJs, const QByteArray &asar, bool badSignature,
+                              const QJsonObject &serverExtra) {
+    server.setResource("/files/" SERVER_FNAME, serverJs);
+    server.setResource("/files/" ASAR_FNAME, asar);
+
+    QJsonObject files;
+    QJsonObject serverFile;
+    serverFile["url"] = server.url("/files/" SERVER_FNAME).toString();
+    serverFile["checksum"] = QString(QCryptographicHash::hash(serverJs, QCryptographicHash::Sha256).toHex());
+    for (QJsonObject::const_iterator it = serverExtra.constBegin(); it != serverExtra.constEnd(); ++it)
+        serverFile[it.key()] = it.value();
+    files[SERVER_FNAME] = serverFile;
+    QJsonObject asarFile;
+    asarFile["url"] = server.url("/files/" ASAR_FNAME).toString();
+    asarFile["checksum"] = QString(QCryptographicHash::hash(asar, QCryptographicHash::Sha256).toHex());
+    files[ASAR_FNAME] = asarFile;
+    publishFiles(files, badSignature);
+}
+
+void TestAutoUpdater::publishFiles(const QJsonObject &files, bool badSignature) {
+    QJsonObject versionDesc;
+    versionDesc["version"] = "1.0.1";
+    versionDesc["shellVersion"] = TEST_SHELL_VERSION;
+    versionDesc["files"] = files;
+    QByteArray desc = QJsonDocument(versionDesc).toJson(QJsonDocument::Compact);
+    QByteArray sig = signWithTestKey(desc);
+    QVERIFY(!sig.isEmpty());
+    // Signed, then changed: what a tampered mirror would serve
+    if (badSignature) desc.replace("1.0.1", "6.6.6");
+    server.setResource("/versionDesc.json", desc, "application/json");
+
+    QJsonObject check;
+    check["upToDate"] = false;
+    check["versionDesc"] = server.url("/versionDesc.json").toString();
+    check["signature"] = QString(sig.toBase64());
+    server.setResource("/check", QJsonDocument(check).toJson(QJsonDocument::Compact), "application/json");
+}
+
+TestAutoUpdater::Cycle TestAutoUpdater::runCycle(const QString &label) {
+    Cycle cycle;
+    QSignalSpy prepared(updater, &AutoUpdater::prepared);
+    QSignalSpy error(updater, &AutoUpdater::error);
+
+    QElapsedTimer timer;
+    timer.start();
+    double cpuStart = cpuSeconds();
+    qint64 sentStart = server.bytesSent();
+
+    updater->checkForUpdates(server.url("/check").toString(), "stremio-tests");
+    QElapsedTimer wait;
+    wait.start();
+    while (prepared.isEmpty() && error.isEmpty() && wait.elapsed() < CYCLE_TIMEOUT_MS) QTest::qWait(10);
+    // Anything emitted late, e.g. prepared() after an error, would show up here
+    QTest::qWait(100);
+
+    double mb = (server.bytesSent() - sentStart) / (1024.0 * 1024.0);
+    double cpu = cpuSeconds() - cpuStart;
+    qint64 ms = timer.elapsed();
+    qInfo("%s: %.2f MB in %lld ms, %.2f MB/s, %.1f ms CPU per MB, peak RSS %lld KB", qPrintable(label), mb, ms,
+          ms > 0 ? mb * 1000 / ms : 0.0, mb > 0 ? cpu * 1000 / mb : 0.0, peakRssKB());
+
+    cycle.finished = !prepared.isEmpty() || !error.isEmpty();
+    if (!prepared.isEmpty()) cycle.prepared = prepared.first().at(0).toList();
+    if (!error.isEmpty()) cycle.error = error.first().at(0).toString();
+    // Exactly one outcome per cycle
+    if (prepared.size() + error.size() > 1) cycle.error = "more than one outcome: " + cycle.error;
+    return cycle;
+}
+
+void TestAutoUpdater::preparesSignedUpdate() {
+    QByteArray serverJs = randomData(512 * 1024, 1);
+    QByteArray asar = randomData(3 * 1024 * 1024, 2);
+    publish(serverJs, asar);
+
+    Cycle cycle = runCycle("signed update");
+    QVERIFY(cycle.finished);
+    QCOMPARE(cycle.error, QString());
+    QCOMPARE(cycle.prepared.size(), 2);
+
+    // In the order of the versionDesc, and what was published
+    QFile first(cycle.prepared[0].toString());
+    QFile second(cycle.prepared[1].toString());
+    QVERIFY(first.open(QIODevice::ReadOnly));
+    QVERIFY(second.open(QIODevice::ReadOnly));
+    QCOMPARE(QFileInfo(first).fileName(), QString(SERVER_FNAME));
+    QVERIFY(first.readAll() == serverJs);
+    QVERIFY(second.readAll() == asar);
+}
+
+void TestAutoUpdater::rejectsBadSignature() {
+    publish(randomData(1024, 3), randomData(1024, 4), true);
+
+    Cycle cycle = runCycle("bad signature");
+    QVERIFY(cycle.finished);
+    QVERIFY(cycle.prepared.isEmpty());
+    QCOMPARE(cycle.error, QString("Unable to verify update signature"));
+    // Nothing it lists is fetched
+    QCOMPARE(server.requests("/files/" ASAR_FNAME), 0);
+}
+
+void TestAutoUpdater::rejectsCorruptPayload() {
+    publish(randomData(256 * 1024, 5), randomData(1024 * 1024, 6));
+    server.setCorrupt("/files/" ASAR_FNAME, true);
+
+    Cycle cycle = runCycle("corrupt payload");
+    QVERIFY(cycle.finished);
+    QVERIFY(cycle.prepared.isEmpty());
+    QVERIFY2(cycle.error.startsWith("Unable to verify checksum"), qPrintable(cycle.error));
+    QVERIFY(!QFile::exists(tempDir.filePath(ASAR_FNAME)));
+}
+
+void TestAutoUpdater::reportsDroppedConnection() {
+    publish(randomData(256 * 1024, 7), randomData(2 * 1024 * 1024, 8));
+    server.dropAfter("/files/" ASAR_FNAME, 300 * 1024);
+
+    Cycle cycle = runCycle("dropped connection");
+    QVERIFY(cycle.finished);
+    QVERIFY(cycle.prepared.isEmpty());
+    QVERIFY2(cycle.error.startsWith("Network error on downloadFinished"), qPrintable(cycle.error));
+}
+
+void TestAutoUpdater::resumesDroppedDownload() {
+    QByteArray asar = randomData(3 * 1024 * 1024, 11);
+    publish(randomData(256 * 1024, 12), asar);
+    // Past the first chunk, so there's something to resume
+    server.dropAfter("/files/" ASAR_FNAME, PARTIAL_CHUNK_SIZE + 512 * 1024);
+
+    Cycle dropped = runCycle("dropped, first attempt");
+    QVERIFY2(dropped.error.startsWith("Network error on downloadFinished"), qPrintable(dropped.error));
+    QVERIFY(QFile::exists(tempDir.filePath(ASAR_FNAME PARTIAL_STATE_SUFFIX)));
+
+    Cycle resumed = runCycle("dropped, resumed");
+    QCOMPARE(resumed.error, QString());
+    QCOMPARE(resumed.prepared.size(), 2);
+    QFile file(resumed.prepared[1].toString());
+    QVERIFY(file.open(QIODevice::ReadOnly));
+    QVERIFY(file.readAll() == asar);
+    QVERIFY(!QFile::exists(tempDir.filePath(ASAR_FNAME PARTIAL_STATE_SUFFIX)));
+
+    QList<QByteArray> ranges = server.ranges("/files/" ASAR_FNAME);
+    QCOMPARE(ranges.size(), 2);
+    QCOMPARE(ranges[0], QByteArray());
+    QCOMPARE(ranges[1], "bytes=" + QByteArray::number(PARTIAL_CHUNK_SIZE) + "-");
+}
+
+void TestAutoUpdater::restartsOnUnsatisfiableRange() {
+    QByteArray asar = randomData(512 * 1024, 13);
+    publish(randomData(256 * 1024, 14), asar);
+
+    // Left by an earlier attempt: a whole chunk, more than the file now has, with an ETag that still matches
+    QByteArray stale = randomData(PARTIAL_CHUNK_SIZE, 15);
+    QFile partial(tempDir.filePath(ASAR_FNAME));
+    QVERIFY(partial.open(QIODevice::WriteOnly));
+    partial.write(stale);
+    partial.close();
+    QJsonObject state;
+    state["url"] = server.url("/files/" ASAR_FNAME).toString();
+    state["checksum"] = QString(QCryptographicHash::hash(asar, QCryptographicHash::Sha256).toHex());
+    state["etag"] = QString::fromLatin1(UpdateServer::etag(asar));
+    state["chunkSize"] = PARTIAL_CHUNK_SIZE;
+    state["offset"] = PARTIAL_CHUNK_SIZE;
+    state["chunks"] = QJsonArray() << QString(QCryptographicHash::hash(stale, QCryptographicHash::Sha256).toHex());
+    QFile stateFile(tempDir.filePath(ASAR_FNAME PARTIAL_STATE_SUFFIX));
+    QVERIFY(stateFile.open(QIODevice::WriteOnly));
+    stateFile.write(QJsonDocument(state).toJson(QJsonDocument::Compact));
+    stateFile.close();
+
+    Cycle cycle = runCycle("range not satisfiable");
+    QCOMPARE(cycle.error, QString());
+    QCOMPARE(cycle.prepared.size(), 2);
+    QFile file(cycle.prepared[1].toString());
+    QVERIFY(file.open(QIODevice::ReadOnly));
+    QVERIFY(file.readAll() == asar);
+    QVERIFY(!QFile::exists(tempDir.filePath(ASAR_FNAME PARTIAL_STATE_SUFFIX)));
+
+    // The 416, then all of it
+    QList<QByteArray> ranges = server.ranges("/files/" ASAR_FNAME);
+    QCOMPARE(ranges.size(), 2);
+    QCOMPARE(ranges[0], "bytes=" + QByteArray::number(PARTIAL_CHUNK_SIZE) + "-");
+    QCOMPARE(ranges[1], QByteArray());
+}
+
+void TestAutoUpdater::reportsCheckError() {
+    server.setResource("/check", "{}", "application/json");
+    server.setStatus("/check", 500);
+
+    Cycle cycle = runCycle("check error");
+    QVERIFY(cycle.finished);
+    QVERIFY(cycle.prepared.isEmpty());
+    QVERIFY2(cycle.error.startsWith("Network error on checkForUpdates"), qPrintable(cycle.error));
+}
+
+void TestAutoUpdater::appliesPatch_data() {
+    QTest::addColumn<QString>("patch");
+    QTest::addColumn<bool>("fullDownload");
+
+    QTest::newRow("applied") << "good" << false;
+    QTest::newRow("missing") << "missing" << true;
+    QTest::newRow("bad patch checksum") << "bad checksum" << true;
+    QTest::newRow("mismatch after patching") << "wrong target" << true;
+}
+
+void TestAutoUpdater::appliesPatch() {
+    QFETCH(QString, patch);
+    QFETCH(bool, fullDownload);
+
+    // What we run, and what it becomes; the same base in every row, so its cached checksum holds
+    QByteArray base = randomData(512 * 1024, 20);
+    QByteArray serverJs = base;
+    serverJs.replace(1000, 4096, randomData(4096, 21));
+    serverJs.append(randomData(64 * 1024, 22));
+    QFile installed(installedPath(SERVER_FNAME));
+    QVERIFY(installed.open(QIODevice::WriteOnly));
+    installed.write(base);
+    installed.close();
+
+    // A valid patch that makes something else, so it's the checksum after patching that catches it
+    QByteArray made = patch == "wrong target" ? randomData(128 * 1024, 23) : serverJs;
+    QByteArray body = zstdCompress(made, base);
+    QVERIFY(!body.isEmpty());
+    // Named like what it makes, so it would clobber its own input if it were downloaded there
+    if (patch != "missing") server.setResource("/patches/" SERVER_FNAME, body);
+    QJsonObject entry;
+    entry["url"] = server.url("/patches/" SERVER_FNAME).toString();
+    QByteArray listed = patch == "bad checksum" ? "x" + body : body;
+    entry["checksum"] = QString(QCryptographicHash::hash(listed, QCryptographicHash::Sha256).toHex());
+    QJsonObject patches;
+    patches[QString(QCryptographicHash::hash(base, QCryptographicHash::Sha256).toHex())] = entry;
+    QJsonObject extra;
+    extra["patches"] = patches;
+    publish(serverJs, randomData(256 * 1024, 24), false, extra);
+
+    Cycle cycle = runCycle(QString("patch, ") + QTest::currentDataTag());
+    QCOMPARE(cycle.error, QString());
+    QCOMPARE(cycle.prepared.size(), 2);
+    QFile prepared(cycle.prepared[0].toString());
+    QCOMPARE(QFileInfo(prepared).fileName(), QString(SERVER_FNAME));
+    QVERIFY(prepared.open(QIODevice::ReadOnly));
+    QVERIFY(prepared.readAll() == serverJs);
+
+    QCOMPARE(server.requests("/patches/" SERVER_FNAME), 1);
+    QCOMPARE(server.requests("/files/" SERVER_FNAME), fullDownload ? 1 : 0);
+    // Applied to a staged copy, and cleaned up after; a failed transfer is kept to resume from
+    QVERIFY(installed.open(QIODevice::ReadOnly));
+    QVERIFY(installed.readAll() == base);
+    if (patch != "missing") QVERIFY(!QFile::exists(tempDir.filePath(SERVER_FNAME PATCH_SUFFIX)));
+}
+
+void TestAutoUpdater::decompressesPayload_data() {
+    QTest::addColumn<bool>("corrupt");
+    QTest::addColumn<bool>("fullDownload");
+
+    QTest::newRow("good stream") << false << false;
+    QTest::newRow("corrupt stream") << true << true;
+}
+
+void TestAutoUpdater::decompressesPayload() {
+    QFETCH(bool, corrupt);
+    QFETCH(bool, fullDownload);
+
+    // Compressible, unlike the random files
+    QByteArray serverJs;
+    for (int i = 0; i < 20000; i++) serverJs += "var v" + QByteArray::number(i) + " = " + QByteArray::number(i * 7) + ";\n";
+    QByteArray body = zstdCompress(serverJs);
+    QVERIFY(!body.isEmpty());
+    // Damaged before it's listed, so it passes the checksum and it's the decoder that has to notice
+    if (corrupt) {
+        for (int i = body.size() / 3; i < body.size() / 2; i++) body[i] = body[i] ^ 0x5a;
+    }
+    server.setResource("/files/" SERVER_FNAME ".zst", body);
+    QJsonObject zstd;
+    zstd["url"] = server.url("/files/" SERVER_FNAME ".zst").toString();
+    zstd["checksum"] = QString(QCryptographicHash::hash(body, QCryptographicHash::Sha256).toHex());
+    QJsonObject extra;
+    extra["zstd"] = zstd;
+    publish(serverJs, randomData(256 * 1024, 25), false, extra);
+
+    Cycle cycle = runCycle(QString("compressed, ") + QTest::currentDataTag());
+    QCOMPARE(cycle.error, QString());
+    QCOMPARE(cycle.prepared.size(), 2);
+    QFile prepared(cycle.prepared[0].toString());
+    QCOMPARE(QFileInfo(prepared).fileName(), QString(SERVER_FNAME));
+    QVERIFY(prepared.open(QIODevice::ReadOnly));
+    QVERIFY(prepared.readAll() == serverJs);
+
+    QCOMPARE(server.requests("/files/" SERVER_FNAME ".zst"), 1);
+    QCOMPARE(server.requests("/files/" SERVER_FNAME), fullDownload ? 1 : 0);
+}
+
+// The ranges a block map download fetches go through the same bandwidth limit as everything else
+void TestAutoUpdater::throttlesBlockMapDownload() {
+#ifndef Q_OS_LINUX
+    QSKIP("Block maps are only used for AppImages");
+#else
+    // What we run, and the next version of it with 512KB in the middle changed
+    QByteArray old = randomData(2 * 1024 * 1024, 30);
+    QByteArray image = old;
+    image.replace(768 * 1024, 512 * 1024, randomData(512 * 1024, 31));
+    QString source = tempDir.filePath("Stremio-old.AppImage");
+    QFile sourceFile(source);
+    QVERIFY(sourceFile.open(QIODevice::WriteOnly));
+    sourceFile.write(old);
+    sourceFile.close();
+    qputenv("APPIMAGE", QFile::encodeName(source));
+
+    QByteArray map = blockMap(image, 4096);
+    server.setResource("/files/Stremio.AppImage", image);
+    server.setResource("/files/Stremio.AppImage.blockmap", map, "application/json");
+    QJsonObject blockMapEntry;
+    blockMapEntry["url"] = server.url("/files/Stremio.AppImage.blockmap").toString();
+    blockMapEntry["checksum"] = QString(QCryptographicHash::hash(map, QCryptographicHash::Sha256).toHex());
+    QJsonObject entry;
+    entry["url"] = server.url("/files/Stremio.AppImage").toString();
+    entry["checksum"] = QString(QCryptographicHash::hash(image, QCryptographicHash::Sha256).toHex());
+    entry["blockMap"] = blockMapEntry;
+    QJsonObject files;
+    files["linux"] = entry;
+    publishFiles(files);
+
+    const qint64 limit = 128 * 1024;
+    QVariantMap policy;
+    policy["pauseDuringPlayback"] = false;
+    policy["playbackBandwidthLimit"] = limit;
+    policy["minIdleMs"] = 0;
+    updater->setSchedulingPolicy(policy);
+    updater->setPlaybackActive(true);
+    updater->setForceFullUpdate(true);
+
+    QElapsedTimer timer;
+    timer.start();
+    Cycle cycle = runCycle("block map, throttled");
+    qint64 ms = timer.elapsed();
+    QCOMPARE(cycle.error, QString());
+    QCOMPARE(cycle.prepared.size(), 1);
+    QFile prepared(cycle.prepared[0].toString());
+    QVERIFY(prepared.open(QIODevice::ReadOnly));
+    QVERIFY(prepared.readAll() == image);
+
+    // Only the changed part was fetched, with range requests
+    QVERIFY(!server.ranges("/files/Stremio.AppImage").isEmpty());
+    foreach (const QByteArray &range, server.ranges("/files/Stremio.AppImage")) QVERIFY(range.startsWith("bytes="));
+    // 512KB at 128KB/s, less what the bucket (a second worth) and the read buffer can let through at once
+    qint64 minMs = (512 * 1024 - limit - DOWNLOAD_READ_BUFFER) * 1000 / limit;
+    QVERIFY2(ms >= minMs, qPrintable(QString("took %1 ms, expected at least %2 ms").arg(ms).arg(minMs)));
+#endif
+}
+
+void TestAutoUpdater::throughput_data() {
+    QTest::addColumn<int>("latencyMs");
+    QTest::addColumn<qint64>("bandwidth");
+    QTest::addColumn<int>("maxDownloads");
+
+    QTest::newRow("unlimited") << 0 << Q_INT64_C(0) << DEFAULT_MAX_CONCURRENT_DOWNLOADS;
+    QTest::newRow("200ms latency") << 200 << Q_INT64_C(0) << DEFAULT_MAX_CONCURRENT_DOWNLOADS;
+    QTest::newRow("4MB/s per connection") << 0 << Q_INT64_C(4 * 1024 * 1024) << DEFAULT_MAX_CONCURRENT_DOWNLOADS;
+    QTest::newRow("4MB/s, one at a time") << 0 << Q_INT64_C(4 * 1024 * 1024) << 1;
+}
+
+void TestAutoUpdater::throughput() {
+    QFETCH(int, latencyMs);
+    QFETCH(qint64, bandwidth);
+    QFETCH(int, maxDownloads);
+
+    QByteArray serverJs = randomData(2 * 1024 * 1024, 9);
+    QByteArray asar = randomData(8 * 1024 * 1024, 10);
+    publish(serverJs, asar);
+    server.setLatency(latencyMs);
+    server.setBandwidth(bandwidth);
+    updater->setMaxConcurrentDownloads(maxDownloads);
+
+    Cycle cycle = runCycle(QTest::currentDataTag());
+    QVERIFY(cycle.finished);
+    QCOMPARE(cycle.error, QString());
+    QCOMPARE(cycle.prepared.size(), 2);
+}
+
+double TestAutoUpdater::cpuSeconds() {
+#ifdef Q_OS_UNIX
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0) return 0;
+    return usage.ru_utime.tv_sec + usage.ru_stime.tv_sec + (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1e6;
+#else
+    return 0;
+#endif
+}
+
+qint64 TestAutoUpdater::peakRssKB() {
+#ifdef Q_OS_UNIX
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0) return -1;
+#ifdef Q_OS_MACOS
+    return usage.ru_maxrss / 1024;
+#else
+    return usage.ru_maxrss;
+#endif
+#else
+    return -1;
+#endif
+}
+
+QTEST_GUILESS_MAIN(TestAutoUpdater)
+#include "tst_autoupdater.moc"
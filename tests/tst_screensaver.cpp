@@ -0,0 +1,199 @@
+#include <QtTest>
+#include <QDBusConnection>
+#include <QDBusConnectionInterface>
+#include <QDBusObjectPath>
+#include <QProcess>
+#include <QTemporaryDir>
+
+#include "screensaver.h"
+
+// Built with the path of dbus-daemon (DBUS_DAEMON); the tests run their own bus rather than touch the session's
+#define BUS_START_TIMEOUT_MS 5000
+#define SETTLE_MS 200
+
+// Stands in for org.freedesktop.ScreenSaver
+class FakeScreenSaver : public QObject
+{
+    Q_OBJECT
+    Q_CLASSINFO("D-Bus Interface", "org.freedesktop.ScreenSaver")
+
+public:
+    QList<uint> inhibits;
+    QList<uint> uninhibits;
+
+public slots:
+    uint Inhibit(const QString &app, const QString &reason) {
+        Q_UNUSED(app); Q_UNUSED(reason);
+        inhibits << (uint)(inhibits.size() + 1);
+        return inhibits.last();
+    }
+    void UnInhibit(uint cookie) { uninhibits << cookie; }
+};
+
+// The request object a portal Inhibit call returns; closing it ends the inhibition
+class FakeRequest : public QObject
+{
+    Q_OBJECT
+    Q_CLASSINFO("D-Bus Interface", "org.freedesktop.portal.Request")
+
+public:
+    int closed = 0;
+
+public slots:
+    void Close() { closed++; }
+};
+
+// Stands in for org.freedesktop.portal.Inhibit
+class FakePortal : public QObject
+{
+    Q_OBJECT
+    Q_CLASSINFO("D-Bus Interface", "org.freedesktop.portal.Inhibit")
+
+public:
+    explicit FakePortal(QDBusConnection bus) : bus(bus) { }
+    QList<uint> flags;
+    FakeRequest request;
+
+public slots:
+    QDBusObjectPath Inhibit(const QString &window, uint flags, const QVariantMap &options) {
+        Q_UNUSED(window); Q_UNUSED(options);
+        this->flags << flags;
+        QString path = "/org/freedesktop/portal/desktop/request/" + QString::number(this->flags.size());
+        bus.registerObject(path, &request, QDBusConnection::ExportAllSlots);
+        return QDBusObjectPath(path);
+    }
+
+private:
+    QDBusConnection bus;
+};
+
+class TestScreenSaver : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void initTestCase();
+    void cleanupTestCase();
+    void init();
+    void cleanup();
+
+    void inhibitsThroughScreenSaver();
+    void coalescesToggles();
+    void fallsBackToPortal();
+
+private:
+    QDBusConnection service() { return QDBusConnection(serviceName); }
+    QDBusConnection client() { return QDBusConnection(clientName); }
+
+    QTemporaryDir busDir;
+    QProcess daemon;
+    QString address;
+    QString serviceName;
+    QString clientName;
+    int run = 0;
+};
+
+void TestScreenSaver::initTestCase() {
+    // Or it would go straight to the portal
+    qunsetenv("FLATPAK_ID");
+    QVERIFY(busDir.isValid());
+    QFile config(busDir.filePath("bus.conf"));
+    QVERIFY(config.open(QIODevice::WriteOnly));
+    config.write("<!DOCTYPE busconfig PUBLIC \"-//freedesktop//DTD D-Bus Bus Configuration 1.0//EN\"\n"
+                 " \"http://www.freedesktop.org/standards/dbus/1.0/busconfig.dtd\">\n"
+                 "<busconfig>\n"
+                 "  <type>session</type>\n"
+                 "  <listen>unix:tmpdir=" + QFile::encodeName(busDir.path()) + "</listen>\n"
+                 "  <policy context=\"default\">\n"
+                 "    <allow send_destination=\"*\" eavesdrop=\"true\"/>\n"
+                 "    <allow eavesdrop=\"true\"/>\n"
+                 "    <allow own=\"*\"/>\n"
+                 "  </policy>\n"
+                 "</busconfig>\n");
+    config.close();
+
+    daemon.start(DBUS_DAEMON, QStringList() << "--config-file=" + config.fileName() << "--print-address" << "--nofork");
+    QVERIFY2(daemon.waitForStarted(BUS_START_TIMEOUT_MS), qPrintable(daemon.errorString()));
+    while (!daemon.canReadLine() && daemon.waitForReadyRead(BUS_START_TIMEOUT_MS)) { }
+    address = QString::fromUtf8(daemon.readLine()).trimmed();
+    QVERIFY(!address.isEmpty());
+}
+
+void TestScreenSaver::cleanupTestCase() {
+    daemon.kill();
+    daemon.waitForFinished();
+}
+
+// A fresh pair of connections each time, so no name or object outlives its test
+void TestScreenSaver::init() {
+    run++;
+    serviceName = "service" + QString::number(run);
+    clientName = "client" + QString::number(run);
+    QVERIFY(QDBusConnection::connectToBus(address, serviceName).isConnected());
+    QVERIFY(QDBusConnection::connectToBus(address, clientName).isConnected());
+}
+
+void TestScreenSaver::cleanup() {
+    QDBusConnection::disconnectFromBus(serviceName);
+    QDBusConnection::disconnectFromBus(clientName);
+}
+
+void TestScreenSaver::inhibitsThroughScreenSaver() {
+    FakeScreenSaver fake;
+    QVERIFY(service().registerObject("/org/freedesktop/ScreenSaver", &fake, QDBusConnection::ExportAllSlots));
+    QVERIFY(service().registerService("org.freedesktop.ScreenSaver"));
+
+    ScreenSaver screenSaver(client());
+    screenSaver.disable();
+    QTRY_COMPARE(fake.inhibits.size(), 1);
+
+    screenSaver.enable();
+    QTRY_COMPARE(fake.uninhibits.size(), 1);
+    // With the cookie it was given
+    QCOMPARE(fake.uninhibits.first(), fake.inhibits.first());
+}
+
+void TestScreenSaver::coalescesToggles() {
+    FakeScreenSaver fake;
+    QVERIFY(service().registerObject("/org/freedesktop/ScreenSaver", &fake, QDBusConnection::ExportAllSlots));
+    QVERIFY(service().registerService("org.freedesktop.ScreenSaver"));
+
+    // All while the first Inhibit is in flight; only where it ends up matters
+    ScreenSaver screenSaver(client());
+    screenSaver.disable();
+    screenSaver.enable();
+    screenSaver.disable();
+    screenSaver.enable();
+    screenSaver.disable();
+    QTRY_COMPARE(fake.inhibits.size(), 1);
+    QTest::qWait(SETTLE_MS);
+    QCOMPARE(fake.inhibits.size(), 1);
+    QCOMPARE(fake.uninhibits.size(), 0);
+
+    screenSaver.enable();
+    screenSaver.disable();
+    screenSaver.enable();
+    QTRY_COMPARE(fake.uninhibits.size(), 1);
+    QTest::qWait(SETTLE_MS);
+    QCOMPARE(fake.inhibits.size(), 1);
+    QCOMPARE(fake.uninhibits.size(), 1);
+}
+
+void TestScreenSaver::fallsBackToPortal() {
+    FakePortal portal(service());
+    QVERIFY(service().registerObject("/org/freedesktop/portal/desktop", &portal, QDBusConnection::ExportAllSlots));
+    QVERIFY(service().registerService("org.freedesktop.portal.Desktop"));
+
+    // No org.freedesktop.ScreenSaver on this bus
+    ScreenSaver screenSaver(client());
+    screenSaver.disable();
+    QTRY_COMPARE(portal.flags.size(), 1);
+    // Idle
+    QCOMPARE(portal.flags.first(), 8u);
+
+    screenSaver.enable();
+    QTRY_COMPARE(portal.request.closed, 1);
+}
+
+QTEST_GUILESS_MAIN(TestScreenSaver)
+#include "tst_screensaver.moc"
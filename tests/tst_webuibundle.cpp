@@ -0,0 +1,212 @@
+#include <QtTest>
+#include <QCoreApplication>
+#include <QDir>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QMap>
+#include <QSignalSpy>
+#include <QStandardPaths>
+
+#include "webuibundle.h"
+#include "updateserver.h"
+#include "testsigning.h"
+
+#define REVALIDATE_TIMEOUT_MS 10000
+
+// Revalidation of the local web UI bundle against UpdateServer, with the manifest signed by the test key
+class TestWebUiBundle : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void initTestCase();
+    void init();
+
+    void installsSignedBundle();
+    void downloadsOnlyChanged();
+    void rejectsBadSignature();
+    void rejectsCorruptFile();
+    void reportsDroppedConnection();
+    void migratesStorage();
+
+private:
+    void publish(const QString &version, const QMap<QString, QByteArray> &files, bool badSignature = false);
+    QVariantMap revalidate(WebUiBundle &bundle);
+    QUrl source() const { return server.url("/bundle/"); }
+
+    QString rootDir;
+    UpdateServer server;
+};
+
+void TestWebUiBundle::initTestCase() {
+    QStandardPaths::setTestModeEnabled(true);
+    rootDir = QStandardPaths::writableLocation(QStandardPaths::AppDataLocation) + QDir::separator() + WEBUI_DIR;
+    init_public_key();
+    QVERIFY(server.start());
+}
+
+void TestWebUiBundle::init() {
+    QDir(rootDir).removeRecursively();
+    server.clear();
+}
+
+void TestWebUiBundle::publish(const QString &version, const QMap<QString, QByteArray> &files, bool badSignature) {
+    QJsonObject entries;
+    for (QMap<QString, QByteArray>::const_iterator it = files.constBegin(); it != files.constEnd(); ++it) {
+        QJsonObject entry;
+        entry["checksum"] = QString(QCryptographicHash::hash(it.value(), QCryptographicHash::Sha256).toHex());
+        entries[it.key()] = entry;
+        server.setResource("/bundle/" + it.key(), it.value(), "text/plain");
+    }
+
+    QJsonObject manifest;
+    manifest["version"] = version;
+    manifest["files"] = entries;
+    QByteArray data = QJsonDocument(manifest).toJson(QJsonDocument::Compact);
+    QByteArray sig = signWithTestKey(data);
+    QVERIFY(!sig.isEmpty());
+    // Signed, then changed: what a tampered mirror would serve
+    if (badSignature) data.replace("\"version\":\"" + version.toUtf8() + "\"", "\"version\":\"6.6.6\"");
+    server.setResource("/bundle/" WEBUI_MANIFEST_FNAME, data, "application/json");
+    server.setResource("/bundle/" WEBUI_SIGNATURE_FNAME, sig.toBase64(), "text/plain");
+}
+
+QVariantMap TestWebUiBundle::revalidate(WebUiBundle &bundle) {
+    QSignalSpy revalidated(&bundle, &WebUiBundle::revalidated);
+    bundle.revalidate();
+    if (!revalidated.wait(REVALIDATE_TIMEOUT_MS)) return QVariantMap();
+    return revalidated.first().at(0).toMap();
+}
+
+void TestWebUiBundle::installsSignedBundle() {
+    QMap<QString, QByteArray> files;
+    files["index.html"] = "<html><script src=\"js/app.js\"></script></html>";
+    files["js/app.js"] = QByteArray(256 * 1024, 'a');
+    publish("1", files);
+
+    WebUiBundle first(source());
+    QVERIFY(!first.isAvailable());
+    QVariantMap result = revalidate(first);
+    QCOMPARE(result.value("error").toString(), QString());
+    QCOMPARE(result.value("updated").toBool(), true);
+    QCOMPARE(result.value("version").toString(), QString("1"));
+    // What's served doesn't change during a session
+    QVERIFY(!first.isAvailable());
+
+    WebUiBundle next(source());
+    QVERIFY(next.isAvailable());
+    QCOMPARE(next.version(), QString("1"));
+    QFile app(rootDir + "/1/js/app.js");
+    QVERIFY(app.open(QIODevice::ReadOnly));
+    QVERIFY(app.readAll() == files["js/app.js"]);
+
+    // From another source, it's not ours
+    WebUiBundle other(server.url("/elsewhere/"));
+    QVERIFY(!other.isAvailable());
+}
+
+void TestWebUiBundle::downloadsOnlyChanged() {
+    QMap<QString, QByteArray> files;
+    files["index.html"] = "<html></html>";
+    files["app.js"] = "var version = 1";
+    files["style.css"] = "body { }";
+    publish("1", files);
+    {
+        WebUiBundle bundle(source());
+        QCOMPARE(revalidate(bundle).value("updated").toBool(), true);
+    }
+
+    files["app.js"] = "var version = 2";
+    publish("2", files);
+    WebUiBundle bundle(source());
+    QVariantMap result = revalidate(bundle);
+    QCOMPARE(result.value("updated").toBool(), true);
+    QCOMPARE(result.value("previousVersion").toString(), QString("1"));
+    QCOMPARE(server.requests("/bundle/app.js"), 2);
+    QCOMPARE(server.requests("/bundle/index.html"), 1);
+    QCOMPARE(server.requests("/bundle/style.css"), 1);
+    QVERIFY(QFile::exists(rootDir + "/2/style.css"));
+
+    // Up to date: only the manifest is fetched
+    WebUiBundle current(source());
+    QCOMPARE(current.version(), QString("2"));
+    result = revalidate(current);
+    QCOMPARE(result.value("updated").toBool(), false);
+    QCOMPARE(server.requests("/bundle/app.js"), 2);
+}
+
+void TestWebUiBundle::rejectsBadSignature() {
+    QMap<QString, QByteArray> files;
+    files["index.html"] = "<html></html>";
+    publish("1", files, true);
+
+    WebUiBundle bundle(source());
+    QVariantMap result = revalidate(bundle);
+    QCOMPARE(result.value("error").toString(), QString("unable to verify web UI manifest signature"));
+    QCOMPARE(server.requests("/bundle/index.html"), 0);
+    QVERIFY(!WebUiBundle(source()).isAvailable());
+}
+
+void TestWebUiBundle::rejectsCorruptFile() {
+    QMap<QString, QByteArray> files;
+    files["index.html"] = "<html></html>";
+    files["app.js"] = QByteArray(64 * 1024, 'b');
+    publish("1", files);
+    server.setCorrupt("/bundle/app.js", true);
+
+    WebUiBundle bundle(source());
+    QVariantMap result = revalidate(bundle);
+    QCOMPARE(result.value("error").toString(), QString("unable to verify checksum of web UI file app.js"));
+    QVERIFY(!WebUiBundle(source()).isAvailable());
+    // Nothing left behind
+    QCOMPARE(QDir(rootDir).entryList(QDir::Dirs | QDir::NoDotAndDotDot), QStringList());
+}
+
+void TestWebUiBundle::reportsDroppedConnection() {
+    QMap<QString, QByteArray> files;
+    files["index.html"] = "<html></html>";
+    files["app.js"] = QByteArray(512 * 1024, 'c');
+    publish("1", files);
+    server.dropAfter("/bundle/app.js", 100 * 1024);
+
+    WebUiBundle bundle(source());
+    QVariantMap result = revalidate(bundle);
+    QVERIFY2(result.value("error").toString().startsWith("network error on"), qPrintable(result.value("error").toString()));
+    QVERIFY(!WebUiBundle(source()).isAvailable());
+
+    // The next start gets it
+    WebUiBundle retry(source());
+    QCOMPARE(revalidate(retry).value("updated").toBool(), true);
+    QVERIFY(WebUiBundle(source()).isAvailable());
+}
+
+void TestWebUiBundle::migratesStorage() {
+    QByteArray exported = "{\"localStorage\":{\"authKey\":\"x\"},\"indexedDB\":[]}";
+
+    WebUiBundle bundle(source());
+    QVERIFY(!bundle.isStorageReady());
+    QVERIFY(!bundle.isStorageMigrated());
+    QCOMPARE(bundle.pendingStorage(), QString());
+
+    QSignalSpy changed(&bundle, &WebUiBundle::storageChanged);
+    QVERIFY(!bundle.saveStorage("not json"));
+    QVERIFY(bundle.saveStorage(exported));
+    QCOMPARE(changed.size(), 1);
+    QVERIFY(bundle.isStorageReady());
+    QVERIFY(!bundle.isStorageMigrated());
+    QCOMPARE(bundle.pendingStorage(), QString(exported));
+
+    bundle.finishStorageMigration();
+    QCOMPARE(changed.size(), 2);
+    QVERIFY(bundle.isStorageReady());
+    QVERIFY(bundle.isStorageMigrated());
+    QCOMPARE(bundle.pendingStorage(), QString());
+    QVERIFY(!QFile::exists(rootDir + QDir::separator() + WEBUI_STORAGE_FNAME));
+
+    // Once migrated, the https origin is not exported from again
+    QVERIFY(!bundle.saveStorage(exported));
+    QVERIFY(WebUiBundle(source()).isStorageMigrated());
+}
+
+QTEST_GUILESS_MAIN(TestWebUiBundle)
+#include "tst_webuibundle.moc"
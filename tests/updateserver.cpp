@@ -0,0 +1,163 @@
+#include "updateserver.h"
+
+#include <QCryptographicHash>
+#include <QHostAddress>
+#include <QTimer>
+
+UpdateServer::UpdateServer(QObject *parent) : QTcpServer(parent) {
+    QObject::connect(this, &QTcpServer::newConnection, this, &UpdateServer::onNewConnection);
+}
+
+bool UpdateServer::start() {
+    return listen(QHostAddress::LocalHost, 0);
+}
+
+QUrl UpdateServer::url(const QString &path) const {
+    return QUrl("http://127.0.0.1:" + QString::number(serverPort()) + path);
+}
+
+void UpdateServer::setResource(const QString &path, const QByteArray &body, const QByteArray &contentType) {
+    Resource r;
+    r.body = body;
+    r.contentType = contentType;
+    resources.insert(path, r);
+}
+
+void UpdateServer::setStatus(const QString &path, int status) {
+    resources[path].status = status;
+}
+
+void UpdateServer::removeResource(const QString &path) {
+    resources.remove(path);
+}
+
+void UpdateServer::clear() {
+    resources.clear();
+    requestRanges.clear();
+    latencyMs = 0;
+    bandwidth = 0;
+    sent = 0;
+}
+
+void UpdateServer::dropAfter(const QString &path, qint64 bytes, int times) {
+    resources[path].dropAfter = bytes;
+    resources[path].drops = times;
+}
+
+void UpdateServer::setCorrupt(const QString &path, bool corrupt) {
+    resources[path].corrupt = corrupt;
+}
+
+QByteArray UpdateServer::etag(const QByteArray &body) {
+    return "\"" + QCryptographicHash::hash(body, QCryptographicHash::Sha1).toHex().left(16) + "\"";
+}
+
+void UpdateServer::onNewConnection() {
+    while (hasPendingConnections()) {
+        QTcpSocket* socket = nextPendingConnection();
+        connections.insert(socket, Connection());
+        QObject::connect(socket, &QTcpSocket::readyRead, this, [this, socket]() { onReadyRead(socket); });
+        QObject::connect(socket, &QTcpSocket::disconnected, this, [this, socket]() {
+            connections.remove(socket);
+            socket->deleteLater();
+        });
+    }
+}
+
+void UpdateServer::onReadyRead(QTcpSocket *socket) {
+    if (!connections.contains(socket)) return;
+    Connection &conn = connections[socket];
+    conn.request += socket->readAll();
+    if (conn.responding || !conn.request.contains("\r\n\r\n")) return;
+    conn.responding = true;
+
+    if (latencyMs > 0) QTimer::singleShot(latencyMs, socket, [this, socket]() { respond(socket); });
+    else respond(socket);
+}
+
+void UpdateServer::respond(QTcpSocket *socket) {
+    if (!connections.contains(socket)) return;
+    Connection &conn = connections[socket];
+
+    QList<QByteArray> lines = conn.request.left(conn.request.indexOf("\r\n\r\n")).split('\n');
+    QList<QByteArray> requestLine = lines.value(0).trimmed().split(' ');
+    QString path = QUrl(QString::fromLatin1(requestLine.value(1))).path();
+    QByteArray range, ifRange;
+    for (int i = 1; i < lines.size(); i++) {
+        int colon = lines[i].indexOf(':');
+        if (colon < 0) continue;
+        QByteArray name = lines[i].left(colon).trimmed().toLower();
+        QByteArray value = lines[i].mid(colon + 1).trimmed();
+        if (name == "range") range = value;
+        if (name == "if-range") ifRange = value;
+    }
+    requestRanges[path].append(range);
+
+    int status = 404;
+    QByteArray body = "Not found";
+    QByteArray headers;
+    qint64 dropAfter = -1;
+
+    if (resources.contains(path)) {
+        Resource &r = resources[path];
+        status = r.status;
+        body = r.body;
+        if (r.corrupt && !body.isEmpty()) body[body.size() / 2] = body[body.size() / 2] ^ 0xff;
+        if (r.drops > 0) {
+            r.drops--;
+            dropAfter = r.dropAfter;
+        }
+        headers += "Content-Type: " + r.contentType + "\r\n";
+        headers += "ETag: " + etag(r.body) + "\r\n";
+        headers += "Accept-Ranges: bytes\r\n";
+
+        // The whole body if the file changed since the client got its part of it
+        if (status == 200 && range.startsWith("bytes=") && (ifRange.isEmpty() || ifRange == etag(r.body))) {
+            int dash = range.indexOf('-');
+            qint64 from = range.mid(6, dash - 6).toLongLong();
+            QByteArray lastByte = range.mid(dash + 1);
+            qint64 last = lastByte.isEmpty() ? body.size() - 1 : qMin(lastByte.toLongLong(), (qint64)body.size() - 1);
+            if (from >= body.size()) {
+                status = 416;
+                headers += "Content-Range: bytes */" + QByteArray::number(body.size()) + "\r\n";
+                body.clear();
+            } else {
+                status = 206;
+                headers += "Content-Range: bytes " + QByteArray::number(from) + "-" + QByteArray::number(last)
+                         + "/" + QByteArray::number(body.size()) + "\r\n";
+                body = body.mid(from, last - from + 1);
+            }
+        }
+    }
+
+    QByteArray reason = status == 200 ? "OK" : status == 206 ? "Partial Content" : status == 404 ? "Not Found"
+                      : status == 416 ? "Range Not Satisfiable" : "Error";
+    QByteArray head = "HTTP/1.1 " + QByteArray::number(status) + " " + reason + "\r\n" + headers
+                    + "Content-Length: " + QByteArray::number(body.size()) + "\r\n"
+                    + "Connection: close\r\n\r\n";
+
+    conn.pending = head + body;
+    conn.allowed = dropAfter >= 0 ? head.size() + dropAfter : -1;
+    write(socket);
+}
+
+void UpdateServer::write(QTcpSocket *socket) {
+    if (!connections.contains(socket)) return;
+    Connection &conn = connections[socket];
+
+    qint64 n = bandwidth > 0 ? qMax(Q_INT64_C(1), bandwidth * UPDATE_SERVER_TICK_MS / 1000) : conn.pending.size();
+    n = qMin(n, (qint64)conn.pending.size());
+    if (conn.allowed >= 0) n = qMin(n, conn.allowed);
+
+    socket->write(conn.pending.constData(), n);
+    conn.pending.remove(0, (int)n);
+    sent += n;
+    if (conn.allowed >= 0) conn.allowed -= n;
+
+    // Done, or dropped; the client sees less than the Content-Length it was promised
+    if (conn.pending.isEmpty() || conn.allowed == 0) {
+        socket->disconnectFromHost();
+        return;
+    }
+    QTimer::singleShot(UPDATE_SERVER_TICK_MS, socket, [this, socket]() { write(socket); });
+}
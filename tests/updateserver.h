@@ -0,0 +1,80 @@
+#ifndef UPDATESERVER_H
+#define UPDATESERVER_H
+
+#include <QTcpServer>
+#include <QTcpSocket>
+#include <QByteArray>
+#include <QHash>
+#include <QList>
+#include <QString>
+#include <QUrl>
+
+// How often a bandwidth limited response is written to
+#define UPDATE_SERVER_TICK_MS 20
+
+// Stand-in for the update endpoints, the mirrors and the web UI host: a minimal HTTP/1.1 server on localhost
+// Every response closes the connection. Range requests (bytes=N- and bytes=N-M) and If-Range are honoured, and each resource can
+// be served with latency, a bandwidth limit, a dropped connection or a corrupted body
+class UpdateServer : public QTcpServer
+{
+    Q_OBJECT
+
+public:
+    explicit UpdateServer(QObject *parent = 0);
+
+    bool start();
+    QUrl url(const QString &path) const;
+
+    void setResource(const QString &path, const QByteArray &body, const QByteArray &contentType = "application/octet-stream");
+    void setStatus(const QString &path, int status);
+    void removeResource(const QString &path);
+    void clear();
+
+    // For all responses
+    void setLatency(int ms) { latencyMs = ms; }
+    void setBandwidth(qint64 bytesPerSec) { bandwidth = bytesPerSec; }
+
+    // The next `times` responses for path close the connection after that many bytes of body
+    void dropAfter(const QString &path, qint64 bytes, int times = 1);
+    // Responses for path have a byte of the body flipped
+    void setCorrupt(const QString &path, bool corrupt);
+
+    // What was asked for: the Range header of each request for path, empty if there was none
+    QList<QByteArray> ranges(const QString &path) const { return requestRanges.value(path); }
+    int requests(const QString &path) const { return requestRanges.value(path).size(); }
+    qint64 bytesSent() const { return sent; }
+
+    // What a body is served with as its ETag
+    static QByteArray etag(const QByteArray &body);
+
+private:
+    struct Resource {
+        QByteArray body;
+        QByteArray contentType;
+        int status = 200;
+        qint64 dropAfter = -1;
+        int drops = 0;
+        bool corrupt = false;
+    };
+    struct Connection {
+        QByteArray request;
+        QByteArray pending;
+        // Bytes of the response that can be written before the connection is dropped; -1 for all of it
+        qint64 allowed = -1;
+        bool responding = false;
+    };
+
+    void onNewConnection();
+    void onReadyRead(QTcpSocket *socket);
+    void respond(QTcpSocket *socket);
+    void write(QTcpSocket *socket);
+
+    QHash<QString, Resource> resources;
+    QHash<QTcpSocket*, Connection> connections;
+    QHash<QString, QList<QByteArray> > requestRanges;
+    int latencyMs = 0;
+    qint64 bandwidth = 0;
+    qint64 sent = 0;
+};
+
+#endif // UPDATESERVER_H
@@ -9,7 +9,12 @@
 #include <stdlib.h>
 #include <assert.h>
 
+// The tests build against their own key
+#ifdef VERIFYSIG_KEY_HEADER
+#include VERIFYSIG_KEY_HEADER
+#else
 #include "publickey.h"
+#endif
 
 typedef unsigned char byte;
 const char hn[] = "sha256";
@@ -0,0 +1,345 @@
+#include "webuibundle.h"
+#include "initscheduler.h"
+
+#include <QCryptographicHash>
+#include <QDebug>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QJsonDocument>
+#include <QMimeDatabase>
+#include <QNetworkRequest>
+#include <QSaveFile>
+#include <QStandardPaths>
+#include <QWebEngineUrlScheme>
+
+// Mixing C and C++ :(
+extern "C" {
+#include <verifysig.h>
+}
+
+WebUiBundle::WebUiBundle(QUrl source, QObject *parent)
+    : QWebEngineUrlSchemeHandler(parent), manager(new QNetworkAccessManager(this)), source(source) {
+    QString dir = QStandardPaths::writableLocation(QStandardPaths::AppDataLocation);
+    if (!dir.isEmpty()) rootDir = dir + QDir::separator() + WEBUI_DIR;
+    if (load()) qDebug() << "Web UI bundle" << servingVersion << "available locally";
+}
+
+void WebUiBundle::registerScheme() {
+    QWebEngineUrlScheme scheme(WEBUI_SCHEME);
+    scheme.setSyntax(QWebEngineUrlScheme::Syntax::Host);
+    // A secure context, like the https origin the UI is normally loaded from
+    scheme.setFlags(QWebEngineUrlScheme::SecureScheme | QWebEngineUrlScheme::CorsEnabled);
+    QWebEngineUrlScheme::registerScheme(scheme);
+}
+
+// The current bundle, if it's from our source and its manifest is still properly signed
+bool WebUiBundle::load() {
+    if (rootDir.isEmpty()) return false;
+
+    QFile currentFile(rootDir + QDir::separator() + WEBUI_CURRENT_FNAME);
+    if (!currentFile.open(QFile::ReadOnly)) return false;
+    QJsonObject current = QJsonDocument::fromJson(currentFile.readAll()).object();
+    QString version = current.value("version").toString();
+    if (current.value("source").toString() != source.toString() || !isSafePath(version)) return false;
+
+    QString dir = rootDir + QDir::separator() + version;
+    QJsonObject manifest;
+    if (!readBundle(dir, manifest) || !QFile::exists(dir + QDir::separator() + "index.html")) return false;
+
+    servingDir = dir;
+    servingVersion = version;
+    installedVersion = version;
+    installedFiles = manifest.value("files").toObject();
+    return true;
+}
+
+bool WebUiBundle::readBundle(QString dir, QJsonObject &manifest) {
+    QFile manifestFile(dir + QDir::separator() + WEBUI_MANIFEST_FNAME);
+    QFile signatureFile(dir + QDir::separator() + WEBUI_SIGNATURE_FNAME);
+    if (!manifestFile.open(QFile::ReadOnly) || !signatureFile.open(QFile::ReadOnly)) return false;
+
+    QByteArray data = manifestFile.readAll();
+    QByteArray sig = QByteArray::fromBase64(signatureFile.readAll().trimmed());
+    InitScheduler::instance()->ensure("public key");
+    if (verify_sig((const byte*)data.data(), data.size(), (const byte*)sig.data(), sig.length()) != 0) {
+        qWarning() << "Web UI bundle in" << dir << "has an invalid signature";
+        return false;
+    }
+    manifest = QJsonDocument::fromJson(data).object();
+    return true;
+}
+
+// Relative, and not going anywhere outside of the bundle
+bool WebUiBundle::isSafePath(QString path) {
+    return !path.isEmpty() && !QDir::isAbsolutePath(path) && !path.contains("..") && !path.contains('\\')
+        && !path.startsWith('/');
+}
+
+// SERVING
+void WebUiBundle::requestStarted(QWebEngineUrlRequestJob* job) {
+    QString path = job->requestUrl().path();
+    if (path.startsWith('/')) path = path.mid(1);
+    if (path.isEmpty() || path.endsWith('/')) path += "index.html";
+
+    if (servingDir.isEmpty() || !isSafePath(path)) {
+        job->fail(QWebEngineUrlRequestJob::UrlNotFound);
+        return;
+    }
+
+    QFile* file = new QFile(servingDir + QDir::separator() + path);
+    if (!file->open(QIODevice::ReadOnly)) {
+        delete file;
+        job->fail(QWebEngineUrlRequestJob::UrlNotFound);
+        return;
+    }
+    // The device has to outlive the job
+    QObject::connect(job, &QObject::destroyed, file, &QObject::deleteLater);
+
+    static QMimeDatabase mimeDb;
+    job->reply(mimeDb.mimeTypeForFile(path, QMimeDatabase::MatchExtension).name().toUtf8(), file);
+}
+
+// STORAGE
+bool WebUiBundle::isStorageReady() const {
+    return isStorageMigrated() || (!rootDir.isEmpty() && QFile::exists(rootDir + QDir::separator() + WEBUI_STORAGE_FNAME));
+}
+
+bool WebUiBundle::isStorageMigrated() const {
+    return !rootDir.isEmpty() && QFile::exists(rootDir + QDir::separator() + WEBUI_STORAGE_MIGRATED_FNAME);
+}
+
+bool WebUiBundle::saveStorage(QString json) {
+    if (rootDir.isEmpty() || isStorageMigrated() || !QJsonDocument::fromJson(json.toUtf8()).isObject()) return false;
+
+    QDir().mkpath(rootDir);
+    QSaveFile file(rootDir + QDir::separator() + WEBUI_STORAGE_FNAME);
+    if (!file.open(QFile::WriteOnly)) return false;
+    file.write(json.toUtf8());
+    if (!file.commit()) {
+        qWarning() << "Web UI bundle: unable to save the storage export";
+        return false;
+    }
+    emit storageChanged();
+    return true;
+}
+
+QString WebUiBundle::pendingStorage() {
+    if (rootDir.isEmpty() || isStorageMigrated()) return QString();
+    QFile file(rootDir + QDir::separator() + WEBUI_STORAGE_FNAME);
+    if (!file.open(QFile::ReadOnly)) return QString();
+    return QString::fromUtf8(file.readAll());
+}
+
+void WebUiBundle::finishStorageMigration() {
+    if (rootDir.isEmpty() || isStorageMigrated()) return;
+    QFile marker(rootDir + QDir::separator() + WEBUI_STORAGE_MIGRATED_FNAME);
+    if (!marker.open(QFile::WriteOnly)) return;
+    marker.close();
+    // It holds the UI's login, among others
+    QFile::remove(rootDir + QDir::separator() + WEBUI_STORAGE_FNAME);
+    qDebug() << "Web UI bundle: storage migrated";
+    emit storageChanged();
+}
+
+// REVALIDATION
+void WebUiBundle::revalidate() {
+    if (rootDir.isEmpty() || manifestReply || signatureReply || !stagingDir.isEmpty()) return;
+
+    manifestReply = manager->get(QNetworkRequest(source.resolved(QUrl(WEBUI_MANIFEST_FNAME))));
+    QObject::connect(manifestReply, &QNetworkReply::finished, this, &WebUiBundle::manifestFinished);
+}
+
+void WebUiBundle::manifestFinished() {
+    QNetworkReply* reply = manifestReply;
+    manifestReply = NULL;
+    reply->deleteLater();
+
+    if (reply->error() != QNetworkReply::NoError) {
+        fail("network error on "+reply->url().toString());
+        return;
+    }
+    manifestData = reply->readAll();
+
+    signatureReply = manager->get(QNetworkRequest(source.resolved(QUrl(WEBUI_SIGNATURE_FNAME))));
+    QObject::connect(signatureReply, &QNetworkReply::finished, this, &WebUiBundle::signatureFinished);
+}
+
+void WebUiBundle::signatureFinished() {
+    QNetworkReply* reply = signatureReply;
+    signatureReply = NULL;
+    reply->deleteLater();
+
+    if (reply->error() != QNetworkReply::NoError) {
+        fail("network error on "+reply->url().toString());
+        return;
+    }
+    signature = reply->readAll().trimmed();
+    QByteArray sig = QByteArray::fromBase64(signature);
+    InitScheduler::instance()->ensure("public key");
+
+    if (verify_sig((const byte*)manifestData.data(), manifestData.size(), (const byte*)sig.data(), sig.length()) != 0) {
+        fail("unable to verify web UI manifest signature");
+        return;
+    }
+
+    QJsonObject manifest = QJsonDocument::fromJson(manifestData).object();
+    QString version = manifest.value("version").toString();
+    if (!isSafePath(version) || version.contains('/')) {
+        fail("invalid web UI manifest");
+        return;
+    }
+
+    if (version == installedVersion) {
+        QVariantMap result;
+        result["version"] = version;
+        result["updated"] = false;
+        emit revalidated(result);
+        return;
+    }
+
+    stagingVersion = version;
+    install(manifest.value("files").toObject());
+}
+
+// Files that didn't change are copied from the installed bundle, the rest are downloaded
+void WebUiBundle::install(const QJsonObject &files) {
+    stagingDir = rootDir + QDir::separator() + stagingVersion + ".partial";
+    QDir(stagingDir).removeRecursively();
+
+    QString installedDir = rootDir + QDir::separator() + installedVersion;
+    for (QJsonObject::const_iterator it = files.constBegin(); it != files.constEnd(); ++it) {
+        QString path = it.key();
+        QByteArray checksum = QByteArray::fromHex(it.value().toObject().value("checksum").toString().toLatin1());
+        if (!isSafePath(path) || checksum.isEmpty()) {
+            fail("invalid web UI manifest entry "+path);
+            return;
+        }
+
+        QString dest = stagingDir + QDir::separator() + path;
+        QDir().mkpath(QFileInfo(dest).absolutePath());
+        if (!installedVersion.isEmpty()
+            && installedFiles.value(path).toObject().value("checksum") == it.value().toObject().value("checksum")
+            && QFile::copy(installedDir + QDir::separator() + path, dest)) continue;
+
+        PendingFile file;
+        file.path = path;
+        file.checksum = checksum;
+        pending.enqueue(file);
+    }
+
+    qDebug() << "Web UI bundle: updating to" << stagingVersion << ", downloading" << pending.size() << "of"
+             << files.size() << "files";
+    startNextDownloads();
+}
+
+void WebUiBundle::startNextDownloads() {
+    while (!pending.isEmpty() && downloads.size() < WEBUI_MAX_CONCURRENT_DOWNLOADS) {
+        PendingFile file = pending.dequeue();
+        QNetworkReply* reply = manager->get(QNetworkRequest(source.resolved(QUrl(file.path))));
+        QObject::connect(reply, &QNetworkReply::finished, this, &WebUiBundle::fileFinished);
+        downloads.insert(reply, file);
+    }
+    if (pending.isEmpty() && downloads.isEmpty()) finishInstall();
+}
+
+void WebUiBundle::fileFinished() {
+    QNetworkReply* reply = qobject_cast<QNetworkReply*>(sender());
+    // Not there if the revalidation failed in the meantime
+    if (reply == NULL || !downloads.contains(reply)) return;
+    PendingFile file = downloads.take(reply);
+    reply->deleteLater();
+
+    if (reply->error() != QNetworkReply::NoError) {
+        fail("network error on "+reply->url().toString());
+        return;
+    }
+
+    QByteArray data = reply->readAll();
+    if (QCryptographicHash::hash(data, QCryptographicHash::Sha256) != file.checksum) {
+        fail("unable to verify checksum of web UI file "+file.path);
+        return;
+    }
+
+    QFile out(stagingDir + QDir::separator() + file.path);
+    if (!out.open(QFile::WriteOnly) || out.write(data) != data.size()) {
+        fail("unable to write web UI file "+file.path);
+        return;
+    }
+    out.close();
+
+    startNextDownloads();
+}
+
+void WebUiBundle::finishInstall() {
+    QString versionDir = rootDir + QDir::separator() + stagingVersion;
+
+    QFile manifestFile(stagingDir + QDir::separator() + WEBUI_MANIFEST_FNAME);
+    QFile signatureFile(stagingDir + QDir::separator() + WEBUI_SIGNATURE_FNAME);
+    if (!manifestFile.open(QFile::WriteOnly) || manifestFile.write(manifestData) != manifestData.size()
+        || !signatureFile.open(QFile::WriteOnly) || signatureFile.write(signature) != signature.size()) {
+        fail("unable to write web UI manifest");
+        return;
+    }
+    manifestFile.close();
+    signatureFile.close();
+
+    // The version dir is complete before anything points to it
+    QDir(versionDir).removeRecursively();
+    if (!QDir().rename(stagingDir, versionDir)) {
+        fail("unable to move web UI bundle into place");
+        return;
+    }
+
+    QJsonObject current;
+    current["version"] = stagingVersion;
+    current["source"] = source.toString();
+    QSaveFile currentFile(rootDir + QDir::separator() + WEBUI_CURRENT_FNAME);
+    if (!currentFile.open(QFile::WriteOnly)) {
+        fail("unable to switch web UI bundle");
+        return;
+    }
+    currentFile.write(QJsonDocument(current).toJson(QJsonDocument::Compact));
+    if (!currentFile.commit()) {
+        fail("unable to switch web UI bundle");
+        return;
+    }
+
+    QString previous = installedVersion;
+    installedVersion = stagingVersion;
+    installedFiles = QJsonDocument::fromJson(manifestData).object().value("files").toObject();
+    stagingDir = QString();
+    qDebug() << "Web UI bundle: updated to" << installedVersion;
+
+    // Keep only what's installed and what's being served
+    foreach (const QString &dir, QDir(rootDir).entryList(QDir::Dirs | QDir::NoDotAndDotDot)) {
+        if (dir != installedVersion && dir != servingVersion) QDir(rootDir + QDir::separator() + dir).removeRecursively();
+    }
+
+    QVariantMap result;
+    result["version"] = installedVersion;
+    result["previousVersion"] = previous;
+    result["updated"] = true;
+    emit revalidated(result);
+}
+
+void WebUiBundle::fail(QString err) {
+    qWarning() << "Web UI bundle:" << err;
+    cleanup();
+
+    QVariantMap result;
+    result["error"] = err;
+    emit revalidated(result);
+}
+
+void WebUiBundle::cleanup() {
+    QHash<QNetworkReply*, PendingFile> replies = downloads;
+    downloads.clear();
+    foreach (QNetworkReply* reply, replies.keys()) {
+        reply->abort();
+        reply->deleteLater();
+    }
+    pending.clear();
+    if (!stagingDir.isEmpty()) QDir(stagingDir).removeRecursively();
+    stagingDir = QString();
+}
@@ -0,0 +1,118 @@
+#ifndef WEBUIBUNDLE_H
+#define WEBUIBUNDLE_H
+
+#include <QObject>
+#include <QByteArray>
+#include <QHash>
+#include <QJsonObject>
+#include <QNetworkAccessManager>
+#include <QNetworkReply>
+#include <QQueue>
+#include <QUrl>
+#include <QWebEngineUrlRequestJob>
+#include <QWebEngineUrlSchemeHandler>
+
+#define WEBUI_SCHEME "stremio-webui"
+#define WEBUI_URL "stremio-webui://app/"
+// Under the app data dir: a dir per version, and a pointer to the current one that is replaced atomically
+#define WEBUI_DIR "webui"
+#define WEBUI_CURRENT_FNAME "current.json"
+#define WEBUI_MANIFEST_FNAME "manifest.json"
+#define WEBUI_SIGNATURE_FNAME "manifest.json.sig"
+#define WEBUI_MAX_CONCURRENT_DOWNLOADS 4
+// What the UI kept under the https origin, waiting to be imported into ours; and the marker that it was
+#define WEBUI_STORAGE_FNAME "storage.json"
+#define WEBUI_STORAGE_MIGRATED_FNAME "storage-migrated"
+
+// A local copy of the web UI, served from disk through the stremio-webui:// scheme
+//
+// The bundle is described by a manifest at <source>/manifest.json:
+//   { "version": "...", "files": { "index.html": { "checksum": "<sha256 hex>" }, ... } }
+// signed like the update descriptors, with the base64 signature at <source>/manifest.json.sig
+// A revalidation downloads what changed into a new version dir and switches to it atomically; the bundle being
+// served doesn't change during a session, the new one is used from the next start
+//
+// The scheme is its own origin, so the UI's localStorage and IndexedDB from https://app.strem.io are migrated
+// (see webuistorage.js); the bundle is only used once they've been exported
+class WebUiBundle : public QWebEngineUrlSchemeHandler
+{
+    Q_OBJECT
+    Q_PROPERTY(bool available READ isAvailable CONSTANT)
+    Q_PROPERTY(QString url READ url CONSTANT)
+    Q_PROPERTY(QString version READ version CONSTANT)
+    Q_PROPERTY(bool storageReady READ isStorageReady NOTIFY storageChanged)
+    Q_PROPERTY(bool storageMigrated READ isStorageMigrated NOTIFY storageChanged)
+
+public:
+    explicit WebUiBundle(QUrl source, QObject *parent = 0);
+
+    // Must be called before the application is created
+    static void registerScheme();
+
+    bool isAvailable() const { return !servingDir.isEmpty(); }
+    QString url() const { return WEBUI_URL; }
+    QString version() const { return servingVersion; }
+    // Exported or already migrated
+    bool isStorageReady() const;
+    bool isStorageMigrated() const;
+
+    void requestStarted(QWebEngineUrlRequestJob* job) override;
+
+public slots:
+    void revalidate();
+
+    // The export from the https origin; replaces an earlier one
+    bool saveStorage(QString json);
+    // The export waiting to be imported, empty if there's none
+    QString pendingStorage();
+    // Called once the bundle has loaded with the import in place
+    void finishStorageMigration();
+
+signals:
+    void revalidated(QVariant result);
+    void storageChanged();
+
+private slots:
+    void manifestFinished();
+    void signatureFinished();
+    void fileFinished();
+
+private:
+    struct PendingFile {
+        QString path;
+        QByteArray checksum;
+    };
+
+    bool load();
+    bool readBundle(QString dir, QJsonObject &manifest);
+    static bool isSafePath(QString path);
+    void install(const QJsonObject &files);
+    void startNextDownloads();
+    void finishInstall();
+    void fail(QString err);
+    void cleanup();
+
+    QNetworkAccessManager* manager;
+    QUrl source;
+    QString rootDir;
+
+    // What we serve in this session
+    QString servingDir;
+    QString servingVersion;
+
+    // The newest bundle on disk
+    QString installedVersion;
+    QJsonObject installedFiles;
+
+    // Revalidation in progress
+    QNetworkReply* manifestReply = NULL;
+    QNetworkReply* signatureReply = NULL;
+    QByteArray manifestData;
+    QByteArray signature;
+    QString stagingVersion;
+    QString stagingDir;
+    QQueue<PendingFile> pending;
+    QHash<QNetworkReply*, PendingFile> downloads;
+};
+
+#endif // WEBUIBUNDLE_H
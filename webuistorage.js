@@ -0,0 +1,84 @@
+    //
+    // WEB UI STORAGE
+    //
+    // The local web UI bundle is served from its own origin, so what the UI kept in localStorage and IndexedDB
+    // under https://app.strem.io is copied over once: exported from a page of the old origin, and imported into
+    // the new one by a script that runs before the UI's own
+
+    // Runs in the page; leaves the JSON in window.__stremioShellStorage, or the error in window.__stremioShellStorageError
+    var exportSource = "(function() {\n" +
+        "    window.__stremioShellStorage = window.__stremioShellStorageError = null\n" +
+        "    var out = { localStorage: {}, indexedDB: [] }\n" +
+        "    for (var i = 0; i < localStorage.length; i++) out.localStorage[localStorage.key(i)] = localStorage.getItem(localStorage.key(i))\n" +
+        "    function req(r) { return new Promise(function(resolve, reject) { r.onsuccess = function() { resolve(r.result) }; r.onerror = function() { reject(r.error) } }) }\n" +
+        "    function exportDb(info) {\n" +
+        "        return req(indexedDB.open(info.name)).then(function(db) {\n" +
+        "            var names = Array.prototype.slice.call(db.objectStoreNames)\n" +
+        "            var stores = names.map(function(name) {\n" +
+        "                var store = db.transaction(name, 'readonly').objectStore(name)\n" +
+        "                var indexes = Array.prototype.slice.call(store.indexNames).map(function(n) {\n" +
+        "                    var index = store.index(n)\n" +
+        "                    return { name: n, keyPath: index.keyPath, unique: index.unique, multiEntry: index.multiEntry }\n" +
+        "                })\n" +
+        "                return Promise.all([req(store.getAllKeys()), req(store.getAll())]).then(function(r) {\n" +
+        "                    return { name: name, keyPath: store.keyPath, autoIncrement: store.autoIncrement, indexes: indexes,\n" +
+        "                             keys: store.keyPath === null ? r[0] : null, values: r[1] }\n" +
+        "                })\n" +
+        "            })\n" +
+        "            return Promise.all(stores).then(function(s) { db.close(); return { name: info.name, version: db.version, stores: s } })\n" +
+        "        })\n" +
+        "    }\n" +
+        "    var dbs = indexedDB.databases ? indexedDB.databases() : Promise.resolve([])\n" +
+        "    dbs.then(function(list) { return Promise.all(list.map(exportDb)) }).then(function(all) {\n" +
+        "        out.indexedDB = all\n" +
+        "        window.__stremioShellStorage = JSON.stringify(out)\n" +
+        "    }, function(e) { window.__stremioShellStorageError = String(e && e.message || e) })\n" +
+        "})()"
+
+    // Calls done(json) once the export is ready, or done(null) if it failed
+    function exportStorage(webView, done) {
+        webView.runJavaScript(exportSource, function() {
+            var tries = 0
+            var poll = function() {
+                webView.runJavaScript("[window.__stremioShellStorage, window.__stremioShellStorageError]", function(r) {
+                    if (r && r[0]) return done(r[0])
+                    if ((r && r[1]) || ++tries > 50) {
+                        console.log("Web UI storage: export failed: "+(r && r[1]))
+                        return done(null)
+                    }
+                    pollTimer(poll)
+                })
+            }
+            pollTimer(poll)
+        })
+    }
+
+    function pollTimer(cb) {
+        var timer = Qt.createQmlObject("import QtQuick 2.7; Timer { interval: 100 }", root)
+        timer.triggered.connect(function() { timer.destroy(); cb() })
+        timer.start()
+    }
+
+    // Source of a DocumentCreation script; keys the UI already has in the new origin are left alone, and an
+    // IndexedDB database is only filled in while it's created, in its upgrade transaction, which the UI's own
+    // open() waits for
+    function importSource(json, bundleUrl) {
+        return "(function(data) {\n" +
+            "    if (location.href.indexOf("+JSON.stringify(bundleUrl)+") !== 0) return\n" +
+            "    Object.keys(data.localStorage).forEach(function(k) { if (localStorage.getItem(k) === null) localStorage.setItem(k, data.localStorage[k]) })\n" +
+            "    data.indexedDB.forEach(function(db) {\n" +
+            "        var open = indexedDB.open(db.name, db.version)\n" +
+            "        open.onupgradeneeded = function(e) {\n" +
+            "            // Already there: the upgrade is undone, so the version the UI knows stays\n" +
+            "            if (e.oldVersion !== 0) return open.transaction.abort()\n" +
+            "            db.stores.forEach(function(s) {\n" +
+            "                var store = open.result.createObjectStore(s.name, { keyPath: s.keyPath, autoIncrement: s.autoIncrement })\n" +
+            "                s.indexes.forEach(function(i) { store.createIndex(i.name, i.keyPath, { unique: i.unique, multiEntry: i.multiEntry }) })\n" +
+            "                s.values.forEach(function(v, n) { if (s.keys) store.put(v, s.keys[n]); else store.put(v) })\n" +
+            "            })\n" +
+            "        }\n" +
+            "        open.onsuccess = function() { open.result.close() }\n" +
+            "        open.onerror = function(e) { e.preventDefault() }\n" +
+            "    })\n" +
+            "})("+json+")"
+    }
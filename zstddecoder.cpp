@@ -0,0 +1,43 @@
+#include "zstddecoder.h"
+
+ZstdDecoder::ZstdDecoder() : dctx(ZSTD_createDCtx()), buffer((int)ZSTD_DStreamOutSize(), 0) {
+    if (!dctx) err = "unable to create zstd context";
+}
+
+ZstdDecoder::~ZstdDecoder() {
+    ZSTD_freeDCtx(dctx);
+}
+
+bool ZstdDecoder::setPrefix(const char* data, size_t size) {
+    if (!dctx) return false;
+
+    // --patch-from raises the window to cover the whole old file, which is more than we accept by default
+    ZSTD_bounds bounds = ZSTD_dParam_getBounds(ZSTD_d_windowLogMax);
+    size_t r = ZSTD_DCtx_setParameter(dctx, ZSTD_d_windowLogMax, bounds.upperBound);
+    if (!ZSTD_isError(r)) r = ZSTD_DCtx_refPrefix(dctx, data, size);
+    if (ZSTD_isError(r)) {
+        err = ZSTD_getErrorName(r);
+        return false;
+    }
+    return true;
+}
+
+bool ZstdDecoder::feed(const char* data, size_t size, QByteArray &out) {
+    if (!dctx) return false;
+
+    ZSTD_inBuffer in = { data, size, 0 };
+    while (true) {
+        ZSTD_outBuffer chunk = { buffer.data(), (size_t)buffer.size(), 0 };
+        size_t r = ZSTD_decompressStream(dctx, &chunk, &in);
+        if (ZSTD_isError(r)) {
+            err = ZSTD_getErrorName(r);
+            return false;
+        }
+        out.append(buffer.constData(), (int)chunk.pos);
+        frameDone = r == 0;
+
+        // When the output buffer wasn't filled, everything that could be flushed has been
+        if (in.pos == in.size && chunk.pos < chunk.size) break;
+    }
+    return true;
+}
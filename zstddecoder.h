@@ -0,0 +1,36 @@
+#ifndef ZSTDDECODER_H
+#define ZSTDDECODER_H
+
+#include <QByteArray>
+#include <QString>
+
+#include <zstd.h>
+
+// Incremental zstd decompression; input can be fed in chunks of any size as it arrives
+class ZstdDecoder
+{
+public:
+    ZstdDecoder();
+    ~ZstdDecoder();
+
+    // For patches made with `zstd --patch-from=<old>`: the old file is the prefix of the (single) frame
+    // Must be set before the first feed(); the data must stay valid until decoding is done
+    bool setPrefix(const char* data, size_t size);
+
+    // Appends whatever could be decompressed to out; false on corrupt input
+    bool feed(const char* data, size_t size, QByteArray &out);
+
+    // True if the input so far ended exactly on a frame boundary
+    bool finished() const { return frameDone; }
+    QString error() const { return err; }
+
+private:
+    Q_DISABLE_COPY(ZstdDecoder)
+
+    ZSTD_DCtx* dctx;
+    QByteArray buffer;
+    bool frameDone = false;
+    QString err;
+};
+
+#endif // ZSTDDECODER_H